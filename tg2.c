@@ -2,20 +2,39 @@
  * tg.c generate WWV or IRIG signals for test
  */
 
+#define _GNU_SOURCE /* CPU affinity */
+#include <alsa/asoundlib.h>
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
 #include <portaudio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -28,7 +47,7 @@
 
 #define BUFLNG (400) /* buffer size */
 #define WWV (0)      /* WWV encoder */
-#define IRIG (1)     /* IRIG-B encoder */
+#define IRIG (1)     /* IRIG encoder, rate by IrigRate */
 #define OFF (0)      /* zero amplitude */
 #define LOW (1)      /* low amplitude */
 #define HIGH (2)     /* high amplitude */
@@ -45,9 +64,18 @@
 
 #define SECONDS_PER_MINUTE (60)
 #define SECONDS_PER_HOUR (3600)
+#define SECONDS_PER_DAY (86400)
 
 #define OUTPUT_DATA_STRING_LENGTH (200)
 
+#define RATE_DENOMINATOR (1000) /* sample rate resolution, 1 mHz */
+#define LONGEST_PULSE_MS (1010) /* long second used for rate correction */
+#define RENDER_ARENA_PULSES (4)  /* arena size, in longest pulses of samples */
+#define ARENA_ALIGNMENT (64)     /* cache line */
+
+#define WAVETABLE_BITS (10) /* log2 of wavetable entries per cycle */
+#define WAVETABLE_SIZE (1 << WAVETABLE_BITS)
+
 /*
  * Decoder operations at the end of each second are driven by a state
  * machine. The transition matrix consists of a dispatch table indexed
@@ -144,90 +172,745 @@ struct progx progx[] = {
 };
 
 /*
- * IRIG format frames (1000 Hz, 1 second for 10 frames of data)
+ * IRIG-B frame program (1000 Hz, 1 second for 10 frames of data),
+ * flattened to one entry for each of the 100 bits of the frame: the
+ * field the bit carries, and which bit of it.  The time fields are BCD,
+ * the control functions and straight binary seconds binary, each of them
+ * split over two frames.  The bits of the day hundreds that are always
+ * zero are slack: they can be sent short or long to correct the rate.
+ */
+#define IRIG_FRAME_BITS (100)
+#define IRIG_MARKER (-2) /* position identifier */
+#define IRIG_UNUSED (-1) /* always zero */
+#define IRIG_SECONDS (0)
+#define IRIG_MINUTES (1)
+#define IRIG_HOURS (2)
+#define IRIG_DAYS (3)
+#define IRIG_YEARS (4)   /* zero unless IrigIncludeYear */
+#define IRIG_CONTROL (5) /* control functions, IEEE 1344 */
+#define IRIG_SBS (6)     /* straight binary seconds */
+#define IRIG_FIELDS (7)
+#define IRIG_PARITY_POSITION (75) /* control functions bit 14, IEEE 1344 parity of the bits before it */
+
+struct IrigBit {
+  int field; /* IRIG_SECONDS to IRIG_SBS, or IRIG_MARKER or IRIG_UNUSED */
+  int bit;   /* bit of the field */
+  int slack; /* always zero, may be sent short or long */
+};
+
+struct IrigBit IrigProgram[IRIG_FRAME_BITS] = {
+    {IRIG_MARKER, 0, 0},   /* 0 on-time reference marker */
+    {IRIG_SECONDS, 0, 0},  /* 1 seconds units 1 */
+    {IRIG_SECONDS, 1, 0},  /* 2 seconds units 2 */
+    {IRIG_SECONDS, 2, 0},  /* 3 seconds units 4 */
+    {IRIG_SECONDS, 3, 0},  /* 4 seconds units 8 */
+    {IRIG_UNUSED, 0, 0},   /* 5 unused */
+    {IRIG_SECONDS, 4, 0},  /* 6 seconds tens 1 */
+    {IRIG_SECONDS, 5, 0},  /* 7 seconds tens 2 */
+    {IRIG_SECONDS, 6, 0},  /* 8 seconds tens 4 */
+    {IRIG_MARKER, 0, 0},   /* 9 P1 */
+    {IRIG_MINUTES, 0, 0},  /* 10 minutes units 1 */
+    {IRIG_MINUTES, 1, 0},  /* 11 minutes units 2 */
+    {IRIG_MINUTES, 2, 0},  /* 12 minutes units 4 */
+    {IRIG_MINUTES, 3, 0},  /* 13 minutes units 8 */
+    {IRIG_UNUSED, 0, 0},   /* 14 unused */
+    {IRIG_MINUTES, 4, 0},  /* 15 minutes tens 1 */
+    {IRIG_MINUTES, 5, 0},  /* 16 minutes tens 2 */
+    {IRIG_MINUTES, 6, 0},  /* 17 minutes tens 4 */
+    {IRIG_MINUTES, 7, 0},  /* 18 minutes tens 8 */
+    {IRIG_MARKER, 0, 0},   /* 19 P2 */
+    {IRIG_HOURS, 0, 0},    /* 20 hours units 1 */
+    {IRIG_HOURS, 1, 0},    /* 21 hours units 2 */
+    {IRIG_HOURS, 2, 0},    /* 22 hours units 4 */
+    {IRIG_HOURS, 3, 0},    /* 23 hours units 8 */
+    {IRIG_UNUSED, 0, 0},   /* 24 unused */
+    {IRIG_HOURS, 4, 0},    /* 25 hours tens 1 */
+    {IRIG_HOURS, 5, 0},    /* 26 hours tens 2 */
+    {IRIG_HOURS, 6, 0},    /* 27 hours tens 4 */
+    {IRIG_HOURS, 7, 0},    /* 28 hours tens 8 */
+    {IRIG_MARKER, 0, 0},   /* 29 P3 */
+    {IRIG_DAYS, 0, 0},     /* 30 days units 1 */
+    {IRIG_DAYS, 1, 0},     /* 31 days units 2 */
+    {IRIG_DAYS, 2, 0},     /* 32 days units 4 */
+    {IRIG_DAYS, 3, 0},     /* 33 days units 8 */
+    {IRIG_UNUSED, 0, 0},   /* 34 unused */
+    {IRIG_DAYS, 4, 0},     /* 35 days tens 1 */
+    {IRIG_DAYS, 5, 0},     /* 36 days tens 2 */
+    {IRIG_DAYS, 6, 0},     /* 37 days tens 4 */
+    {IRIG_DAYS, 7, 0},     /* 38 days tens 8 */
+    {IRIG_MARKER, 0, 0},   /* 39 P4 */
+    {IRIG_DAYS, 8, 0},     /* 40 days hundreds 1 */
+    {IRIG_DAYS, 9, 0},     /* 41 days hundreds 2 */
+    {IRIG_DAYS, 10, 1},    /* 42 days hundreds 4, always zero */
+    {IRIG_DAYS, 11, 1},    /* 43 days hundreds 8, always zero */
+    {IRIG_UNUSED, 0, 0},   /* 44 unused */
+    {IRIG_DAYS, 12, 1},    /* 45 days thousands 1, always zero */
+    {IRIG_DAYS, 13, 1},    /* 46 days thousands 2, always zero */
+    {IRIG_DAYS, 14, 1},    /* 47 days thousands 4, always zero */
+    {IRIG_DAYS, 15, 1},    /* 48 days thousands 8, always zero */
+    {IRIG_MARKER, 0, 0},   /* 49 P5 */
+    {IRIG_YEARS, 0, 0},    /* 50 years units 1 */
+    {IRIG_YEARS, 1, 0},    /* 51 years units 2 */
+    {IRIG_YEARS, 2, 0},    /* 52 years units 4 */
+    {IRIG_YEARS, 3, 0},    /* 53 years units 8 */
+    {IRIG_UNUSED, 0, 0},   /* 54 unused */
+    {IRIG_YEARS, 4, 0},    /* 55 years tens 1 */
+    {IRIG_YEARS, 5, 0},    /* 56 years tens 2 */
+    {IRIG_YEARS, 6, 0},    /* 57 years tens 4 */
+    {IRIG_YEARS, 7, 0},    /* 58 years tens 8 */
+    {IRIG_MARKER, 0, 0},   /* 59 P6 */
+    {IRIG_CONTROL, 0, 0},  /* 60 control functions bit 0 */
+    {IRIG_CONTROL, 1, 0},  /* 61 control functions bit 1 */
+    {IRIG_CONTROL, 2, 0},  /* 62 control functions bit 2 */
+    {IRIG_CONTROL, 3, 0},  /* 63 control functions bit 3 */
+    {IRIG_CONTROL, 4, 0},  /* 64 control functions bit 4 */
+    {IRIG_CONTROL, 5, 0},  /* 65 control functions bit 5 */
+    {IRIG_CONTROL, 6, 0},  /* 66 control functions bit 6 */
+    {IRIG_CONTROL, 7, 0},  /* 67 control functions bit 7 */
+    {IRIG_CONTROL, 8, 0},  /* 68 control functions bit 8 */
+    {IRIG_MARKER, 0, 0},   /* 69 P7 */
+    {IRIG_CONTROL, 9, 0},  /* 70 control functions bit 9 */
+    {IRIG_CONTROL, 10, 0}, /* 71 control functions bit 10 */
+    {IRIG_CONTROL, 11, 0}, /* 72 control functions bit 11 */
+    {IRIG_CONTROL, 12, 0}, /* 73 control functions bit 12 */
+    {IRIG_CONTROL, 13, 0}, /* 74 control functions bit 13 */
+    {IRIG_CONTROL, 14, 0}, /* 75 control functions bit 14, parity */
+    {IRIG_CONTROL, 15, 0}, /* 76 control functions bit 15 */
+    {IRIG_CONTROL, 16, 0}, /* 77 control functions bit 16 */
+    {IRIG_CONTROL, 17, 0}, /* 78 control functions bit 17 */
+    {IRIG_MARKER, 0, 0},   /* 79 P8 */
+    {IRIG_SBS, 0, 0},      /* 80 straight binary seconds 2^0 */
+    {IRIG_SBS, 1, 0},      /* 81 straight binary seconds 2^1 */
+    {IRIG_SBS, 2, 0},      /* 82 straight binary seconds 2^2 */
+    {IRIG_SBS, 3, 0},      /* 83 straight binary seconds 2^3 */
+    {IRIG_SBS, 4, 0},      /* 84 straight binary seconds 2^4 */
+    {IRIG_SBS, 5, 0},      /* 85 straight binary seconds 2^5 */
+    {IRIG_SBS, 6, 0},      /* 86 straight binary seconds 2^6 */
+    {IRIG_SBS, 7, 0},      /* 87 straight binary seconds 2^7 */
+    {IRIG_SBS, 8, 0},      /* 88 straight binary seconds 2^8 */
+    {IRIG_MARKER, 0, 0},   /* 89 P9 */
+    {IRIG_SBS, 9, 0},      /* 90 straight binary seconds 2^9 */
+    {IRIG_SBS, 10, 0},     /* 91 straight binary seconds 2^10 */
+    {IRIG_SBS, 11, 0},     /* 92 straight binary seconds 2^11 */
+    {IRIG_SBS, 12, 0},     /* 93 straight binary seconds 2^12 */
+    {IRIG_SBS, 13, 0},     /* 94 straight binary seconds 2^13 */
+    {IRIG_SBS, 14, 0},     /* 95 straight binary seconds 2^14 */
+    {IRIG_SBS, 15, 0},     /* 96 straight binary seconds 2^15 */
+    {IRIG_SBS, 16, 0},     /* 97 straight binary seconds 2^16 */
+    {IRIG_SBS, 17, 0},     /* 98 straight binary seconds 2^17 */
+    {IRIG_MARKER, 0, 0},   /* 99 P0 */
+};
+
+/*
+ * An encoded IRIG frame, bit n (1 = one, 0 = zero or marker) in
+ * bits[n / 64].
+ */
+struct IrigFrame {
+  uint64_t bits[2];
+};
+
+/*
+ * IRIG time-base rates.  All send symbols of 2, 5 and 8 tenths high, so
+ * the frame program and templates are shared and only the length of a
+ * tenth changes.  A and G also send tenths of seconds in the day
+ * thousands digit, and G hundredths in place of the year units.  E sends
+ * the same frame as B over 10 s; H a 60 bit minute frame starting with
+ * the minutes, hours and day in the places B has seconds, minutes and
+ * hours.  G's 100 kHz carrier can't be sampled, so it is sent as a DC
+ * level shift, with edges area-sampled to keep pulse widths exact.
+ */
+struct IrigRate {
+  char letter;     /* format designation */
+  int pps;         /* symbols per second */
+  int frame_bits;  /* symbols per frame */
+  int carrier;     /* Hz, 0 = DC level shift */
+  int subseconds;  /* decimal places of seconds sent: tenths, hundredths */
+};
+
+struct IrigRate IrigRates[] = {
+    {'A', 1000, 100, 10000, 1},
+    {'B', 100, 100, 1000, 0},
+    {'E', 10, 100, 1000, 0},
+    {'G', 10000, 100, 0, 2},
+    {'H', 1, 60, 1000, 0},
+};
+
+/*
+ * Carrier oscillators.  Each carrier frequency has a 64-bit phase
+ * increment per sample (2^64 is one cycle), set once at startup.  Carriers
+ * are only rendered into templates, each of which starts at phase zero on
+ * the on-time point (or a whole number of cycles after it), so the phase
+ * of a sample is the increment times its index in the template, and the
+ * on-time marker begins on a positive-going zero crossing.
+ */
+struct Oscillator {
+  int freq;           /* carrier frequency (Hz) */
+  uint64_t increment; /* phase advance per sample */
+};
+
+struct Oscillator Oscillators[] = {
+    {100, 0},   /* WWV/H data subcarrier */
+    {1000, 0},  /* IRIG-B/E/H carrier, WWV sync */
+    {1200, 0},  /* WWVH sync */
+    {1500, 0},  /* WWV/H hour sync */
+    {10000, 0}, /* IRIG-A carrier */
+};
+
+/*
+ * Output sample formats.  Templates are rendered straight into the format
+ * the output takes, the integer ones from wavetables already scaled to the
+ * LOW and HIGH amplitudes, so samples still go out as block copies.
+ * Integer samples are little-endian, and s24 is packed in 3 bytes.
+ */
+struct SampleFormat {
+  const char *name;      /* -F name */
+  int bytes;             /* bytes per sample */
+  int32_t full_scale;    /* largest integer sample, 0 for float */
+  PaSampleFormat pa;     /* PortAudio format */
+  snd_pcm_format_t alsa; /* ALSA format */
+};
+
+/* In the order a device is offered them when -F doesn't say. */
+struct SampleFormat SampleFormats[] = {
+    {"f32", 4, 0, paFloat32, SND_PCM_FORMAT_FLOAT},
+    {"s32", 4, 2147483647, paInt32, SND_PCM_FORMAT_S32_LE},
+    {"s24", 3, 8388607, paInt24, SND_PCM_FORMAT_S24_3LE},
+    {"s16", 2, 32767, paInt16, SND_PCM_FORMAT_S16_LE},
+};
+
+double Levels[] = {0., 0.25, 0.75}; /* OFF, LOW and HIGH amplitudes */
+
+/*
+ * Symbol waveform templates.  An IRIG second is made of 10 ms symbols and
+ * a WWV/H second of a tick, a 100 Hz data pulse and silence, so rather
+ * than synthesising every pulse the shapes are rendered once at startup
+ * and sent as block copies.  Every symbol starts a whole number of carrier
+ * cycles after the on-time point, so a template rendered from phase zero
+ * is phase continuous with its neighbours.
+ */
+struct Template {
+  void *samples; /* rendered waveform, in OutputFormat */
+  int length;    /* number of samples */
+  int us;        /* pulse time added so far */
+};
+
+/* IRIG symbols, indexed by [high tenths][total tenths - IRIG_SYMBOL_SHORT];
+ * the short and long symbols are only used for rate correction. */
+#define IRIG_SYMBOL_SHORT (9)
+#define IRIG_SYMBOL_LONG (11)
+struct Template IrigTemplates[M8 + 1][IRIG_SYMBOL_LONG - IRIG_SYMBOL_SHORT + 1];
+
+struct Template WwvTickTemplate;   /* 5 ms sync tick and 25 ms guard */
+struct Template WwvDataTemplate;   /* 100 Hz data pulse, long enough for PI; DATA0/1 send a prefix */
+struct Template WwvMinuteTemplate; /* minute sync pulse */
+struct Template WwvHourTemplate;   /* hour sync pulse */
+struct Template SilenceTemplate;   /* zeros for quiet times, up to a long second */
+
+/*
+ * Render arena.  Templates and other buffers used while generating are
+ * carved from one page-aligned block allocated and touched at startup, so
+ * in the steady state the generator makes no heap allocations and takes
+ * no page faults.  AllocationCount counts every heap allocation made
+ * through Allocate(); SteadyStateAllocations is the part of that made
+ * after startup, and should stay at zero however long the run.
+ */
+struct Arena {
+  char *base;  /* page-aligned block */
+  size_t size; /* bytes in block */
+  size_t used; /* bytes handed out */
+};
+
+/*
+ * Output ring for callback mode.  The generator loop is the only producer
+ * and the PortAudio callback the only consumer, so head and tail need no
+ * lock: the producer alone advances head, the callback alone advances tail.
+ * Both are free-running sample counts; the buffer index is the count
+ * modulo the (power of two) size.  The callback never waits: if the ring
+ * runs dry it pads with silence and counts an underrun.
+ */
+struct Ring {
+  char *samples;                           /* ring storage, in OutputFormat */
+  uint64_t size;                           /* samples, a power of two */
+  _Atomic uint64_t head;                   /* samples written by the generator */
+  _Atomic uint64_t tail;                   /* samples read by the callback */
+  _Atomic uint64_t consumer_min_fill;      /* lowest fill the callback has seen */
+  _Atomic unsigned long underruns;         /* callbacks short of samples */
+  _Atomic unsigned long underrun_samples;  /* silence padded in their place */
+  _Atomic unsigned long device_underflows; /* underflows reported by PortAudio */
+  _Atomic unsigned timing_sequence;        /* odd while the callback updates the timing below */
+  _Atomic uint64_t timing_sample;          /* first sample of the latest callback buffer */
+  _Atomic int64_t timing_dac_ns;           /* its outputBufferDacTime, stream time in ns */
+  uint64_t producer_min_fill;              /* lowest fill the generator has seen */
+  unsigned long producer_waits;            /* times the generator found the ring full */
+  _Atomic int pinned;                      /* callback thread pinned to OutputCpu: 0 not yet, else errno + 1 */
+};
+
+/*
+ * Render-ahead for blocking writes.  The generator renders each second
+ * into a slot and hands it to the device writer thread, then goes on to
+ * the next while that one plays: depth seconds queued behind the one
+ * being written, so up to depth + 1 seconds ahead of the device.  Between
+ * seconds the device waits on nothing but taking the next slot.
+ * Like OutputRing, one producer and one consumer, so the free-running
+ * slot counts need no lock, and either side waiting for the other takes
+ * a short sleep.  The writer publishes the DAC time of the next sample it
+ * writes, as the callback does, for EstimateDacTime().  A slot holds a
+ * long second; anything longer goes on into the next.
+ */
+struct AheadSlot {
+  char *samples; /* in OutputFormat */
+  int n;         /* samples rendered into it */
+};
+struct AheadQueue {
+  struct AheadSlot *slots;
+  int size;                          /* slots, depth + 1 */
+  int capacity;                      /* samples a slot holds */
+  int piece;                         /* samples in a write */
+  int depth;                         /* seconds queued behind the one being written, 0 for none */
+  int running;                       /* writer thread started */
+  _Atomic uint64_t head;             /* slots handed over by the generator */
+  _Atomic uint64_t tail;             /* slots written to the device */
+  _Atomic uint64_t written;          /* samples written to the device */
+  _Atomic unsigned timing_sequence;  /* odd while the writer updates the timing below */
+  _Atomic uint64_t timing_sample;    /* next sample the writer writes */
+  _Atomic int64_t timing_ns;         /* CLOCK_REALTIME when the write before it returned, ns */
+  _Atomic int64_t timing_latency_ns; /* device latency then */
+  _Atomic unsigned long starved;     /* slots the writer found not yet rendered */
+  uint64_t lowest;                   /* fewest samples ahead at a hand-over since the last report */
+  _Atomic int stop;                  /* writer should finish what is queued */
+  pthread_t thread;
+};
+#define AHEAD_DEFAULT_DEPTH (2) /* triple buffered */
+#define AHEAD_POLL_US (1000)    /* sleep waiting for a slot */
+#define AHEAD_WRITE_MS (10)     /* longest write, about a symbol as the generator wrote them */
+
+/*
+ * Output timing.  The latency is how far ahead of the DAC we are writing:
+ * the time from now until the next sample we write will be played.  In
+ * callback mode it is measured from the outputBufferDacTime of the latest
+ * callback, mapped onto the system clock through Pa_GetStreamTime(); with
+ * blocking writes, which return once the device queue is full, it is the
+ * stream's outputLatency.  A fixed -D delay overrides both.  Rendering
+ * ahead, it is measured by the writer thread as each write returns, and
+ * the seconds queued for it come on top.  From it we estimate when the
+ * first sample of each second actually reaches the DAC, and how far that
+ * is from the second it marks.
+ */
+struct OutputTiming {
+  double latency;       /* smoothed write-to-DAC latency (s) */
+  double reference;     /* system time (s) at which the first second sent should start */
+  double second_dac;    /* estimated system time (s) the last second started at the DAC */
+  double on_time_error; /* second_dac less the time it should have started (s) */
+  double ahead;         /* rendered ahead of the device at the last hand-over (s) */
+  int samples;          /* estimates taken */
+};
+#define LATENCY_SMOOTHING (16) /* time constant of the latency average, in estimates */
+
+/*
+ * Rate discipline.  The sound card's sample clock is not the system clock,
+ * so left alone the on-time marker drifts.  A phase/frequency-locked loop
+ * steers how many samples make up a second, through the timebase, to hold
+ * the measured on-time error at zero.  It first measures the frequency
+ * error for FLL_SECONDS, then closes a critically damped
+ * proportional-integral phase loop.  Callback mode measures the error
+ * from DAC timestamps, to microseconds, so can use a faster loop than
+ * blocking writes, whose return times jitter by a buffer.
+ */
+struct RateDiscipline {
+  double frequency;  /* integral path: sound card rate error (fraction) */
+  double correction; /* fractional rate correction in use */
+  double fll_error;  /* on-time error when frequency measurement started (s) */
+  int time_constant; /* phase loop time constant (s) */
+  int updates;       /* seconds disciplined */
+};
+#define FLL_SECONDS (8)                  /* seconds of frequency measurement before closing the loop */
+#define PLL_TIME_CONSTANT_CALLBACK (16)  /* s */
+#define PLL_TIME_CONSTANT_BLOCKING (64)  /* s */
+#define MAX_RATE_CORRECTION (500e-6)     /* steering limit, fraction of SampleRate */
+
+/*
+ * Saved clock state.  What the discipline learns about a sound card, its
+ * rate error and the output latency, is kept in a file, a line for each
+ * device, sample rate and output mode, so the next run can start locked
+ * instead of measuring the rate all over again.  State that is too old,
+ * or whose latency no longer matches what the device reports, is ignored.
+ * The generator publishes the values; the log writer saves them.
+ */
+struct ClockState {
+  const char *path;         /* state file, NULL for none */
+  const char *device;       /* device name, as the device gives it */
+  const char *mode;         /* output mode, callback, blocking or alsa */
+  _Atomic double frequency; /* rate error to save, fraction */
+  _Atomic double latency;   /* ... and latency (s) */
+  _Atomic int due;          /* saving them is wanted */
+};
+#define STATE_MAX_AGE (7 * SECONDS_PER_DAY) /* s */
+#define STATE_LATENCY_TOLERANCE (0.005)     /* s */
+#define STATE_SAVE_SECONDS (60)             /* between saves while locked */
+#define STATE_LINE (512)                    /* longest line in the file */
+
+/*
+ * Offline rendering.  Instead of pacing output by the sound card, samples
+ * are written to a file as fast as they can be made.  A WAV file starts
+ * with a JUNK chunk big enough to become a ds64 chunk, so a render past
+ * the 4 GB RIFF limit can be turned into RF64 when the file is closed.
+ */
+struct RenderTarget {
+  FILE *fp;       /* output, NULL when playing to a device */
+  int wav;        /* write a WAV header */
+  int part;       /* writing one chunk of a batch job in place */
+  uint64_t bytes; /* sample data written */
+};
+#define WAVE_FORMAT_PCM (1)
+#define WAVE_FORMAT_IEEE_FLOAT (3)
+#define WAV_HEADER_BYTES (80) /* RIFF, JUNK/ds64, fmt and data chunk headers */
+
+/*
+ * Output sinks.  Emit() hands each buffer to every sink in turn.  The
+ * first is the device, or the render file, written in place; the rest
+ * are added with -O and written by a sink thread, so a slow consumer
+ * never holds up the device.  Every buffer passed to Emit() is a template
+ * or silence in the render arena, which is not written again once
+ * rendered, so a queued sink is given a reference to the samples, not a
+ * copy: its queue holds one struct iovec per buffer, gathered into a
+ * writev(), or a vmsplice() when the output is a pipe, which maps the
+ * pages into it without copying at all.  An entry with a NULL base marks
+ * the start of a second, with the time (seconds since 2000) as its
+ * length; capture files rotate on these, so each starts on a second.
+ *
+ * While playing, a full queue drops samples (and counts them) rather than
+ * stall the generator; a render waits for room instead.
+ */
+struct Sink {
+  const char *name;                                  /* for messages */
+  void (*write)(struct Sink *, const void *, int);  /* given each buffer by Emit() */
+  void (*flush)(struct Sink *, struct iovec *, int); /* write out queued buffers, on the sink thread */
+  void (*mark)(struct Sink *, int64_t);              /* a second starts, NULL if not wanted */
+  struct iovec *queue;                               /* buffers waiting for the sink thread */
+  uint64_t size;                                     /* entries in queue, a power of two */
+  _Atomic uint64_t head;                             /* entries queued by the generator */
+  _Atomic uint64_t tail;                             /* entries written by the sink thread */
+  _Atomic unsigned long dropped;                     /* samples not queued, with the queue full */
+  int fd;                                            /* output, -1 for none */
+  int pipe;                                          /* fd is a pipe, so can be spliced into */
+  const char *path;                                  /* capture file name prefix */
+  int rotate;                                        /* seconds per capture file */
+  int64_t second;                                    /* last second marked */
+  uint64_t bytes;                                    /* written, by the sink thread */
+};
+#define MAX_SINKS (4)
+#define SINK_QUEUE_ENTRIES (1 << 16) /* seconds of buffers, even at IRIG G */
+#define SINK_BATCH (64)              /* buffers per writev() or vmsplice(), well inside IOV_MAX */
+#define SINK_POLL_MS (10)            /* sink thread sleep with nothing queued */
+#define SINK_CAPTURE_SECONDS (3600)  /* default capture file length */
+#define SINK_STDOUT "stdout"
+#define SINK_CAPTURE_PREFIX "capture:"
+
+/*
+ * Control socket.  A thread takes commands, a line at a time, on a Unix
+ * socket, and hands the generator a complete copy of the parameters they
+ * set through a triple buffer: it fills its back slot and swaps it for
+ * the middle one, and the generator, at each frame boundary, swaps its
+ * front slot for the middle one if that is fresh.  Neither ever waits
+ * for the other.  Each group of parameters has a generation, bumped by a
+ * command that sets it, so the generator only applies what changed.
+ */
+enum ControlGroup { CONTROL_LEAP, CONTROL_DST, CONTROL_QUALITY, CONTROL_OFFSET, CONTROL_GROUPS };
+
+struct ControlParams {
+  unsigned generation[CONTROL_GROUPS]; /* times each group has been set */
+  unsigned sequence;                   /* commands applied, all groups */
+  int insert_leap;                     /* leap second at the end of the minute below */
+  int delete_leap;                     /* ... or one left out */
+  int leap_year;                       /* year, day, hour and minute of the leap */
+  int leap_day;
+  int leap_hour;
+  int leap_minute;
+  int dst_switch;                      /* DST switch at the start of the minute below */
+  int dst_year;                        /* year, day, hour and minute of the switch */
+  int dst_day;
+  int dst_hour;
+  int dst_minute;
+  unsigned quality;                    /* IEEE 1344 time quality */
+  int offset_sign;                     /* IEEE 1344 time offset */
+  int offset_ones;
+  int offset_half;
+};
+
+struct ControlPlane {
+  const char *path;               /* socket path, NULL for none */
+  int fd;                         /* listening socket */
+  pthread_t thread;               /* control thread */
+  _Atomic int stop;               /* control thread should finish */
+  struct ControlParams slots[3];  /* triple buffer */
+  _Atomic int middle;             /* slot between the two, | CONTROL_FRESH until taken */
+  int back;                       /* slot the control thread fills */
+  int front;                      /* slot the generator reads */
+  struct ControlParams requested; /* control thread's copy, as last set */
+  _Atomic unsigned applied;       /* sequence the generator has applied */
+};
+#define CONTROL_FRESH (4)     /* middle slot flag */
+#define CONTROL_POLL_MS (100) /* control thread wait for a command, between checks for stop */
+#define CONTROL_LINE (256)    /* longest command */
+
+/*
+ * Leap second and DST schedule.  Leap seconds come from a
+ * leap-seconds.list (-e) and DST switches from a tzdata zone (-Z), and
+ * both go in one table of events sorted by the minute they happen in, in
+ * the time sent.  The generator compares the minute now only with when
+ * the next event is due, and arms it the minute before, as if given by
+ * -i/-b or -g.  The log writer looks at the files every few seconds and,
+ * if one has changed, builds the table again and hands it over through a
+ * triple buffer, as the control socket does.
+ */
+enum EventKind { EVENT_LEAP_INSERT, EVENT_LEAP_DELETE, EVENT_DST_ON, EVENT_DST_OFF };
+struct ScheduleEvent {
+  int64_t at;  /* start of the minute it happens in, s since 2000 in the time sent */
+  int64_t utc; /* ... and the instant, s since 2000 UTC */
+  int kind;    /* enum EventKind */
+  int offset;  /* zone's UTC offset from then on (s), for DST switches */
+};
+#define SCHEDULE_EVENTS (512)
+struct EventTable {
+  int count;
+  struct ScheduleEvent events[SCHEDULE_EVENTS];
+};
+struct EventSchedule {
+  const char *leap_path;      /* leap-seconds.list, NULL for none */
+  const char *zone;           /* tzdata zone, NULL for none */
+  char zone_path[PATH_MAX];   /* ... and its file */
+  int offset;                 /* s from UTC to the time sent, without a zone (-l) */
+  int zone_offset;            /* zone's UTC offset before its first switch (s) */
+  struct timespec leap_mtime; /* files as last loaded */
+  struct timespec zone_mtime;
+  time_t checked;             /* log writer last looked at them */
+  struct EventTable slots[3]; /* triple buffer */
+  _Atomic int middle;         /* slot between the two, | SCHEDULE_FRESH until taken */
+  int back;                   /* slot the log writer fills */
+  int front;                  /* slot the generator reads */
+  int next;                   /* generator's next event to arm in the front slot */
+};
+#define SCHEDULE_FRESH (4)            /* middle slot flag */
+#define SCHEDULE_CHECK_SECONDS (10)   /* between looks at the files */
+#define SCHEDULE_LAST_YEAR (99)       /* zone rules are followed to the end of the century */
+#define SCHEDULE_LINE (256)           /* longest leap-seconds.list line read */
+#define ZONE_FILE_MAX (65536)         /* largest TZif file */
+#define ZONEINFO_DIR "/usr/share/zoneinfo"
+#define UNIX_TO_2000 (946684800LL)    /* s from 1970 to 2000 */
+#define NTP_TO_2000 (3155673600LL)    /* s from 1900 to 2000 */
+#define NO_EVENT INT64_MAX            /* event time for none */
+
+/*
+ * Where a run is, so many seconds after it starts: the time sent, and the
+ * leap second and DST state, found by stepping from one event to the next
+ * rather than a second at a time, so a render can start anywhere.
  */
+struct CalendarSeek {
+  int64_t at;      /* time sent, s since 2000 */
+  int leap_second; /* ... is followed by second 60, which is where it is */
+  int dst;         /* DST in effect, as the run starts and then as found */
+  int steps;       /* DST switches passed, +1 for each forward, -1 back */
+  int switched;    /* the -g switch is among them */
+};
 
 /*
- * IRIG format frame 10 - MS straight binary seconds
+ * Batch rendering.  A manifest lists jobs, one per line: the output file
+ * followed by the tg2 options for it, which must include -y and -c.  Each
+ * job is cut into chunks of seconds, and each chunk is rendered by a tg2
+ * child process that seeds its time, leap and DST state directly from
+ * the chunk's start and writes its samples in place in the job's file.
+ * The timebase is exact, so the chunks join with no seam and the file is
+ * the same as one rendered in a single run.
+ *
+ * Chunks are spread over a pool of worker threads, each with its own
+ * queue.  A worker takes chunks from the front of its own queue and, once
+ * that is empty, steals from the back of another's, so the pool stays
+ * busy whatever the mix of job lengths.
  */
-struct progx progu[] = {
-    {COEF, 2},   /* 0 0x0 0200 seconds */
-    {COEF, 4},   /* 1 0x0 0400 */
-    {COEF, 8},   /* 2 0x0 0800 */
-    {DECC, 1},   /* 3 0x0 1000 */
-    {COEF, 2},   /* 4 0x0 2000 */
-    {COEF, 4},   /* 6 0x0 4000 */
-    {COEF, 8},   /* 7 0x0 8000 */
-    {DECC, 1},   /* 8 0x1 0000 */
-    {COEF, 2},   /* 9 0x2 0000 - but only 86,401 / 0x1 5181 seconds in a day, so
-                    always zero */
-    {NODEC, M8}, /* 9 PI */
+struct BatchJob {
+  char *path;         /* output file */
+  char **argv;        /* tg2 options for the job, NULL terminated */
+  int argc;           /* entries in argv */
+  int seconds;        /* length of the job */
+  int split;          /* can be rendered in independent chunks */
+  _Atomic int failed; /* a chunk of the job failed */
+};
+
+struct BatchChunk {
+  struct BatchJob *job;
+  int first; /* first second of the job in the chunk */
+  int count; /* seconds in the chunk */
+};
+
+struct WorkQueue {
+  pthread_mutex_t lock;
+  struct BatchChunk *chunks; /* this worker's share of the chunks */
+  int front;                 /* next chunk for the owner */
+  int back;                  /* one past the next chunk to steal */
+  int rendered;              /* chunks rendered by the owner */
+  int steals;                /* ... of which stolen from other queues */
 };
+#define BATCH_CHUNK_SECONDS (600) /* long enough that starting a child is noise */
 
 /*
- * IRIG format frame 8 - MS control functions
+ * ALSA output.  A device named "alsa:" and an ALSA PCM (alsa:hw:0, or
+ * alsa:null to try it without hardware) bypasses PortAudio: each block is
+ * copied straight into the device's mmap ring, the only copy between the
+ * templates and the DAC.  The driver timestamps its position on
+ * CLOCK_MONOTONIC, so the DAC time of the next sample written is the
+ * timestamp plus the delay, the frames queued ahead of it including the
+ * codec's own, rather than inferred from when a blocking write returned.
  */
-struct progx progv[] = {
-    {COEF, 2}, /*  0 CF # 19 */
-    {COEF, 4}, /*  1 CF # 20 */
-    {COEF, 8}, /*  2 CF # 21 */
-    {DECC, 1}, /*  3 CF # 22 */
-    {COEF, 2}, /*  4 CF # 23 */
-    {COEF, 4}, /*  6 CF # 24 */
-    {COEF, 8}, /*  7 CF # 25 */
-    {DECC, 1}, /*  8 CF # 26 */
-    {COEF, 2}, /*  9 CF # 27 */
-    {DEC, M8}, /* 10 PI */
+struct AlsaOutput {
+  snd_pcm_t *pcm;                  /* NULL when not in use */
+  snd_pcm_uframes_t buffer_frames; /* device ring */
+  snd_pcm_uframes_t period_frames; /* ... and its wakeup interval */
 };
+#define ALSA_PREFIX "alsa:"
+#define ALSA_BUFFER_US (100000)
+#define ALSA_PERIOD_US (10000)
+#define ALSA_WAIT_MS (1000) /* longest wait for room in the ring before trying again */
 
 /*
- * IRIG format frames 7 & 9 - LS control functions & LS straight binary seconds
+ * RTP output, for AES67 and other network audio receivers.  A device
+ * named "rtp:host:port", with ":L16" or ":L24" (the default) after it,
+ * sends the samples as big-endian PCM over UDP, a packet a millisecond.
+ * There is no sound card clock: each packet is sent when its first
+ * sample is due by the system clock, which makes that the media clock.
+ * The stream starts on a whole sample of it, and the RTP timestamp of a
+ * sample is its time on it, in samples, modulo 2^32: the start time
+ * times the rate, plus the sample's distance from the start in
+ * SampleClock.  A receiver sharing the clock (by PTP, or on the same
+ * host) can then place the on-time marker to the sample.
  */
-struct progx progw[] = {
-    {COEF, 1},   /*  0  CF # 10, 0x0 0001 seconds */
-    {COEF, 2},   /*  1  CF # 11, 0x0 0002 */
-    {COEF, 4},   /*  2  CF # 12, 0x0 0004 */
-    {COEF, 8},   /*  3  CF # 13, 0x0 0008 */
-    {DECC, 1},   /*  4  CF # 14, 0x0 0010 */
-    {COEF, 2},   /*  6  CF # 15, 0x0 0020 */
-    {COEF, 4},   /*  7  CF # 16, 0x0 0040 */
-    {COEF, 8},   /*  8  CF # 17, 0x0 0080 */
-    {DECC, 1},   /*  9  CF # 18, 0x0 0100 */
-    {NODEC, M8}, /* 10  PI */
+struct RtpOutput {
+  int fd;                /* connected UDP socket, -1 when not in use */
+  int bytes;             /* per sample, 2 for L16, 3 for L24 */
+  int payload_type;      /* dynamic, as the SDP printed at startup maps it */
+  int packet_samples;    /* samples in a packet */
+  unsigned char *packet; /* header and payload being filled */
+  int filled;            /* samples in the payload so far */
+  uint16_t sequence;     /* of the next packet */
+  uint32_t ssrc;         /* random, per stream */
+  uint64_t first;        /* SampleClock of the first sample sent */
+  uint64_t sample;       /* ... and of the first in the packet */
+  uint64_t origin;       /* media clock (samples) at the first sample */
+  struct timespec start; /* CLOCK_MONOTONIC the first sample is due */
+  uint64_t packets;      /* sent */
+  uint64_t late;         /* ... of which a packet time or more after they were due */
+  uint64_t errors;       /* sends that failed, for want of a receiver say */
 };
+#define RTP_PREFIX "rtp:"
+#define RTP_HEADER_BYTES (12)
+#define RTP_PAYLOAD_L24 (96)
+#define RTP_PAYLOAD_L16 (97)
+#define RTP_PACKET_US (1000)  /* AES67 packet time */
+#define RTP_START_US (100000) /* from opening the stream to its first sample, for the rest of startup */
+#define RTP_DSCP (34)         /* AF41, the AES67 default for media */
+
+/*
+ * Real-time setup of the generator thread.  -R runs it under SCHED_FIFO
+ * or SCHED_RR, -K locks all memory, with the stack prefaulted (the heap
+ * is the prefaulted render arena), and -A pins the generator, and in
+ * callback mode the PortAudio callback thread, to CPUs.  The writer
+ * threads are started first, so don't inherit any of it.  Each step that
+ * fails, usually for want of privilege or rlimit, warns and is skipped:
+ * the time code still runs, with less margin.
+ */
+#define REALTIME_DEFAULT_PRIORITY (50)
+#define STACK_PREFAULT_BYTES (256 * 1024)
 
 /*
- * IRIG format frames 2 to 6 - minutes, hours, days, hundreds days, 2 digit
- * years (also called control functions bits 1-9)
- */
-struct progx progy[] = {
-    {COEF, 1},  /* 0 1 units, CF # 1 */
-    {COEF, 2},  /* 1 2 units, CF # 2 */
-    {COEF, 4},  /* 2 4 units, CF # 3 */
-    {COEF, 8},  /* 3 8 units, CF # 4 */
-    {DECZ, M2}, /* 4 zero bit, CF # 5 / unused, default zero in years */
-    {COEF, 1},  /* 5 10 tens, CF # 6 */
-    {COEF, 2},  /* 6 20 tens, CF # 7*/
-    {COEF, 4},  /* 7 40 tens, CF # 8*/
-    {COEF, 8},  /* 8 80 tens, CF # 9*/
-    {DEC, M8},  /* 9 PI */
+ * Metrics.  Once a second the generator fills in a snapshot of its health
+ * and publishes it through a triple buffer: it writes the back buffer,
+ * then swaps it with the middle one in a single atomic exchange.  The
+ * writer thread swaps the middle buffer for its front one when there is a
+ * new one there, and writes it out as a Prometheus text file (for
+ * node_exporter's textfile collector), replaced by a rename so a scrape
+ * never sees half of it.  Neither side ever waits for the other, and the
+ * generator does no I/O.  Blocking write times go straight into log2
+ * buckets, which the snapshot copies; they and the underflows are counted
+ * by whichever thread writes to the device, so are atomic.
+ */
+#define METRICS_WRITE_BUCKETS (20) /* blocking write time buckets, le 1 us << n */
+#define METRICS_FRESH (4)          /* flag in Metrics.middle: not yet taken by the writer */
+struct MetricsSnapshot {
+  uint64_t seconds_sent;
+  uint64_t samples;
+  unsigned long underflows;                   /* write or device underflows */
+  unsigned long ring_underruns;               /* callbacks padded with silence */
+  unsigned long log_dropped;                  /* log messages dropped */
+  unsigned long sink_dropped;                 /* samples dropped by -O sinks */
+  double on_time_error;                       /* s, against the system clock */
+  double latency;                             /* s */
+  double look_ahead;                          /* s rendered ahead of the device */
+  unsigned long device_starved;               /* slots the device writer waited for */
+  double sound_card_error;                    /* sound card rate error, fraction */
+  double correction;                          /* rate correction in use, fraction */
+  int discipline_state;                       /* 0 off, 1 measuring, 2 locked */
+  int cycles_added, cycles_removed;           /* -k rate correction */
+  int leap_pending, leap_delete, dst, dst_pending, time_quality;
+  uint64_t writes[METRICS_WRITE_BUCKETS + 1]; /* blocking writes by time, last over the top bucket */
+  double write_seconds;                       /* ... and their total time */
+};
+
+struct Metrics {
+  const char *path;                                   /* text file, NULL for none */
+  struct MetricsSnapshot buffers[3];                  /* back, middle and front, by the indices below */
+  int back;                                           /* generator's */
+  _Atomic int middle;                                 /* latest published, | METRICS_FRESH until taken */
+  int front;                                          /* writer's */
+  _Atomic uint64_t writes[METRICS_WRITE_BUCKETS + 1]; /* running counts */
+  _Atomic int64_t write_ns;
+  _Atomic unsigned long underflows;
+  uint64_t seconds_sent;
+  _Atomic int stop;                                   /* writer thread should finish */
+  pthread_t thread;
 };
+#define METRICS_INTERVAL_MS (1000)
 
 /*
- * IRIG format first frame, frame 1 - seconds
+ * Logging.  Once the generator is running it never writes to stdout
+ * itself, as a slow console or a stalled pipe would hold up the sound
+ * card: Log() formats the message and copies it into a byte ring, and a
+ * writer thread copies the ring out.  As with OutputRing there is one
+ * producer and one consumer, so the free-running counts need no lock.
+ * If the ring is full the message is dropped and counted instead of
+ * waiting.  With -L, a compact binary record of each second goes to a
+ * file through a ring of its own.  Renders have no deadline to miss, so
+ * write straight out.
  */
-struct progx progz[] = {
-    {MIN, M8},  /* 0 PI (on-time marker for the second at zero cross of 1st cycle) */
-    {COEF, 1},  /* 1 1 units */
-    {COEF, 2},  /* 2 2 */
-    {COEF, 4},  /* 3 4 */
-    {COEF, 8},  /* 4 8 */
-    {DECZ, M2}, /* 5 zero bit */
-    {COEF, 1},  /* 6 10 tens */
-    {COEF, 2},  /* 7 20 */
-    {COEF, 4},  /* 8 40 */
-    {DEC, M8},  /* 9 PI */
+struct LogRing {
+  char *bytes;                   /* ring storage */
+  uint64_t size;                 /* bytes, a power of two */
+  _Atomic uint64_t head;         /* bytes written by the generator */
+  _Atomic uint64_t tail;         /* bytes written out */
+  _Atomic unsigned long dropped; /* messages dropped with the ring full */
+  FILE *fp;                      /* where the writer sends them */
+};
+#define LOG_RING_BYTES (1 << 16)  /* a few seconds of the most verbose output */
+#define LOG_MESSAGE_BYTES (512)   /* longest message, longer ones are cut short */
+#define LOG_POLL_MS (10)          /* writer's sleep with nothing to write */
+#define LOG_MAGIC "TG2LOG1\n"     /* -L file header */
+
+/* -L record of a second, in host byte order. */
+struct LogRecord {
+  uint64_t sample;          /* first sample of the second */
+  int32_t on_time_error_ns; /* estimated on-time error */
+  int32_t correction_ppb;   /* rate correction in use */
+  uint32_t control;         /* IRIG control functions, 0 for WWV */
+  uint32_t dropped;         /* text messages dropped so far */
+  uint16_t year;            /* of the century */
+  uint16_t day_of_year;
+  uint8_t hour, minute, second;
+  uint8_t flags; /* LOG_ values */
 };
+#define LOG_LEAP_PENDING (0x1)
+#define LOG_LEAP_DELETE (0x2)
+#define LOG_DST (0x4)
+#define LOG_DST_PENDING (0x8)
+#define BENCH_ENCODE_FRAMES (1000000) /* frames encoded on their own to time the encoder */
+#define TG2_OPTIONS "a:A:b:B:c:C:dD:e:f:F:g:hHi:I:jJ:k:Kl:L:mM:N:o:O:P:q:r:R:sS:tu:U:w:xy:zZ:?"
 
 /* LeapState values. */
 #define LEAPSTATE_NORMAL (0)
@@ -241,12 +924,138 @@ struct progx progz[] = {
 void WWV_Second(int, int);                     /* send second */
 void WWV_SecondNoTick(int, int);               /* send second with no tick */
 void digit(int);                               /* encode digit */
-void peep(int, int, int);                      /* send cycles */
+void Emit(const void *, int);                  /* write samples to the stream */
+void DeviceWrite(struct Sink *, const void *, int); /* Sink: the PortAudio or ALSA device */
+void WriteDevice(const void *, int);           /* Blocking write to it */
+double DeviceLatency(void);                    /* Time until the next sample written to it is played */
+void RenderWrite(struct Sink *, const void *, int); /* Sink: the render file */
+void QueueSamples(struct Sink *, const void *, int); /* Sink: queue a reference for the sink thread */
+void AddSink(const char *);                    /* Add an -O sink */
+int PushSink(struct Sink *, const void *, size_t); /* Queue an entry, returns FALSE if dropped */
+void MarkSinks(int64_t);                       /* Tell the sinks a second starts */
+void PipeFlush(struct Sink *, struct iovec *, int);    /* Write buffers to stdout */
+void CaptureFlush(struct Sink *, struct iovec *, int); /* ... or to the capture file */
+void CaptureMark(struct Sink *, int64_t);      /* Rotate the capture file */
+void StartSinks(void);                         /* Start the sink thread, if there are queued sinks */
+void StopSinks(void);                          /* Write out what is queued, and stop */
+void *SinkWriter(void *);                      /* Sink thread */
+void StartControl(void);                       /* Listen on the control socket */
+void StopControl(void);                        /* Stop the control thread, and remove the socket */
+void *ControlServer(void *);                   /* Control thread */
+void ServeControl(int);                        /* Take commands from a client */
+void ControlCommand(const char *, char *, size_t); /* Carry out a command, with a reply */
+int ParseControlMinute(const char *, int *, int *, int *, int *); /* yymmddhhmm to year, day, hour, minute */
+void PublishControl(void);                     /* Hand the generator the parameters as requested */
+const struct ControlParams *TakeControl(void); /* Parameters, if changed since last taken */
+void StartSchedule(void);                      /* Load the leap second and zone files */
+int LoadSchedule(struct EventTable *);         /* Build a table of events from them, FALSE if one can't be read */
+int LoadLeapSeconds(struct EventTable *);      /* ... leap seconds from leap-seconds.list */
+int LoadZone(struct EventTable *);             /* ... DST switches from a TZif file */
+void AddZoneRules(struct EventTable *, const char *, int64_t); /* ... and from its TZ rule after the table ends */
+int AddEvent(struct EventTable *, int64_t, int64_t, int, int); /* Add an event, FALSE if the table is full */
+int ZoneOffset(const struct EventTable *, int64_t); /* s from UTC to the time sent, at a UTC time */
+int CompareEvents(const void *, const void *);
+void CheckSchedule(void);                      /* Log writer: load the files again if they've changed */
+const struct EventTable *TakeSchedule(void);   /* Generator: table, if changed since last taken */
+int FirstEvent(const struct EventTable *, int64_t); /* Index of the first event at or after a time */
+int64_t ScheduleArmTime(void);                 /* When the next event is armed, NO_EVENT for never */
+int DrainSink(struct Sink *);                  /* Write out a sink's queue, returns entries written */
+void InitRing(int);                            /* Allocate the callback mode ring */
+void OpenAudioDevice(const char *);            /* Open the PortAudio stream */
+void OpenAlsaDevice(const char *);             /* ... or an ALSA PCM, for mmap output */
+void StartAlsaDevice(void);
+void AlsaWrite(const void *, int);             /* Copy samples into the mmap ring */
+void AlsaRecover(int);                         /* Recover from an underrun or suspend */
+double AlsaLatency(void);                      /* Time until the next sample written is played, NAN if unknown */
+void CloseAlsaDevice(void);                    /* Play out what is queued, and close */
+void OpenRtpDevice(const char *);              /* ... or an RTP stream to a network receiver */
+void StartRtpDevice(void);
+void RtpWrite(const void *, int);              /* Packetize samples, sending each packet when due */
+void SendRtpPacket(void);                      /* Wait until the packet is due, and send it */
+double RtpLatency(void);                       /* Time until the next sample written is due */
+void CloseRtpDevice(void);                     /* Send what is left, and close */
+void StartAudioDevice(void);                   /* Start it, ready to align to the second */
+void OpenRenderFile(const char *);             /* Open a file to render to */
+void WriteWavHeader(void);                     /* (Re)write the WAV header for bytes so far */
+void CloseRenderFile(void);
+void PlaceRenderChunk(uint64_t, uint64_t);      /* Seek to a batch chunk's samples in the file */
+uint64_t TimebaseSamples(uint64_t, uint64_t *); /* Samples sent in the first seconds of a run */
+int64_t CalendarToSeconds(int, int, int, int, int); /* Year, day of year, time to seconds since 2000 */
+int DaysInYear(int);                            /* 365 or 366 */
+void SeekCalendar(struct CalendarSeek *, int64_t, int64_t, int64_t, int, int64_t); /* Where a run is after n seconds */
+void SecondsToCalendar(int64_t, int *, int *, int *, int *, int *);
+void StepOffsetHour(int, int *, int *, int);    /* Move the IEEE 1344 offset an hour for DST */
+void SetTimeOffset(float, int *, int *, int *); /* IEEE 1344 offset fields for +/- hours */
+int BatchRender(const char *, int);             /* Render a manifest of jobs, returns exit status */
+void *BatchWorker(void *);
+int TakeChunk(int, struct BatchChunk *);        /* Next chunk for a worker, own or stolen */
+void RunChunk(const struct BatchChunk *);       /* Render a chunk in a child tg2 */
+void RingWrite(const void *, int);             /* Queue samples for the callback */
+void DrainRing(void);                          /* Wait for the callback to empty the ring */
+void PrintRingStatistics(void);
+void StartAhead(void);                         /* Allocate the render-ahead slots and start the device writer */
+void StopAhead(void);                          /* Hand over the last second, write out what is queued, and stop */
+void *AheadWriter(void *);                     /* Device writer thread */
+void QueueAhead(const void *, int);            /* Copy samples into the slot being rendered */
+void PassAhead(void);                          /* Hand the slot over, and wait for the next to come free */
+void PublishAheadTiming(uint64_t);             /* When the next sample written reaches the DAC */
+void PrintAheadStatistics(void);
+void SetupRealtime(void);                      /* Scheduling, memory locking and pinning, as asked */
+const char *PolicyName(int);                   /* Name of a scheduling policy */
+void PrefaultStack(void);                      /* Touch the stack so it is all mapped */
+int OutputCallback(const void *, void *, unsigned long, const PaStreamCallbackTimeInfo *, PaStreamCallbackFlags,
+                   void *);
 int ConvertMonthDayToDayOfYear(int, int, int); /* Calc day of year from year month & day */
 void Help(void);                               /* Usage message */
-void ReverseString(char *);
-void Delay(long ms);
-size_t strlcat(char *dst, const char *src, size_t size);
+uint32_t Bcd(int);                             /* Binary coded decimal of value */
+void EncodeIrigFrame(struct IrigFrame *, const uint32_t *); /* Pack fields into a frame */
+int EncodeIrigTime(struct IrigFrame *, int, int, int, int, int, int, int); /* Frame for a time, returns parity */
+int IrigParity(const struct IrigFrame *);      /* IEEE 1344 parity of a frame */
+void EmitSilence(uint64_t);                    /* Send silence outside the timebase */
+double EstimateDacTime(uint64_t);              /* System time a sample reaches the DAC */
+void PrintTiming(void);
+void PrintBenchmark(double, uint64_t, int, int, int); /* Machine-readable results of a -m run */
+double EncodeBenchmark(int, int);                     /* ns to encode a frame in a year and day */
+void StartMetrics(void);                       /* Start writing metrics to the -M file */
+void PublishMetrics(int, int, int, int, int);  /* Publish a snapshot, with the leap, DST and quality state */
+void StopMetrics(void);                        /* Write the last snapshot and stop */
+void *MetricsWriter(void *);                   /* Writer thread */
+void WriteMetrics(const struct MetricsSnapshot *);
+void Log(const char *, ...);                   /* printf, through the log ring once started */
+void LogSecond(uint64_t, int, int, int, int, int, int, int); /* Binary record of a second */
+void InitLogRing(struct LogRing *, FILE *);    /* Allocate a log ring writing to a file */
+int LogPush(struct LogRing *, const void *, size_t); /* Queue bytes, or drop them if full */
+void StartLog(void);                           /* Start the log writer thread */
+void StopLog(void);                            /* Write out what is queued, and stop */
+void *LogWriter(void *);                       /* Writer thread */
+int DrainLogRing(struct LogRing *);            /* Write out a ring, returns bytes written */
+void DisciplineRate(double);                   /* Steer the rate from the on-time error */
+void SetRateCorrection(double);                /* Scale samples per second by 1 + correction */
+const char *ClockStateMode(void);              /* Output mode, as saved in the clock state */
+int ParseClockState(char *, double *, char *, double *, double *, long *, const char **);
+void LoadClockState(void);                     /* Start from the saved rate error, if it still fits */
+void PublishClockState(void);                  /* Hand the log writer the values to save */
+void SaveClockState(void);                     /* Write the published values to the state file */
+void InitOscillators(void);                    /* Build wavetable and phase increments */
+const struct Oscillator *FindOscillator(int);  /* Oscillator for a carrier frequency */
+void RunOscillator(const struct Oscillator *, uint64_t, float, float *, int);
+void RunIntegerOscillator(const struct Oscillator *, uint64_t, const int32_t *, void *, int);
+struct SampleFormat *FindSampleFormat(const char *); /* Sample format by -F name */
+void PutSample(void *, int, int32_t);          /* Store an integer sample in OutputFormat */
+int32_t GetSample(const void *, int);          /* Fetch an integer sample in OutputFormat */
+int MsToSamples(int);                          /* Convert milliseconds to samples */
+struct IrigRate *FindIrigRate(char);           /* IRIG rate by letter */
+void InitTimebase(void);                       /* Start the sample clock for SampleRate */
+int AdvanceTimebase(int);                      /* Samples to send for the next us of signal */
+void InitTemplates(void);                      /* Render symbol templates for the encoder */
+void ReserveTemplate(struct Template *, int);  /* Reserve template space for us of samples */
+void AddToTemplate(struct Template *, int, int, int);
+void SendTemplate(const struct Template *, int);
+void SendSilence(int);                         /* Send ms of silence */
+void SendIrigSymbol(int, int);                 /* Send IRIG symbol by high and low tenths */
+void *Allocate(size_t, size_t);                /* Counted, aligned heap allocation */
+void InitArena(void);                          /* Allocate and prefault the render arena */
+void *ArenaAlloc(size_t);                      /* Carve a buffer from the render arena */
 
 
 /*
@@ -270,6 +1079,8 @@ int IrigIncludeYear = FALSE; /* Whether to send year in first control functions
                                 area, between P5 and P6. */
 int IrigIncludeIeee = FALSE; /* Whether to send IEEE 1344 control functions
                                 extensions between P6 and P8. */
+struct IrigRate *Irig;       /* IRIG time-base rate */
+int IrigTenthUs;             /* A tenth of an IRIG symbol (us) */
 int StraightBinarySeconds = 0;
 int ControlFunctions = 0;
 int Debug = FALSE;
@@ -282,7 +1093,48 @@ int TotalCyclesAdded = 0;
 int TotalCyclesRemoved = 0;
 
 double SampleRate;
-int AudioDelayMs = 17; /* my usb dongle, maybe not your codec */
+uint64_t SampleClock = 0;                 /* Samples written since the stream started */
+uint64_t RateNumerator;                   /* SampleRate * RATE_DENOMINATOR, corrected */
+uint64_t TimebaseRemainder;               /* Fraction of a sample owed, in 1 / (1000 * RATE_DENOMINATOR) */
+float Wavetable[WAVETABLE_SIZE + 1];      /* One sine cycle, plus guard point for interpolation */
+int32_t LevelWavetables[HIGH + 1][WAVETABLE_SIZE + 1]; /* Integer formats: the cycle at each amplitude */
+struct SampleFormat *OutputFormat = NULL; /* Set by -F, or by the device */
+struct Arena RenderArena;                 /* Preallocated buffers for the render path */
+unsigned long AllocationCount = 0;        /* Heap allocations made through Allocate() */
+unsigned long SteadyStateAllocations = 0; /* ... of which after startup completed */
+int StartupComplete = FALSE;              /* Set once the generator loop is running */
+int CallbackMode = FALSE;                 /* Feed a PortAudio callback through OutputRing */
+struct Ring OutputRing;                   /* Samples queued for the callback */
+struct AheadQueue Ahead = {.depth = AHEAD_DEFAULT_DEPTH}; /* Seconds rendered ahead of blocking writes */
+struct RenderTarget RenderFile;           /* Offline render output */
+struct AlsaOutput Alsa;                   /* Direct ALSA output */
+struct RtpOutput Rtp = {.fd = -1};        /* RTP output */
+struct WorkQueue *WorkQueues;             /* Batch worker queues */
+int BatchWorkers;                         /* ... and how many */
+struct OutputTiming Timing;               /* Latency and on-time estimates */
+struct RateDiscipline Discipline;         /* Rate correction loop state */
+struct ClockState State;                  /* Saved rate error and latency */
+int AudioDelayMs = -1;                    /* Fixed latency override, -1 = measure */
+int RealtimePolicy = SCHED_OTHER;         /* Generator thread scheduling */
+int RealtimePriority = REALTIME_DEFAULT_PRIORITY;
+int LockMemory = FALSE;                   /* mlockall */
+int RenderCpu = -1;                       /* CPU for the generator, -1 for any */
+int OutputCpu = -1;                       /* ... and the callback or device writer thread */
+int Benchmark = FALSE;                    /* Render to nowhere and print machine-readable results */
+struct Metrics Metrics;                   /* Health published for monitoring */
+struct LogRing TextLog;                   /* Messages for stdout */
+struct LogRing BinaryLog;                 /* -L records */
+const char *BinaryLogPath;                /* ... and their file */
+int LogRunning = FALSE;                   /* Log() goes through the rings */
+_Atomic int LogStop;                      /* log writer should finish */
+pthread_t LogThread;
+struct Sink Sinks[MAX_SINKS];             /* Emit() output, the device or render file first */
+int SinkCount = 1;                        /* ... and how many */
+_Atomic int SinkStop;                     /* sink thread should finish */
+pthread_t SinkThread;
+int SinksRunning = FALSE;
+struct ControlPlane Control = {.fd = -1}; /* Control socket */
+struct EventSchedule Schedule;            /* Leap second and DST events from files */
 
 void Die(const char *fmt, ...) {
   va_list vargs;
@@ -298,35 +1150,9 @@ void Die(const char *fmt, ...) {
  * Main program
  */
 int main(int argc, char **argv) {
-  struct timeval TimeValue;              /* System clock at startup */
-  time_t SecondsPartOfTime;              /* Sent to gmtime() for calculation of TimeStructure
-                                            (can apply offset). */
-  time_t BaseRealTime;                   /* Base realtime so can determine seconds since starting. */
-  time_t NowRealTime;                    /* New realtime to can determine seconds as of now. */
-  unsigned SecondsRunningRealTime;       /* Difference between NowRealTime and
-                                            BaseRealTime. */
-  unsigned SecondsRunningSimulationTime; /* Time that the simulator has been
-                                            running. */
-  int SecondsRunningDifference;          /* Difference between what real time says we
-                                            have been running */
-  /* and what simulator says we have been running - will slowly  */
-  /* change because of clock drift. */
-  int ExpectedRunningDifference = 0;     /* Stable value that we've obtained from
-                                            check at initial start-up.	*/
-  unsigned StabilityCount;               /* Used to check stability of difference while starting */
-#define RUN_BEFORE_STABILITY_CHECK (30)  // Must run this many seconds before even checking stability.
-#define MINIMUM_STABILITY_COUNT \
-  (10)  // Number of consecutive differences that need to be within initial
-        // stability band to say we are stable.
-#define INITIAL_STABILITY_BAND \
-  (2)  // Determining initial stability for consecutive differences within +/-
-       // this value.
-#define RUNNING_STABILITY_BAND \
-  (5)  // When running, stability is defined as difference within +/- this
-       // value.
-
-  struct tm *TimeStructure = NULL; /* Structure returned by gmtime */
-  char code[200];                  /* timecode */
+  time_t SecondsPartOfTime; /* Unix time to start from (can apply offset). */
+
+  char code[200]; /* timecode */
   int temp;
   int arg = 0;
   int sw = 0;
@@ -342,10 +1168,7 @@ int main(int argc, char **argv) {
 
   int BitNumber;
   char FormatCharacter = '3'; /* Default is IRIG-B with IEEE 1344 extensions */
-  char AsciiValue;
-  int HexValue;
   // int	OldPtr = 0;
-  int FrameNumber = 0;
 
   /* Time offset for IEEE 1344 indication. */
   float TimeOffset = 0.0;
@@ -354,10 +1177,11 @@ int main(int argc, char **argv) {
   int OffsetHalf = 0;
 
   unsigned int TimeQuality = 0; /* Time quality for IEEE 1344 indication. */
-  char ParityString[200];       /* Partial output string, to calculate parity on. */
-  int ParitySum = 0;
   int ParityValue;
-  char *StringPointer;
+  struct IrigFrame Frame;  /* IRIG frame being sent */
+  int IrigFrameSecond = 0; /* Second the frame started in */
+  int FramePosition;       /* Next symbol of the frame to send */
+  char IrigRateLetter = 'B';
 
   /* Flags to indicate requested leap second addition or deletion by command
    * line option. */
@@ -373,6 +1197,7 @@ int main(int argc, char **argv) {
   int LeapHour = 0;
   int LeapMinute = 0;
   int LeapDayOfYear = 0;
+  int64_t LeapMinuteAt = NO_EVENT; /* ... as the start of the minute, s since 2000 */
 
   /* State flag for the insertion and deletion of leap seconds, esp. deletion,
    */
@@ -397,14 +1222,14 @@ int main(int argc, char **argv) {
    * line option. */
   int DstSwitchFlag = FALSE;
 
-  /* To allow predict for DstPendingFlag in IEEE 1344 */
-  int DstSwitchPendingYear = 0; /* Default value isn't valid, but I don't care. */
-  int DstSwitchPendingDayOfYear = 0;
-  int DstSwitchPendingHour = 0;
-  int DstSwitchPendingMinute = 0;
+  int64_t DstMinuteAt = NO_EVENT; /* ... as the start of the minute, s since 2000 */
+
+  int64_t MinuteAt;                 /* start of the minute being sent, s since 2000 */
+  int64_t ScheduleArmAt = NO_EVENT; /* when the next event from the schedule is armed */
 
   /* /Flag for indication of a DST switch pending in IEEE 1344 */
   int DstPendingFlag = FALSE;
+  unsigned ControlApplied[CONTROL_GROUPS] = {0}; /* generations of the control socket changes applied */
 
   /* Offset to actual time value sent. */
   float UseOffsetHoursFloat;
@@ -424,6 +1249,13 @@ int main(int argc, char **argv) {
   int RemoveCycle = FALSE;  // We are behind, remove cycle to slow down and get back in sync.
   int RateCorrection;       // Aggregate flag for passing to subroutines.
   int EnableRateCorrection = TRUE;
+  int RingMs = 0;           /* Callback mode ring depth, 0 = blocking writes */
+  unsigned long UnderflowsReported = 0; /* Device underflows logged so far */
+  char *RenderPath = NULL;  /* File to render to, NULL = play */
+  char *BatchManifest = NULL; /* Job list to batch render, NULL = single run */
+  int Workers = 0;            /* Batch worker threads, 0 = one per CPU */
+  int ChunkFirst = 0;         /* Batch chunk: first second of the job to render */
+  int ChunkTotal = 0;         /* ... and length of the job, 0 = not a chunk */
   char deviceNumOrName[512] = {0};
   float DesiredSampleRate = -1;
 
@@ -441,12 +1273,20 @@ int main(int argc, char **argv) {
    */
   Year = 0;
 
-  while ((temp = getopt(argc, argv, "a:b:c:dD:f:g:hHi:jk:l:o:q:r:stu:xy:z?")) != -1) {
+  while ((temp = getopt(argc, argv, TG2_OPTIONS)) != -1) {
     switch (temp) {
       case 'a':
-        strncpy(deviceNumOrName, optarg, sizeof deviceNumOrName);
+        strncpy(deviceNumOrName, optarg, sizeof deviceNumOrName - 1);
         break;
 
+      case 'A': { /* CPUs to run the generator [and callback] on */
+        int n = sscanf(optarg, "%d,%d", &RenderCpu, &OutputCpu);
+        if (n < 1 || RenderCpu < 0 || RenderCpu >= CPU_SETSIZE ||
+            (n == 2 && (OutputCpu < 0 || OutputCpu >= CPU_SETSIZE)))
+          Die("Bad CPU list \"%s\" (CPUs 0 to %d)", optarg, CPU_SETSIZE - 1);
+        break;
+      }
+
       case 'b': /* Remove (delete) a leap second at the end of the specified
                    minute. */
         sscanf(optarg, "%2d%2d%2d%2d%2d", &LeapYear, &LeapMonth, &LeapDayOfMonth, &LeapHour, &LeapMinute);
@@ -454,11 +1294,20 @@ int main(int argc, char **argv) {
         DeleteLeapSecond = TRUE;
         break;
 
+      case 'B': /* Batch render the jobs in a manifest */
+        BatchManifest = optarg;
+        break;
+
       case 'c': /* specify number of seconds to send output for before exiting,
                    0 = forever */
         sscanf(optarg, "%d", &SecondsToSend);
         break;
 
+      case 'C': /* use callback output, with a ring of this many ms */
+        sscanf(optarg, "%d", &RingMs);
+        CallbackMode = (RingMs > 0);
+        break;
+
       case 'd': /* set DST for summer (WWV/H only) / start with DST active
                    (IRIG) */
         DstFlag++;
@@ -468,11 +1317,19 @@ int main(int argc, char **argv) {
         sscanf(optarg, "%d", &AudioDelayMs);
         break;
 
+      case 'e': /* Leap seconds from a leap-seconds.list, reloaded when it changes */
+        Schedule.leap_path = optarg;
+        break;
+
       case 'f': /* select format: i=IRIG-98 (default) 2=IRIG-2004
                    3-IRIG+IEEE-1344 w=WWV(H) */
         sscanf(optarg, "%c", &FormatCharacter);
         break;
 
+      case 'F': /* Sample format */
+        OutputFormat = FindSampleFormat(optarg);
+        break;
+
       case 'g': /* Date and time to switch back into / out of DST active. */
         sscanf(optarg, "%2d%2d%2d%2d%2d", &DstSwitchYear, &DstSwitchMonth, &DstSwitchDayOfMonth, &DstSwitchHour,
                &DstSwitchMinute);
@@ -497,6 +1354,14 @@ int main(int argc, char **argv) {
         EnableRateCorrection = FALSE;
         break;
 
+      case 'I': /* IRIG time-base rate, A B E G or H */
+        sscanf(optarg, "%c", &IrigRateLetter);
+        break;
+
+      case 'J': /* Batch worker threads */
+        sscanf(optarg, "%d", &Workers);
+        break;
+
       case 'k':
         sscanf(optarg, "%d", &RateCorrection);
         EnableRateCorrection = FALSE;
@@ -515,38 +1380,44 @@ int main(int argc, char **argv) {
         }
         break;
 
+      case 'K': /* Lock all memory */
+        LockMemory = TRUE;
+        break;
+
       case 'l': /* use time offset from UTC */
         sscanf(optarg, "%f", &UseOffsetHoursFloat);
         UseOffsetSecondsFloat = UseOffsetHoursFloat * (float)SECONDS_PER_HOUR;
-        UseOffsetSecondsInt = (int)(UseOffsetSecondsFloat + 0.5);
+        UseOffsetSecondsInt = lround(UseOffsetSecondsFloat);
+        break;
+
+      case 'L': /* Log a binary record of each second to a file */
+        BinaryLogPath = optarg;
+        break;
+
+      case 'm': /* Benchmark: render -c seconds, discarding them, and print the results */
+        Benchmark = TRUE;
+        break;
+
+      case 'M': /* Write metrics to a Prometheus text file */
+        Metrics.path = optarg;
+        break;
+
+      case 'N': /* Seconds to render ahead of blocking writes, 0 = write from the generator */
+        if (sscanf(optarg, "%d", &Ahead.depth) != 1 || Ahead.depth < 0) Die("Bad render-ahead depth \"%s\"", optarg);
         break;
 
       case 'o': /* Set IEEE 1344 time offset in hours - positive or negative, to
                    the half hour */
         sscanf(optarg, "%f", &TimeOffset);
-        if (TimeOffset >= -0.2) {
-          OffsetSignBit = 0;
-
-          if (TimeOffset > 0) {
-            OffsetOnes = TimeOffset;
+        SetTimeOffset(TimeOffset, &OffsetSignBit, &OffsetOnes, &OffsetHalf);
+        break;
 
-            if ((TimeOffset - floor(TimeOffset)) >= 0.4)
-              OffsetHalf = 1;
-            else
-              OffsetHalf = 0;
-          } else {
-            OffsetOnes = 0;
-            OffsetHalf = 0;
-          }
-        } else {
-          OffsetSignBit = 1;
-          OffsetOnes = -TimeOffset;
+      case 'O': /* Also send the samples to stdout or a rotating capture file */
+        AddSink(optarg);
+        break;
 
-          if ((ceil(TimeOffset) - TimeOffset) >= 0.4)
-            OffsetHalf = 1;
-          else
-            OffsetHalf = 0;
-        }
+      case 'P': /* Keep the clock state, to start locked next time */
+        State.path = optarg;
         break;
 
       case 'q': /* Hex quality code 0 to 0x0F - 0 = maximum, 0x0F = no lock */
@@ -558,10 +1429,28 @@ int main(int argc, char **argv) {
         sscanf(optarg, "%f", &DesiredSampleRate);
         break;
 
+      case 'R': { /* Real-time scheduling, fifo or rr[:priority] */
+        char name[8] = "";
+
+        sscanf(optarg, "%7[^:]:%d", name, &RealtimePriority);
+        if (strcasecmp(name, "fifo") == 0)
+          RealtimePolicy = SCHED_FIFO;
+        else if (strcasecmp(name, "rr") == 0)
+          RealtimePolicy = SCHED_RR;
+        else
+          Die("Unknown scheduling policy \"%s\" (fifo or rr)", optarg);
+        break;
+      }
+
       case 's': /* set leap warning bit (WWV/H only) */
         leap++;
         break;
 
+      case 'S': /* Render seconds from first of a total second batch job, in place */
+        if (sscanf(optarg, "%d:%d", &ChunkFirst, &ChunkTotal) != 2 || ChunkFirst < 0 || ChunkTotal <= ChunkFirst)
+          Die("Bad batch chunk (%s)", optarg);
+        break;
+
       case 't': /* select WWVH sync frequency */
         tone = 1200;
         break;
@@ -574,6 +1463,14 @@ int main(int argc, char **argv) {
           dut1 |= 0x8;
         break;
 
+      case 'U': /* Control socket */
+        Control.path = optarg;
+        break;
+
+      case 'w': /* Render to a file as fast as possible, instead of playing */
+        RenderPath = optarg;
+        break;
+
       case 'x': /* Turn off verbose output. */
         Verbose = FALSE;
         break;
@@ -587,6 +1484,10 @@ int main(int argc, char **argv) {
         Debug = TRUE;
         break;
 
+      case 'Z': /* DST switches from a tzdata zone, reloaded when it changes */
+        Schedule.zone = optarg;
+        break;
+
       default:
         printf("Invalid option \"%c\", aborting...\n", temp);
         exit(-1);
@@ -596,8 +1497,24 @@ int main(int argc, char **argv) {
 
   if (Debug) Verbose = TRUE;
 
+  if (BatchManifest != NULL) exit(BatchRender(BatchManifest, Workers));
+  if (Benchmark) {
+    if (SecondsToSend <= 0 || !utc) Die("A benchmark needs a start time (-y) and a length (-c).");
+    RenderPath = "/dev/null"; /* for the offline path; Emit() drops the samples */
+  }
+  if (ChunkTotal > 0) {
+    if (RenderPath == NULL || strcmp(RenderPath, "-") == 0) Die("A batch chunk must be rendered to a file (-w).");
+    if (!utc) Die("A batch chunk needs a start time (-y).");
+    if (ChunkFirst > 0 && (leap || AddCycle || RemoveCycle))
+      Die("Can't start part way into a job with -s or -k (they change its length).");
+  }
+  for (int i = 1; i < SinkCount; i++)
+    if (Sinks[i].flush == PipeFlush && RenderPath != NULL && strcmp(RenderPath, "-") == 0)
+      Die("Only one of -w - and -O stdout can write to stdout.");
+
   if (InsertLeapSecond || DeleteLeapSecond) {
     LeapDayOfYear = ConvertMonthDayToDayOfYear(LeapYear, LeapMonth, LeapDayOfMonth);
+    LeapMinuteAt = CalendarToSeconds(LeapYear, LeapDayOfYear, LeapHour, LeapMinute, 0);
 
     if (Debug) {
       printf(
@@ -610,33 +1527,26 @@ int main(int argc, char **argv) {
 
   if (DstSwitchFlag) {
     DstSwitchDayOfYear = ConvertMonthDayToDayOfYear(DstSwitchYear, DstSwitchMonth, DstSwitchDayOfMonth);
-
-    /* Figure out time of minute previous to DST switch, so can put up warning
-     * flag in IEEE 1344 */
-    DstSwitchPendingYear = DstSwitchYear;
-    DstSwitchPendingDayOfYear = DstSwitchDayOfYear;
-    DstSwitchPendingHour = DstSwitchHour;
-    DstSwitchPendingMinute = DstSwitchMinute - 1;
-    if (DstSwitchPendingMinute < 0) {
-      DstSwitchPendingMinute = 59;
-      DstSwitchPendingHour--;
-      if (DstSwitchPendingHour < 0) {
-        DstSwitchPendingHour = 23;
-        DstSwitchPendingDayOfYear--;
-        if (DstSwitchPendingDayOfYear < 1) {
-          DstSwitchPendingYear--;
-        }
-      }
-    }
+    DstMinuteAt = CalendarToSeconds(DstSwitchYear, DstSwitchDayOfYear, DstSwitchHour, DstSwitchMinute, 0);
 
     if (Debug) {
+      int PendingYear, PendingDayOfYear, PendingHour, PendingMinute;
+
+      /* IEEE 1344 warns of the switch through the minute before it. */
+      SecondsToCalendar(DstMinuteAt - SECONDS_PER_MINUTE, &PendingYear, &PendingDayOfYear, &PendingHour,
+                        &PendingMinute, &temp);
       printf("\nHave DST switch request for year %4d day %3d at %2.2dh%2.2d,", DstSwitchYear, DstSwitchDayOfYear,
              DstSwitchHour, DstSwitchMinute);
-      printf("\n    so will have warning at year %4d day %3d at %2.2dh%2.2d.\n", DstSwitchPendingYear,
-             DstSwitchPendingDayOfYear, DstSwitchPendingHour, DstSwitchPendingMinute);
+      printf("\n    so will have warning at year %4d day %3d at %2.2dh%2.2d.\n", PendingYear, PendingDayOfYear,
+             PendingHour, PendingMinute);
     }
   }
 
+  if (Schedule.leap_path != NULL || Schedule.zone != NULL) {
+    Schedule.offset = UseOffsetSecondsInt;
+    StartSchedule();
+  }
+
   switch (tolower(FormatCharacter)) {
     case 'i':
       printf("\nFormat is IRIG-1998 (no year coded)...\n\n");
@@ -675,113 +1585,147 @@ int main(int argc, char **argv) {
       break;
   }
 
-  /*
-   * Open audio device and set options
-   */
-
-  PaError err;
-  err = Pa_Initialize();
-  if (err != paNoError) Die("Pa_Initialize failed: %s\n", Pa_GetErrorText(err));
-
-  int numDevices = Pa_GetDeviceCount();
-  if (numDevices < 0) Die("no audio devices");
-
-  int deviceNum = -1;
-  for (int i = 0; i < numDevices; i++) {
-    const PaDeviceInfo *deviceInfo = Pa_GetDeviceInfo(i);
-    printf("%02d: %s\n", i, deviceInfo->name);
-    if (strcmp(deviceNumOrName, deviceInfo->name) == 0) {
-      deviceNum = i;
-    }
-  }
-
-  if (deviceNum < 0) {
-    if (*deviceNumOrName) {
-      sscanf(deviceNumOrName, "%d", &deviceNum);
-    } else {
-      deviceNum = Pa_GetDefaultOutputDevice();
-      if (deviceNum == paNoDevice) Die("No default output device");
-    }
-  }
-
-  if (deviceNum < 0 || deviceNum >= numDevices) Die("Can't find device (bad device specification).");
+  Irig = FindIrigRate(toupper(IrigRateLetter));
+  IrigTenthUs = 100000 / Irig->pps;
 
-  const PaDeviceInfo *deviceInfo = Pa_GetDeviceInfo(deviceNum);
-  printf("using device %s\n", deviceInfo->name);
   if (DesiredSampleRate > 0.0) {
     printf("desired sample rate=%f\n", DesiredSampleRate);
     SampleRate = DesiredSampleRate;
   } else {
-    // 44.1 KHz is most common but does not work.  Most devices support 48KHz.
+    // Any rate works, but most devices support 48KHz.
     SampleRate = 48000.;
   }
 
-  PaStreamParameters outputParameters;
-  memset(&outputParameters, 0, sizeof outputParameters);
-  outputParameters.device = deviceNum;
-  outputParameters.channelCount = 1;
-  outputParameters.sampleFormat = paFloat32;
-  outputParameters.suggestedLatency = Pa_GetDeviceInfo(outputParameters.device)->defaultLowOutputLatency;
-
-  err = Pa_IsFormatSupported(NULL, &outputParameters, SampleRate);
-  if (err != paFormatIsSupported) Die("Audio output format is not supported.");
+  /*
+   * Open audio device, or the file to render to, and set options.  Devices
+   * take the first sample format they can play unless -F names one.
+   */
+  if (RenderPath != NULL) {
+    if (OutputFormat == NULL) OutputFormat = &SampleFormats[0];
+    RenderFile.part = ChunkTotal > 0;
+    OpenRenderFile(RenderPath);
+    Sinks[0].name = RenderPath;
+    Sinks[0].write = RenderWrite;
+    CallbackMode = FALSE;
+    EnableRateCorrection = FALSE; /* no sound card clock to follow */
+  } else {
+    if (strncmp(deviceNumOrName, ALSA_PREFIX, strlen(ALSA_PREFIX)) == 0) {
+      if (CallbackMode) Die("Callback mode (-C) is for PortAudio devices.");
+      OpenAlsaDevice(deviceNumOrName + strlen(ALSA_PREFIX));
+    } else if (strncmp(deviceNumOrName, RTP_PREFIX, strlen(RTP_PREFIX)) == 0) {
+      if (CallbackMode) Die("Callback mode (-C) is for PortAudio devices.");
+      if (OutputFormat == NULL) OutputFormat = &SampleFormats[0];
+      OpenRtpDevice(deviceNumOrName + strlen(RTP_PREFIX));
+      EnableRateCorrection = FALSE; /* paced by the system clock, so nothing to follow */
+    } else {
+      OpenAudioDevice(deviceNumOrName);
+      if (CallbackMode) InitRing(RingMs);
+    }
+    Sinks[0].name = deviceNumOrName;
+    Sinks[0].write = DeviceWrite;
+  }
 
-  err = Pa_OpenStream(&stream, NULL, /* no input */
-                      &outputParameters, SampleRate, BUFLNG,
-                      paClipOff, /* we won't output out of range samples so don't bother clipping them */
-                      NULL,      /* no callback, use blocking API */
-                      NULL);     /* no callback, so no callback userData */
-  if (err != paNoError) Die("Pa_OpenStream failed: %s\n", Pa_GetErrorText(err));
+  InitTimebase();
+  InitArena();
+  InitOscillators();
+  InitTemplates();
+  StartSinks();
 
-  const PaStreamInfo *info = Pa_GetStreamInfo(stream);
-  if (info == NULL) Die("failed to get stream info");
-  printf("sample rate=%f\n", info->sampleRate);
+  if (RenderFile.part) {
+    SampleClock = TimebaseSamples(ChunkFirst, &TimebaseRemainder);
+    PlaceRenderChunk(SampleClock, TimebaseSamples(ChunkTotal, NULL));
+  }
+  if (RenderFile.fp == NULL) StartAudioDevice();
 
-  printf("Starting stream\n");
-  err = Pa_StartStream(stream);
-  if (err != paNoError) Die("Pa_StartStream failed: %s\n", Pa_GetErrorText(err));
+  if (AudioDelayMs > 200) Die("Bad value for audio delay (%d)", AudioDelayMs);
 
   /*
    * Unless specified otherwise, read the system clock and
    * initialize the time.
    */
-  gettimeofday(&TimeValue, NULL);  // Now always read the system time to keep
-                                   // "real time" of operation.
-  NowRealTime = BaseRealTime = SecondsPartOfTime = TimeValue.tv_sec;
-  SecondsRunningSimulationTime = 0;  // Just starting simulation, running zero seconds as of now.
-  StabilityCount = 0;                // No stability yet.
-
+  Discipline.time_constant =
+      (CallbackMode || Alsa.pcm != NULL) ? PLL_TIME_CONSTANT_CALLBACK : PLL_TIME_CONSTANT_BLOCKING;
   if (utc) {
     DayOfYear = ConvertMonthDayToDayOfYear(Year, Month, DayOfMonth);
+    if (RenderFile.fp == NULL) Timing.reference = EstimateDacTime(SampleClock);
   } else {
+    if (RenderFile.fp != NULL) {
+      /* Nothing to align to, so start from the current second. */
+      SecondsPartOfTime = time(NULL);
+    } else {
+      /* Pad with silence so the next sample written reaches the DAC on a
+       * second boundary, and start the time from the second before it. */
+      double dac = EstimateDacTime(SampleClock);
+      Timing.reference = ceil(dac);
+      EmitSilence((uint64_t)llround((Timing.reference - dac) * SampleRate));
+      SecondsPartOfTime = (time_t)Timing.reference - 1;
+    }
+
     /* Apply offset to time. */
     if (UseOffsetSecondsInt >= 0)
       SecondsPartOfTime += (time_t)UseOffsetSecondsInt;
     else
       SecondsPartOfTime -= (time_t)(-UseOffsetSecondsInt);
 
-    if ((AudioDelayMs > 200) || (AudioDelayMs < 0)) Die("Bad value for audio delay (%d)", AudioDelayMs);
-
-    while (1) {
-      TimeStructure = gmtime(&SecondsPartOfTime);
-      Minute = TimeStructure->tm_min;
-      Hour = TimeStructure->tm_hour;
-      DayOfYear = TimeStructure->tm_yday + 1;
-      Year = TimeStructure->tm_year % 100;
-      Second = TimeStructure->tm_sec;
+    SecondsToCalendar(SecondsPartOfTime - UNIX_TO_2000, &Year, &DayOfYear, &Hour, &Minute, &Second);
+  }
 
-      int ms = (int)(1000L - (long)TimeValue.tv_usec / 1000L) /* ms */;
-      ms -= AudioDelayMs;
-      if (ms == 0) {
-        break;
-      }
-      if (ms > 0) {
-        Delay(ms);
-        break;
+  /*
+   * With a zone, DST is on or off as the zone has it when the run (or the
+   * job, for a batch chunk) starts, whatever -d says.
+   */
+  if (Schedule.zone != NULL) {
+    const struct EventTable *Table = &Schedule.slots[Schedule.front];
+    int ZoneNow = Schedule.zone_offset;
+
+    for (int i = 0, Started = FirstEvent(Table, CalendarToSeconds(Year, DayOfYear, Hour, Minute, 0) + 1); i < Started;
+         i++)
+      if (Table->events[i].kind == EVENT_DST_ON || Table->events[i].kind == EVENT_DST_OFF) {
+        DstFlag = (Table->events[i].kind == EVENT_DST_ON);
+        ZoneNow = Table->events[i].offset;
       }
+    if (ZoneNow != UseOffsetSecondsInt)
+      fprintf(stderr, "Warning: time sent is %+.1f hours from UTC (-l), but %s is %+.1f hours.\n",
+              (double)UseOffsetSecondsInt / SECONDS_PER_HOUR, Schedule.zone, (double)ZoneNow / SECONDS_PER_HOUR);
+  }
+
+  /*
+   * A batch chunk starts ChunkFirst seconds into its job.  Seed the time,
+   * and the leap second and DST state, as they would be after sending
+   * that many seconds from the job's start.
+   */
+  if (ChunkFirst > 0) {
+    struct CalendarSeek Seek = {.dst = DstFlag};
+
+    SeekCalendar(&Seek, CalendarToSeconds(Year, DayOfYear, Hour, Minute, Second), ChunkFirst, LeapMinuteAt,
+                 DeleteLeapSecond, DstMinuteAt);
+    SecondsToCalendar(Seek.at, &Year, &DayOfYear, &Hour, &Minute, &Second);
+    for (; Seek.steps != 0; Seek.steps += (Seek.steps > 0) ? -1 : 1)
+      StepOffsetHour(Seek.steps > 0, &OffsetSignBit, &OffsetOnes, OffsetHalf);
+    DstFlag = Seek.dst;
+    if (Seek.switched) DstMinuteAt = NO_EVENT;
+    if (Seek.leap_second) {
+      Second = 60;
+      LeapState = LEAPSTATE_ZERO_AFTER_INSERT;
     }
   }
 
+  /* Arm the schedule from the minute the run starts in. */
+  MinuteAt = CalendarToSeconds(Year, DayOfYear, Hour, Minute, 0);
+  if (Schedule.leap_path != NULL || Schedule.zone != NULL) {
+    Schedule.next = FirstEvent(&Schedule.slots[Schedule.front], MinuteAt);
+    ScheduleArmAt = ScheduleArmTime();
+  }
+
+  if (State.path != NULL && EnableRateCorrection && State.device != NULL) {
+    State.mode = ClockStateMode(); /* before the device closes */
+    LoadClockState();
+  } else {
+    State.path = NULL; /* nothing to keep */
+  }
+  if (Verbose && RenderFile.fp == NULL)
+    printf("Output latency %s %.1f ms.\n", AudioDelayMs < 0 ? "measured at" : "set to", 1000. * Timing.latency);
+
   StraightBinarySeconds = Second + (Minute * SECONDS_PER_MINUTE) + (Hour * SECONDS_PER_HOUR);
 
   memset(code, 0, sizeof(code));
@@ -796,7 +1740,7 @@ int main(int argc, char **argv) {
           " Year = %02d, Day of year = %03d, Time = %02d:%02d:%02d, Minute "
           "tone = %d Hz, Hour tone = %d Hz.\n",
           Year, DayOfYear, Hour, Minute, Second, tone, HourTone);
-      snprintf(code, sizeof(code), "%01d%03d%02d%02d%01d", Year / 10, DayOfYear, Hour, Minute, Year % 10);
+      snprintf(code, sizeof(code), "%01d%03d%02d%02d%01d", Year % 100 / 10, DayOfYear, Hour, Minute, Year % 10);
       if (Verbose) {
         printf(
             "\n Year = %2.2d, Day of year = %3d, Time = %2.2d:%2.2d:%2.2d, "
@@ -814,7 +1758,7 @@ int main(int argc, char **argv) {
 
       ptr = 8;
       for (BitNumber = 0; BitNumber <= Second; BitNumber++) {
-        if (progx[BitNumber].sw == DEC) ptr--;
+        if (progx[BitNumber].sw == DEC || progx[BitNumber].sw == DECX) ptr--;
       }
       break;
 
@@ -823,7 +1767,7 @@ int main(int argc, char **argv) {
      * no additional alignment.
      */
     case IRIG:
-      printf("IRIG-B time signal, starting point:\n");
+      printf("IRIG-%c time signal, starting point:\n", Irig->letter);
       printf(
           " Year = %02d, Day of year = %03d, Time = %02d:%02d:%02d, Straight "
           "binary seconds (SBS) = %05d / 0x%04X.\n",
@@ -833,7 +1777,7 @@ int main(int argc, char **argv) {
         printf(
             "Codes: \".\" = marker/position indicator, \"-\" = zero dummy bit, "
             "\"0\" = zero bit, \"1\" = one bit.\n");
-        if ((EnableRateCorrection) || (AddCycle) || (RemoveCycle)) {
+        if ((AddCycle) || (RemoveCycle)) {
           printf(
               "       \"o\" = short zero, \"*\" = long zero, \"x\" = short "
               "one, \"+\" = long one.\n");
@@ -851,37 +1795,72 @@ int main(int argc, char **argv) {
    * Run the signal generator to generate new timecode strings
    * once per minute for WWV/H and once per second for IRIG.
    */
+  if (Metrics.path != NULL) StartMetrics();
+  if (BinaryLogPath != NULL) {
+    if ((BinaryLog.fp = fopen(BinaryLogPath, "wb")) == NULL) Die("Can't open %s: %s", BinaryLogPath, strerror(errno));
+    fputs(LOG_MAGIC, BinaryLog.fp);
+  }
+  if (RenderFile.fp == NULL) StartLog(); /* renders have no deadline, so may as well wait for stdout */
+  if (Control.path != NULL) {
+    struct ControlParams *p = &Control.requested;
+
+    p->insert_leap = InsertLeapSecond;
+    p->delete_leap = DeleteLeapSecond;
+    p->leap_year = LeapYear;
+    p->leap_day = LeapDayOfYear;
+    p->leap_hour = LeapHour;
+    p->leap_minute = LeapMinute;
+    p->dst_switch = DstSwitchFlag;
+    p->dst_year = DstSwitchYear;
+    p->dst_day = DstSwitchDayOfYear;
+    p->dst_hour = DstSwitchHour;
+    p->dst_minute = DstSwitchMinute;
+    p->quality = TimeQuality;
+    p->offset_sign = OffsetSignBit;
+    p->offset_ones = OffsetOnes;
+    p->offset_half = OffsetHalf;
+    StartControl();
+  }
+  if (Ahead.depth > 0 && RenderFile.fp == NULL && !CallbackMode) StartAhead();
+  SetupRealtime();
+  StartupComplete = TRUE;
+  uint64_t RenderStartSample = SampleClock;
+  struct timespec RenderStartTime;
+  clock_gettime(CLOCK_MONOTONIC, &RenderStartTime);
   for (CountOfSecondsSent = 0; ((SecondsToSend == 0) || (CountOfSecondsSent < SecondsToSend)); CountOfSecondsSent++) {
     if ((encode == IRIG) && (((Second % 20) == 0) || (CountOfSecondsSent == 0))) {
-      printf("\n");
+      Log("\n");
 
-      printf(
+      Log(
           " Year = %02d, Day of year = %03d, Time = %02d:%02d:%02d, Straight "
           "binary seconds (SBS) = %05d / 0x%04X.\n",
           Year, DayOfYear, Hour, Minute, Second, StraightBinarySeconds, StraightBinarySeconds);
       if ((EnableRateCorrection) || (RemoveCycle) || (AddCycle)) {
-        printf(
+        Log(
             " CountOfSecondsSent = %d, TotalCyclesAdded = %d, "
             "TotalCyclesRemoved = %d\n",
             CountOfSecondsSent, TotalCyclesAdded, TotalCyclesRemoved);
         if ((CountOfSecondsSent != 0) && ((TotalCyclesAdded != 0) || (TotalCyclesRemoved != 0))) {
           RatioError = ((float)(TotalCyclesAdded - TotalCyclesRemoved)) / (1000.0 * (float)CountOfSecondsSent);
-          printf(
+          Log(
               " Adjusted by %2.1f%%, apparent send frequency is %4.2f Hz not "
               "%.3f Hz.\n\n",
               RatioError * 100.0, (1.0 + RatioError) * SampleRate, SampleRate);
         }
       } else
-        printf("\n");
+        Log("\n");
+      if (RenderFile.fp == NULL) PrintTiming();
+      if (CallbackMode) PrintRingStatistics();
+      if (Ahead.running) PrintAheadStatistics();
 
       if (Verbose) {
-        printf(
+        Log(
             "|  StraightBinSecs  | IEEE_1344_Control |   Year  |    Day_of_Year  "
             "  |  Hours  | Minutes |Seconds |\n");
-        printf(
+        Log(
             "|  ---------------  | ----------------- |   ----  |    -----------  "
             "  |  -----  | ------- |------- |\n");
-        printf(
+        Log(
             "|                   |                   |         |                 "
             "  |         |         |        |\n");
       }
@@ -908,20 +1887,20 @@ int main(int argc, char **argv) {
     if (LeapState == LEAPSTATE_NORMAL) {
       /* If on the second of a leap (second 59 in the specified minute), then
        * add or delete a second */
-      if ((Year == LeapYear) && (DayOfYear == LeapDayOfYear) && (Hour == LeapHour) && (Minute == LeapMinute)) {
+      if (MinuteAt == LeapMinuteAt) {
         /* To delete a second, which means we go from 58->60 instead of
          * 58->59->00. */
         if ((DeleteLeapSecond) && (Second == 58)) {
           LeapState = LEAPSTATE_DELETING;
 
-          if (Debug) printf("\n<--- Ready to delete a leap second...\n");
+          if (Debug) Log("\n<--- Ready to delete a leap second...\n");
         } else { /* Delete takes precedence over insert. */
           /* To add a second, which means we go from 59->60->00 instead of
            * 59->00. */
           if ((InsertLeapSecond) && (Second == 59)) {
             LeapState = LEAPSTATE_INSERTING;
 
-            if (Debug) printf("\n<--- Ready to insert a leap second...\n");
+            if (Debug) Log("\n<--- Ready to insert a leap second...\n");
           }
         }
       }
@@ -936,21 +1915,21 @@ int main(int argc, char **argv) {
         Second = 0;
         LeapState = LEAPSTATE_NORMAL;
 
-        if (Debug) printf("\n<--- Deleting a leap second...\n");
+        if (Debug) Log("\n<--- Deleting a leap second...\n");
         break;
 
       case LEAPSTATE_INSERTING:
         Second = 60;
         LeapState = LEAPSTATE_ZERO_AFTER_INSERT;
 
-        if (Debug) printf("\n<--- Inserting a leap second...\n");
+        if (Debug) Log("\n<--- Inserting a leap second...\n");
         break;
 
       case LEAPSTATE_ZERO_AFTER_INSERT:
         Second = 0;
         LeapState = LEAPSTATE_NORMAL;
 
-        if (Debug) printf("\n<--- Inserted a leap second, now back to zero...\n");
+        if (Debug) Log("\n<--- Inserted a leap second, now back to zero...\n");
         break;
 
       default:
@@ -962,11 +1941,9 @@ int main(int argc, char **argv) {
     /* Check for second rollover, increment minutes and ripple upward if
      * required. */
     if (Second == 0) {
-      Minute++;
-      if (Minute >= 60) {
-        Minute = 0;
-        Hour++;
-      }
+      int LastYear = Year;
+
+      MinuteAt += SECONDS_PER_MINUTE;
 
       /* Check for activation of DST switch. */
       /* If DST is active, this would mean that at the appointed time, we
@@ -976,129 +1953,163 @@ int main(int argc, char **argv) {
       /* If DST is not active, this would mean that at the appointed time, we
        * activate DST, */
       /* which translates to going forward an hour (skipping the next hour). */
-      if (DstSwitchFlag) {
-        /* The actual switch happens on the zero'th second of the actual minute
-         * specified. */
-        if ((Year == DstSwitchYear) && (DayOfYear == DstSwitchDayOfYear) && (Hour == DstSwitchHour) &&
-            (Minute == DstSwitchMinute)) {
-          if (DstFlag == 0) { /* DST flag is zero, not in DST, going to DST, "spring
-                                 ahead", so increment hour by two instead of one. */
-            Hour++;
-            DstFlag = 1;
-
-            /* Must adjust offset to keep consistent with UTC. */
-            /* Here we have to increase offset by one hour.  If it goes from
-             * negative to positive, then we fix that. */
-            if (OffsetSignBit == 0) { /* Offset is positive */
-              if (OffsetOnes == 0x0F) {
-                OffsetSignBit = 1;
-                OffsetOnes = (OffsetHalf == 0) ? 8 : 7;
-              } else
-                OffsetOnes++;
-            } else { /* Offset is negative */
-              if (OffsetOnes == 0) {
-                OffsetSignBit = 0;
-                OffsetOnes = (OffsetHalf == 0) ? 1 : 0;
-              } else
-                OffsetOnes--;
-            }
-
-            if (Debug)
-              printf(
-                  "\n<--- DST activated, spring ahead an hour, new offset "
-                  "!...\n");
-          } else { /* DST flag is non zero, in DST, going out of DST, "fall
-                      back", so no increment of hour. */
-            Hour--;
-            DstFlag = 0;
-
-            /* Must adjust offset to keep consistent with UTC. */
-            /* Here we have to reduce offset by one hour.  If it goes negative,
-             * then we fix that. */
-            if (OffsetSignBit == 0) { /* Offset is positive */
-              if (OffsetOnes == 0) {
-                OffsetSignBit = 1;
-                OffsetOnes = (OffsetHalf == 0) ? 1 : 0;
-              } else
-                OffsetOnes--;
-            } else { /* Offset is negative */
-              if (OffsetOnes == 0x0F) {
-                OffsetSignBit = 0;
-                OffsetOnes = (OffsetHalf == 0) ? 8 : 7;
-              } else
-                OffsetOnes++;
-            }
-
-            if (Debug) printf("\n<--- DST de-activated, fall back an hour!...\n");
-          }
-
-          DstSwitchFlag = FALSE; /* One time deal, not intended to run this
-                                    program past two switches... */
+      /* The actual switch happens on the zero'th second of the actual minute
+       * specified. */
+      if (MinuteAt == DstMinuteAt) {
+        if (DstFlag == 0) { /* DST flag is zero, not in DST, going to DST, "spring
+                               ahead", so skip an hour. */
+          MinuteAt += SECONDS_PER_HOUR;
+          DstFlag = 1;
+
+          /* Must adjust offset to keep consistent with UTC. */
+          StepOffsetHour(TRUE, &OffsetSignBit, &OffsetOnes, OffsetHalf);
+
+          if (Debug)
+            Log(
+                "\n<--- DST activated, spring ahead an hour, new offset "
+                "!...\n");
+        } else { /* DST flag is non zero, in DST, going out of DST, "fall
+                    back", so repeat an hour. */
+          MinuteAt -= SECONDS_PER_HOUR;
+          DstFlag = 0;
+
+          /* Must adjust offset to keep consistent with UTC. */
+          StepOffsetHour(FALSE, &OffsetSignBit, &OffsetOnes, OffsetHalf);
+
+          if (Debug) Log("\n<--- DST de-activated, fall back an hour!...\n");
         }
-      }
 
-      if (Hour >= 24) {
-        /* Modified, just in case dumb case where activating DST advances
-         * 23h59:59 -> 01h00:00 */
-        Hour = Hour % 24;
-        DayOfYear++;
+        DstMinuteAt = NO_EVENT; /* the next comes from the control socket or the schedule */
       }
 
+      /* The date and time of the minute, straight from its start, across
+       * any day, year or DST switch. */
+      SecondsToCalendar(MinuteAt, &Year, &DayOfYear, &Hour, &Minute, &Second);
+
       /*
        * At year rollover check for leap second.
        */
-      if (DayOfYear >= (Year & 0x3 ? 366 : 367)) {
-        if (leap) {
-          WWV_Second(DATA0, RateCorrection);
-          if (Verbose) printf("\nLeap!");
-          leap = 0;
-        }
-        DayOfYear = 1;
-        Year++;
+      if (Year != LastYear && leap) {
+        WWV_Second(DATA0, RateCorrection);
+        if (Verbose) Log("\nLeap!");
+        leap = 0;
       }
       if (encode == WWV) {
-        snprintf(code, sizeof(code), "%01d%03d%02d%02d%01d", Year / 10, DayOfYear, Hour, Minute, Year % 10);
+        snprintf(code, sizeof(code), "%01d%03d%02d%02d%01d", Year % 100 / 10, DayOfYear, Hour, Minute, Year % 10);
         if (Verbose)
-          printf(
+          Log(
               "\n Year = %2.2d, Day of year = %3d, Time = %2.2d:%2.2d:%2.2d, "
               "Code = %s",
               Year, DayOfYear, Hour, Minute, Second, code);
 
         if ((EnableRateCorrection) || (RemoveCycle) || (AddCycle)) {
-          printf(
+          Log(
               ", CountOfSecondsSent = %d, TotalCyclesAdded = %d, "
               "TotalCyclesRemoved = %d\n",
               CountOfSecondsSent, TotalCyclesAdded, TotalCyclesRemoved);
           if ((CountOfSecondsSent != 0) && ((TotalCyclesAdded != 0) || (TotalCyclesRemoved != 0))) {
             RatioError = ((float)(TotalCyclesAdded - TotalCyclesRemoved)) / (1000.0 * (float)CountOfSecondsSent);
-            printf(
+            Log(
                 " Adjusted by %2.1f%%, apparent send frequency is %4.2f Hz not "
                 "%.3f Hz.\n\n",
                 RatioError * 100.0, (1.0 + RatioError) * SampleRate, SampleRate);
           }
         } else
-          printf("\n");
+          Log("\n");
+        if (RenderFile.fp == NULL) PrintTiming();
+        if (CallbackMode) PrintRingStatistics();
+        if (Ahead.running) PrintAheadStatistics();
 
         ptr = 8;
       }
     } /* End of "if  (Second == 0)" */
 
-    /* After all that, if we are in the minute just prior to a leap second, warn
-     * of leap second pending */
-    /* and of the polarity */
-    if ((Year == LeapYear) && (DayOfYear == LeapDayOfYear) && (Hour == LeapHour) && (Minute == LeapMinute)) {
-      LeapSecondPending = TRUE;
-      LeapSecondPolarity = DeleteLeapSecond;
-    } else {
-      LeapSecondPending = FALSE;
-      LeapSecondPolarity = FALSE;
+    /*
+     * Changes from the control socket take effect at the start of a frame:
+     * a minute for WWV/H, and for IRIG the second its frame starts in.
+     */
+    const struct ControlParams *Changes;
+    if ((encode == WWV ? Second == 0 : Irig->pps >= Irig->frame_bits || Second % (Irig->frame_bits / Irig->pps) == 0) &&
+        (Changes = TakeControl()) != NULL) {
+      int64_t Now = MinuteAt + Second;
+
+      if (Changes->generation[CONTROL_LEAP] != ControlApplied[CONTROL_LEAP]) {
+        InsertLeapSecond = Changes->insert_leap;
+        DeleteLeapSecond = Changes->delete_leap;
+        LeapYear = Changes->leap_year;
+        LeapDayOfYear = Changes->leap_day;
+        LeapHour = Changes->leap_hour;
+        LeapMinute = Changes->leap_minute;
+        LeapMinuteAt = (InsertLeapSecond || DeleteLeapSecond)
+                           ? CalendarToSeconds(LeapYear, LeapDayOfYear, LeapHour, LeapMinute, 0)
+                           : NO_EVENT;
+        if (LeapMinuteAt != NO_EVENT && LeapMinuteAt + 59 < Now)
+          Log("\nWarning: control: leap second at %02d-%03d %02d:%02d is already past.\n", LeapYear, LeapDayOfYear,
+              LeapHour, LeapMinute);
+      }
+      if (Changes->generation[CONTROL_DST] != ControlApplied[CONTROL_DST]) {
+        DstSwitchFlag = Changes->dst_switch;
+        DstSwitchYear = Changes->dst_year;
+        DstSwitchDayOfYear = Changes->dst_day;
+        DstSwitchHour = Changes->dst_hour;
+        DstSwitchMinute = Changes->dst_minute;
+        DstMinuteAt =
+            DstSwitchFlag ? CalendarToSeconds(DstSwitchYear, DstSwitchDayOfYear, DstSwitchHour, DstSwitchMinute, 0)
+                          : NO_EVENT;
+        if (DstMinuteAt <= Now)
+          Log("\nWarning: control: DST switch at %02d-%03d %02d:%02d is already past.\n", DstSwitchYear,
+              DstSwitchDayOfYear, DstSwitchHour, DstSwitchMinute);
+      }
+      if (Changes->generation[CONTROL_QUALITY] != ControlApplied[CONTROL_QUALITY]) TimeQuality = Changes->quality;
+      if (Changes->generation[CONTROL_OFFSET] != ControlApplied[CONTROL_OFFSET]) {
+        OffsetSignBit = Changes->offset_sign;
+        OffsetOnes = Changes->offset_ones;
+        OffsetHalf = Changes->offset_half;
+      }
+      memcpy(ControlApplied, Changes->generation, sizeof ControlApplied);
+      atomic_store_explicit(&Control.applied, Changes->sequence, memory_order_release);
+      Log("\n>> Control: change %u applied from %02d-%03d %02d:%02d:%02d.\n", Changes->sequence, Year, DayOfYear, Hour,
+          Minute, Second);
+    }
+
+    /*
+     * Events from the schedule.  A table loaded again is taken at the start
+     * of a minute, and each event is armed the minute before its own, in
+     * place of any leap second or DST switch from the options or the
+     * control socket.  A DST switch to what is already in effect, such as
+     * one just made, found again in a new table, is passed over.
+     */
+    if (Second == 0 && (Schedule.leap_path != NULL || Schedule.zone != NULL) && TakeSchedule() != NULL) {
+      Schedule.next = FirstEvent(&Schedule.slots[Schedule.front], MinuteAt);
+      ScheduleArmAt = ScheduleArmTime();
+    }
+    while (MinuteAt >= ScheduleArmAt) {
+      const struct ScheduleEvent *Event = &Schedule.slots[Schedule.front].events[Schedule.next++];
+
+      if (Event->kind == EVENT_LEAP_INSERT || Event->kind == EVENT_LEAP_DELETE) {
+        LeapMinuteAt = Event->at;
+        InsertLeapSecond = (Event->kind == EVENT_LEAP_INSERT);
+        DeleteLeapSecond = !InsertLeapSecond;
+      } else if ((Event->kind == EVENT_DST_ON) == (DstFlag == 0)) {
+        DstMinuteAt = Event->at;
+      }
+      ScheduleArmAt = ScheduleArmTime();
+    }
+
+    /* After all that, if we are in the minute just prior to a leap second, warn
+     * of leap second pending */
+    /* and of the polarity */
+    if (MinuteAt == LeapMinuteAt) {
+      LeapSecondPending = TRUE;
+      LeapSecondPolarity = DeleteLeapSecond;
+    } else {
+      LeapSecondPending = FALSE;
+      LeapSecondPolarity = FALSE;
     }
 
     /* Notification through IEEE 1344 happens during the whole minute previous
      * to the minute specified. */
-    /* The time of that minute has been previously calculated. */
-    if ((Year == DstSwitchPendingYear) && (DayOfYear == DstSwitchPendingDayOfYear) && (Hour == DstSwitchPendingHour) &&
-        (Minute == DstSwitchPendingMinute)) {
+    if (MinuteAt == DstMinuteAt - SECONDS_PER_MINUTE) {
       DstPendingFlag = TRUE;
     } else {
       DstPendingFlag = FALSE;
@@ -1118,81 +2129,26 @@ int main(int argc, char **argv) {
       } else
         ControlFunctions = 0;
 
-      if (IrigIncludeYear) {
-        snprintf(ParityString, sizeof(ParityString), "%04X%02d%04d%02d%02d%02d", ControlFunctions & 0x7FFF, Year,
-                 DayOfYear, Hour, Minute, Second);
-      } else {
-        snprintf(ParityString, sizeof(ParityString), "%04X%02d%04d%02d%02d%02d", ControlFunctions & 0x7FFF, 0,
-                 DayOfYear, Hour, Minute, Second);
-      }
-
-      if (IrigIncludeIeee) {
-        ParitySum = 0;
-        for (StringPointer = ParityString; *StringPointer != NUL; StringPointer++) {
-          switch (toupper(*StringPointer)) {
-            case '1':
-            case '2':
-            case '4':
-            case '8':
-              ParitySum += 1;
-              break;
-
-            case '3':
-            case '5':
-            case '6':
-            case '9':
-            case 'A':
-            case 'C':
-              ParitySum += 2;
-              break;
-
-            case '7':
-            case 'B':
-            case 'D':
-            case 'E':
-              ParitySum += 3;
-              break;
-
-            case 'F':
-              ParitySum += 4;
-              break;
-          }
-        }
-
-        if ((ParitySum & 0x01) == 0x01)
-          ParityValue = 0x01;
-        else
-          ParityValue = 0;
-      } else
-        ParityValue = 0;
+      /* Frames slower than a second carry the time they started. */
+      IrigFrameSecond = Second;
+      if (Irig->pps < Irig->frame_bits) IrigFrameSecond -= Second % (Irig->frame_bits / Irig->pps);
 
-      ControlFunctions |= ((ParityValue & 0x01) << 14);
+      ParityValue = EncodeIrigTime(&Frame, Year, DayOfYear, Hour, Minute, IrigFrameSecond, 0, ControlFunctions);
+      if (ParityValue) ControlFunctions |= 0x04000;
 
-      if (IrigIncludeYear) {
-        snprintf(code, sizeof(code),
-                 /* YearDay HourMin Sec */
-                 "%05X%05X%02d%04d%02d%02d%02d", StraightBinarySeconds, ControlFunctions, Year, DayOfYear, Hour, Minute,
-                 Second);
-      } else {
-        snprintf(code, sizeof(code),
-                 /* YearDay HourMin Sec */
-                 "%05X%05X%02d%04d%02d%02d%02d", StraightBinarySeconds, ControlFunctions, 0, DayOfYear, Hour, Minute,
-                 Second);
+      if (Debug) {
+        snprintf(code, sizeof(code), "%05X%05X%02d%04d%02d%02d%02d", StraightBinarySeconds, ControlFunctions,
+                 IrigIncludeYear ? Year : 0, DayOfYear, Hour, Minute, Second);
+        Log("\nCode string: %s, Frame = %09llX%016llX, ParityValue = %d, DstFlag = %d...\n", code,
+            (unsigned long long)Frame.bits[1], (unsigned long long)Frame.bits[0], ParityValue, DstFlag);
       }
-
-      if (Debug)
-        printf(
-            "\nCode string: %s, ParityString = %s, ParitySum = 0x%2.2X, "
-            "ParityValue = %d, DstFlag = %d...\n",
-            code, ParityString, ParitySum, ParityValue, DstFlag);
-
-      ptr = strlen(code) - 1;
-      // OldPtr = 0;
     }
 
     /*
      * Generate data for the second
      */
+    uint64_t SecondStartSample = SampleClock;
+    if (SinksRunning) MarkSinks(CalendarToSeconds(Year, DayOfYear, Hour, Minute, Second));
     switch (encode) {
       /*
        * The IRIG second consists of 20 BCD digits of width-
@@ -1200,180 +2156,55 @@ int main(int argc, char **argv) {
        * percent on the 1000-Hz carrier.
        */
       case IRIG:
-        /* Initialize the output string */
-        OutputDataString[0] = '\0';
-
-        for (BitNumber = 0; BitNumber < 100; BitNumber++) {
-          FrameNumber = (BitNumber / 10) + 1;
-          switch (FrameNumber) {
-            case 1:
-              /* bits 0 to 9, first frame */
-              sw = progz[BitNumber % 10].sw;
-              arg = progz[BitNumber % 10].arg;
-              break;
-
-            case 2:
-            case 3:
-            case 4:
-            case 5:
-            case 6:
-              /* bits 10 to 59, second to sixth frame */
-              sw = progy[BitNumber % 10].sw;
-              arg = progy[BitNumber % 10].arg;
-              break;
-
-            case 7:
-              /* bits 60 to 69, seventh frame */
-              sw = progw[BitNumber % 10].sw;
-              arg = progw[BitNumber % 10].arg;
-              break;
-
-            case 8:
-              /* bits 70 to 79, eighth frame */
-              sw = progv[BitNumber % 10].sw;
-              arg = progv[BitNumber % 10].arg;
-              break;
-
-            case 9:
-              /* bits 80 to 89, ninth frame */
-              sw = progw[BitNumber % 10].sw;
-              arg = progw[BitNumber % 10].arg;
-              break;
-
-            case 10:
-              /* bits 90 to 99, tenth frame */
-              sw = progu[BitNumber % 10].sw;
-              arg = progu[BitNumber % 10].arg;
-              break;
-
-            default:
-              /* , Unexpected values of FrameNumber */
-              printf(
-                  "\n\nUnexpected value of FrameNumber = %d, cannot parse, "
-                  "aborting...\n\n",
-                  FrameNumber);
-              exit(-1);
-              break;
+        FramePosition = (Irig->pps < Irig->frame_bits) ? (Second - IrigFrameSecond) * Irig->pps : 0;
+        for (int Symbol = 0; Symbol < Irig->pps; Symbol++) {
+          /* Faster rates send several frames a second, each with its fraction. */
+          if (FramePosition == Irig->frame_bits) {
+            FramePosition = 0;
+            EncodeIrigTime(&Frame, Year, DayOfYear, Hour, Minute, Second, Symbol * 100 / Irig->pps, ControlFunctions);
           }
 
-          switch (sw) {
-            case DECC: /* decrement pointer and send bit. */
-              ptr--;
-              /* FALLTHRU */
-            case COEF: /* send BCD bit */
-              AsciiValue = toupper(code[ptr]);
-              HexValue = isdigit(AsciiValue) ? AsciiValue - '0' : (AsciiValue - 'A') + 10;
-              /* if  (Debug) {
-                      if  (ptr != OldPtr) {
-                      if  (Verbose)
-                          printf("\n(%c->%X)", AsciiValue, HexValue);
-                      OldPtr = ptr;
-                      }
-              }
-              */
-              // OK, adjust all unused bits in hundreds of days.
-              if ((FrameNumber == 5) && ((BitNumber % 10) > 1)) {
-                if (RateCorrection < 0) {  // Need to remove cycles to catch up.
-                  if ((HexValue & arg) != 0) {
-                    peep(M5, 1000, HIGH);
-                    peep(M5 - 1, 1000, LOW);
-
-                    TotalCyclesRemoved += 1;
-                    strlcat(OutputDataString, "x", OUTPUT_DATA_STRING_LENGTH);
-                  } else {
-                    peep(M2, 1000, HIGH);
-                    peep(M8 - 1, 1000, LOW);
-
-                    TotalCyclesRemoved += 1;
-                    strlcat(OutputDataString, "o", OUTPUT_DATA_STRING_LENGTH);
-                  }
-                }                            // End of true clause for "if  (RateCorrection < 0)"
-                else {                       // Else clause for "if  (RateCorrection < 0)"
-                  if (RateCorrection > 0) {  // Need to add cycles to slow back down.
-                    if ((HexValue & arg) != 0) {
-                      peep(M5, 1000, HIGH);
-                      peep(M5 + 1, 1000, LOW);
-
-                      TotalCyclesAdded += 1;
-                      strlcat(OutputDataString, "+", OUTPUT_DATA_STRING_LENGTH);
-                    } else {
-                      peep(M2, 1000, HIGH);
-                      peep(M8 + 1, 1000, LOW);
-
-                      TotalCyclesAdded += 1;
-                      strlcat(OutputDataString, "*", OUTPUT_DATA_STRING_LENGTH);
-                    }
-                  }       // End of true clause for "if  (RateCorrection > 0)"
-                  else {  // Else clause for "if  (RateCorrection > 0)"
-                    // Rate is OK, just do what you feel!
-                    if ((HexValue & arg) != 0) {
-                      peep(M5, 1000, HIGH);
-                      peep(M5, 1000, LOW);
-                      strlcat(OutputDataString, "1", OUTPUT_DATA_STRING_LENGTH);
-                    } else {
-                      peep(M2, 1000, HIGH);
-                      peep(M8, 1000, LOW);
-                      strlcat(OutputDataString, "0", OUTPUT_DATA_STRING_LENGTH);
-                    }
-                  }   // End of else clause for "if  (RateCorrection > 0)"
-                }     // End of else claues for "if  (RateCorrection < 0)"
-              }       // End of true clause for "if  ((FrameNumber == 5) &&
-                      // (BitNumber == 8))"
-              else {  // Else clause for "if  ((FrameNumber == 5) && (BitNumber
-                      // == 8))"
-                if ((HexValue & arg) != 0) {
-                  peep(M5, 1000, HIGH);
-                  peep(M5, 1000, LOW);
-                  strlcat(OutputDataString, "1", OUTPUT_DATA_STRING_LENGTH);
-                } else {
-                  peep(M2, 1000, HIGH);
-                  peep(M8, 1000, LOW);
-                  strlcat(OutputDataString, "0", OUTPUT_DATA_STRING_LENGTH);
-                }
-              }  // end of else clause for "if  ((FrameNumber == 5) &&
-                 // (BitNumber == 8))"
-              break;
-
-            case DECZ: /* decrement pointer and send zero bit */
-              ptr--;
-              peep(M2, 1000, HIGH);
-              peep(M8, 1000, LOW);
-              strlcat(OutputDataString, "-", OUTPUT_DATA_STRING_LENGTH);
-              break;
-
-            case DEC: /* send marker/position indicator IM/PI bit */
-              ptr--;
-              /* FALLTHRU */
-            case NODEC: /* send marker/position indicator IM/PI bit but no
-                           decrement pointer */
-            case MIN:   /* send "second start" marker/position indicator IM/PI bit
-                         */
-              peep(arg, 1000, HIGH);
-              peep(10 - arg, 1000, LOW);
-              strlcat(OutputDataString, ".", OUTPUT_DATA_STRING_LENGTH);
-              break;
-
-            default:
-              printf(
-                  "\n\nUnknown state machine value \"%d\", unable to continue, "
-                  "aborting...\n\n",
-                  sw);
-              exit(-1);
-              break;
+          const struct IrigBit *bit = &IrigProgram[FramePosition];
+          int one = (Frame.bits[FramePosition / 64] >> (FramePosition % 64)) & 1;
+          char symbol;
+
+          if (bit->field == IRIG_MARKER) {
+            SendIrigSymbol(M8, 10 - M8);
+            symbol = '.';
+          } else if (bit->field == IRIG_UNUSED) {
+            SendIrigSymbol(M2, M8);
+            symbol = '-';
+          } else if (bit->slack && RateCorrection < 0) { /* Need to remove cycles to catch up. */
+            SendIrigSymbol(one ? M5 : M2, (one ? M5 : M8) - 1);
+            TotalCyclesRemoved += 1;
+            symbol = one ? 'x' : 'o';
+          } else if (bit->slack && RateCorrection > 0) { /* Need to add cycles to slow back down. */
+            SendIrigSymbol(one ? M5 : M2, (one ? M5 : M8) + 1);
+            TotalCyclesAdded += 1;
+            symbol = one ? '+' : '*';
+          } else {
+            SendIrigSymbol(one ? M5 : M2, one ? M5 : M8);
+            symbol = one ? '1' : '0';
           }
-          if (ptr < 0) break;
-        }
-        ReverseString(OutputDataString);
-        if (Verbose) {
-          printf("%s", OutputDataString);
-          if (RateCorrection > 0)
-            printf(" fast\n");
-          else {
-            if (RateCorrection < 0)
-              printf(" slow\n");
-            else
-              printf("\n");
+
+          /* Show the first frame of the second, time order reversed to
+           * read the numbers. */
+          if (Verbose && Symbol < Irig->frame_bits) {
+            OutputDataString[Irig->frame_bits - 1 - FramePosition] = symbol;
+            if (FramePosition == Irig->frame_bits - 1) {
+              OutputDataString[Irig->frame_bits] = NUL;
+              Log("%s", OutputDataString);
+              if (RateCorrection > 0)
+                Log(" fast\n");
+              else {
+                if (RateCorrection < 0)
+                  Log(" slow\n");
+                else
+                  Log("\n");
+              }
+            }
           }
+          FramePosition++;
         }
         break;
 
@@ -1389,15 +2220,15 @@ int main(int argc, char **argv) {
             WWV_Second(arg, RateCorrection);
             if (Verbose) {
               if (arg == DATA0)
-                printf("0");
+                Log("0");
               else {
                 if (arg == DATA1)
-                  printf("1");
+                  Log("1");
                 else {
                   if (arg == PI)
-                    printf("P");
+                    Log("P");
                   else
-                    printf("?");
+                    Log("?");
                 }
               }
             }
@@ -1407,15 +2238,15 @@ int main(int argc, char **argv) {
             WWV_SecondNoTick(arg, RateCorrection);
             if (Verbose) {
               if (arg == DATA0)
-                printf("0");
+                Log("0");
               else {
                 if (arg == DATA1)
-                  printf("1");
+                  Log("1");
                 else {
                   if (arg == PI)
-                    printf("P");
+                    Log("P");
                   else
-                    printf("?");
+                    Log("?");
                 }
               }
             }
@@ -1424,20 +2255,20 @@ int main(int argc, char **argv) {
           case COEF: /* send BCD bit */
             if (code[ptr] & arg) {
               WWV_Second(DATA1, RateCorrection);
-              if (Verbose) printf("1");
+              if (Verbose) Log("1");
             } else {
               WWV_Second(DATA0, RateCorrection);
-              if (Verbose) printf("0");
+              if (Verbose) Log("0");
             }
             break;
 
           case LEAP: /* send leap bit */
             if (leap) {
               WWV_Second(DATA1, RateCorrection);
-              if (Verbose) printf("L");
+              if (Verbose) Log("L");
             } else {
               WWV_Second(DATA0, RateCorrection);
-              if (Verbose) printf("0");
+              if (Verbose) Log("0");
             }
             break;
 
@@ -1446,15 +2277,15 @@ int main(int argc, char **argv) {
             WWV_Second(arg, RateCorrection);
             if (Verbose) {
               if (arg == DATA0)
-                printf("0");
+                Log("0");
               else {
                 if (arg == DATA1)
-                  printf("1");
+                  Log("1");
                 else {
                   if (arg == PI)
-                    printf("P");
+                    Log("P");
                   else
-                    printf("?");
+                    Log("?");
                 }
               }
             }
@@ -1465,15 +2296,15 @@ int main(int argc, char **argv) {
             WWV_SecondNoTick(arg, RateCorrection);
             if (Verbose) {
               if (arg == DATA0)
-                printf("0");
+                Log("0");
               else {
                 if (arg == DATA1)
-                  printf("1");
+                  Log("1");
                 else {
                   if (arg == PI)
-                    printf("P");
+                    Log("P");
                   else
-                    printf("?");
+                    Log("?");
                 }
               }
             }
@@ -1481,57 +2312,57 @@ int main(int argc, char **argv) {
 
           case MIN: /* send minute sync */
             if (Minute == 0) {
-              peep(arg, HourTone, HIGH);
+              SendTemplate(&WwvHourTemplate, arg * 1000);
 
               if (RateCorrection < 0) {
-                peep(990 - arg, HourTone, OFF);
+                SendSilence(990 - arg);
                 TotalCyclesRemoved += 10;
 
-                if (Debug) printf("\n* Shorter Second: ");
+                if (Debug) Log("\n* Shorter Second: ");
               } else {
                 if (RateCorrection > 0) {
-                  peep(1010 - arg, HourTone, OFF);
+                  SendSilence(1010 - arg);
 
                   TotalCyclesAdded += 10;
 
-                  if (Debug) printf("\n* Longer Second: ");
+                  if (Debug) Log("\n* Longer Second: ");
                 } else {
-                  peep(1000 - arg, HourTone, OFF);
+                  SendSilence(1000 - arg);
                 }
               }
 
-              if (Verbose) printf("H");
+              if (Verbose) Log("H");
             } else {
-              peep(arg, tone, HIGH);
+              SendTemplate(&WwvMinuteTemplate, arg * 1000);
 
               if (RateCorrection < 0) {
-                peep(990 - arg, tone, OFF);
+                SendSilence(990 - arg);
                 TotalCyclesRemoved += 10;
 
-                if (Debug) printf("\n* Shorter Second: ");
+                if (Debug) Log("\n* Shorter Second: ");
               } else {
                 if (RateCorrection > 0) {
-                  peep(1010 - arg, tone, OFF);
+                  SendSilence(1010 - arg);
 
                   TotalCyclesAdded += 10;
 
-                  if (Debug) printf("\n* Longer Second: ");
+                  if (Debug) Log("\n* Longer Second: ");
                 } else {
-                  peep(1000 - arg, tone, OFF);
+                  SendSilence(1000 - arg);
                 }
               }
 
-              if (Verbose) printf("M");
+              if (Verbose) Log("M");
             }
             break;
 
           case DUT1: /* send DUT1 bits */
             if (dut1 & arg) {
               WWV_Second(DATA1, RateCorrection);
-              if (Verbose) printf("1");
+              if (Verbose) Log("1");
             } else {
               WWV_Second(DATA0, RateCorrection);
-              if (Verbose) printf("0");
+              if (Verbose) Log("0");
             }
             break;
 
@@ -1539,161 +2370,90 @@ int main(int argc, char **argv) {
             ptr--;
             if (DstFlag) {
               WWV_Second(DATA1, RateCorrection);
-              if (Verbose) printf("1");
+              if (Verbose) Log("1");
             } else {
               WWV_Second(DATA0, RateCorrection);
-              if (Verbose) printf("0");
+              if (Verbose) Log("0");
             }
             break;
 
           case DST2: /* send DST2 bit */
             if (DstFlag) {
               WWV_Second(DATA1, RateCorrection);
-              if (Verbose) printf("1");
+              if (Verbose) Log("1");
             } else {
               WWV_Second(DATA0, RateCorrection);
-              if (Verbose) printf("0");
+              if (Verbose) Log("0");
             }
             break;
         }
     }
 
-    if (EnableRateCorrection) {
-      SecondsRunningSimulationTime++;
-
-      gettimeofday(&TimeValue, NULL);
-      NowRealTime = TimeValue.tv_sec;
-
-      if (NowRealTime >= BaseRealTime)  // Just in case system time corrects
-                                        // backwards, do not blow up.
-      {
-        SecondsRunningRealTime = (unsigned)(NowRealTime - BaseRealTime);
-        SecondsRunningDifference = SecondsRunningSimulationTime - SecondsRunningRealTime;
-
-        if (Debug) {
-          printf(
-              "> NowRealTime = 0x%8.8X, BaseRealtime = 0x%8.8X, "
-              "SecondsRunningRealTime = 0x%8.8X, SecondsRunningSimulationTime "
-              "= 0x%8.8X.\n",
-              (unsigned)NowRealTime, (unsigned)BaseRealTime, SecondsRunningRealTime, SecondsRunningSimulationTime);
-          printf(
-              "> SecondsRunningDifference = 0x%8.8X, ExpectedRunningDifference "
-              "= 0x%8.8X.\n",
-              SecondsRunningDifference, ExpectedRunningDifference);
-        }
-
-        if (SecondsRunningSimulationTime > RUN_BEFORE_STABILITY_CHECK) {
-          if (StabilityCount < MINIMUM_STABILITY_COUNT) {
-            if (StabilityCount == 0) {
-              ExpectedRunningDifference = SecondsRunningDifference;
-              StabilityCount++;
-              if (Debug) printf("> Starting stability check.\n");
-            } else {  // Else for "if  (StabilityCount == 0)"
-              if ((ExpectedRunningDifference + INITIAL_STABILITY_BAND > SecondsRunningDifference) &&
-                  (ExpectedRunningDifference - INITIAL_STABILITY_BAND <
-                   SecondsRunningDifference)) {  // So far, still within
-                                                 // stability band, increment
-                                                 // count.
-                StabilityCount++;
-                if (Debug) printf("> StabilityCount = %d.\n", StabilityCount);
-              } else {  // Outside of stability band, start over.
-                StabilityCount = 0;
-                if (Debug) printf("> Out of stability band, start over.\n");
-              }
-            }     // End of else for "if  (StabilityCount == 0)"
-          }       // End of true clause for "if  (StabilityCount <
-                  // MINIMUM_STABILITY_COUNT))"
-          else {  // Else clause for "if  (StabilityCount <
-                  // MINIMUM_STABILITY_COUNT))" - OK, so we are supposed to be
-                  // stable.
-            if (AddCycle) {
-              if (ExpectedRunningDifference >= SecondsRunningDifference) {
-                if (Debug)
-                  printf(
-                      "> Was adding cycles, ExpectedRunningDifference >= "
-                      "SecondsRunningDifference, can stop it now.\n");
-
-                AddCycle = FALSE;
-                RemoveCycle = FALSE;
-              } else {
-                if (Debug) printf("> Was adding cycles, not done yet.\n");
-              }
-            } else {
-              if (RemoveCycle) {
-                if (ExpectedRunningDifference <= SecondsRunningDifference) {
-                  if (Debug)
-                    printf(
-                        "> Was removing cycles, ExpectedRunningDifference <= "
-                        "SecondsRunningDifference, can stop it now.\n");
-
-                  AddCycle = FALSE;
-                  RemoveCycle = FALSE;
-                } else {
-                  if (Debug) printf("> Was removing cycles, not done yet.\n");
-                }
-              } else {
-                if ((ExpectedRunningDifference + RUNNING_STABILITY_BAND > SecondsRunningDifference) &&
-                    (ExpectedRunningDifference - RUNNING_STABILITY_BAND <
-                     SecondsRunningDifference)) {  // All is well, within
-                                                   // tolerances.
-                  if (Debug) printf("> All is well, within tolerances.\n");
-                } else {  // Oops, outside tolerances.  Else clause of "if
-                          // ((ExpectedRunningDifference...SecondsRunningDifference)"
-                  if (ExpectedRunningDifference > SecondsRunningDifference) {
-                    if (Debug)
-                      printf(
-                          "> ExpectedRunningDifference > "
-                          "SecondsRunningDifference, running behind real "
-                          "time.\n");
-
-                    // Behind real time, have to add a cycle to slow down and
-                    // get back in sync.
-                    AddCycle = FALSE;
-                    RemoveCycle = TRUE;
-                  } else {  // Else clause of "if  (ExpectedRunningDifference <
-                            // SecondsRunningDifference)"
-                    if (ExpectedRunningDifference < SecondsRunningDifference) {
-                      if (Debug)
-                        printf(
-                            "> ExpectedRunningDifference < "
-                            "SecondsRunningDifference, running ahead of real "
-                            "time.\n");
-
-                      // Ahead of real time, have to remove a cycle to speed up
-                      // and get back in sync.
-                      AddCycle = TRUE;
-                      RemoveCycle = FALSE;
-                    } else {
-                      if (Debug)
-                        printf(
-                            "> Oops, outside tolerances, but doesn't fit the "
-                            "profiles, how can this be?\n");
-                    }
-                  }  // End of else clause of "if  (ExpectedRunningDifference >
-                     // SecondsRunningDifference)"
-                }    // End of else clause of "if
-                     // ((ExpectedRunningDifference...SecondsRunningDifference)"
-              }      // End of else clause of "if  (RemoveCycle)".
-            }        // End of else clause of "if  (AddCycle)".
-          }          // End of else clause for "if  (StabilityCount <
-                     // MINIMUM_STABILITY_COUNT))"
-        }            // End of true clause for "if  ((SecondsRunningSimulationTime >
-                     // RUN_BEFORE_STABILITY_CHECK)"
-      }              // End of true clause for "if  (NowRealTime >= BaseRealTime)"
-      else {
-        if (Debug) printf("> Hmm, time going backwards?\n");
+    if (Ahead.running) PassAhead();
+    if (RenderFile.fp == NULL) {
+      Timing.second_dac = EstimateDacTime(SecondStartSample);
+      Timing.on_time_error = Timing.second_dac - (Timing.reference + CountOfSecondsSent);
+      if (atomic_load_explicit(&Metrics.underflows, memory_order_relaxed) != UnderflowsReported) {
+        UnderflowsReported = atomic_load_explicit(&Metrics.underflows, memory_order_relaxed);
+        Log("underflow... sadness\n");
       }
-    }  // End of true clause for "if  (EnableRateCorrection)"
+    }
 
-    fflush(stdout);
+    if (EnableRateCorrection) DisciplineRate(Timing.on_time_error);
+    if (State.path != NULL && Discipline.updates > FLL_SECONDS && CountOfSecondsSent % STATE_SAVE_SECONDS == 0)
+      PublishClockState();
+    if (Metrics.path != NULL)
+      PublishMetrics(LeapSecondPending, LeapSecondPolarity, DstFlag, DstPendingFlag, TimeQuality);
+    if (BinaryLog.fp != NULL)
+      LogSecond(SecondStartSample, Year, DayOfYear, Hour, Minute, Second, (encode == IRIG) ? ControlFunctions : 0,
+                (LeapSecondPending ? LOG_LEAP_PENDING : 0) | (LeapSecondPolarity ? LOG_LEAP_DELETE : 0) |
+                    (DstFlag ? LOG_DST : 0) | (DstPendingFlag ? LOG_DST_PENDING : 0));
+  }
+  if (Ahead.running) StopAhead();
+  if (Alsa.pcm != NULL) CloseAlsaDevice();
+  if (Rtp.fd >= 0) CloseRtpDevice();
+  if (SinksRunning) StopSinks();
+  StopControl();
+  if (LogRunning) StopLog();
+  if (State.path != NULL && Discipline.updates > FLL_SECONDS) {
+    PublishClockState();
+    SaveClockState();
+    if (Verbose) printf(">> Clock state saved to %s.\n", State.path);
   }
+  if (BinaryLog.fp != NULL && fclose(BinaryLog.fp) != 0) Die("%s: %s", BinaryLogPath, strerror(errno));
 
-  printf("\n\n>> Completed %d seconds, exiting...\n\n", SecondsToSend);
+  if (CallbackMode) {
+    DrainRing();
+    Log("\n");
+    PrintRingStatistics();
+  }
+  if (RenderFile.fp != NULL) {
+    struct timespec RenderEndTime;
+    clock_gettime(CLOCK_MONOTONIC, &RenderEndTime);
+    double elapsed =
+        (RenderEndTime.tv_sec - RenderStartTime.tv_sec) + (RenderEndTime.tv_nsec - RenderStartTime.tv_nsec) * 1e-9;
+    uint64_t rendered = SampleClock - RenderStartSample;
+
+    CloseRenderFile();
+    Log("\n>> Rendered %llu samples in %.3f s: %.0f samples/s, %.0fx realtime.\n", (unsigned long long)rendered,
+        elapsed, rendered / elapsed, rendered / elapsed / SampleRate);
+    if (Benchmark) PrintBenchmark(elapsed, rendered, CountOfSecondsSent, Year, DayOfYear);
+  }
+  if (Metrics.path != NULL) StopMetrics();
+
+  printf("\n\n>> Completed %d seconds, exiting...\n", SecondsToSend);
+  printf(">> Heap allocations: %lu at startup, %lu after startup (render arena %zu of %zu bytes used).\n\n",
+         AllocationCount - SteadyStateAllocations, SteadyStateAllocations, RenderArena.used, RenderArena.size);
+  for (int i = 1; i < SinkCount; i++)
+    printf(">> Sink %s: %llu bytes written, %lu samples dropped.\n\n", Sinks[i].name,
+           (unsigned long long)Sinks[i].bytes, (unsigned long)Sinks[i].dropped);
+  if (TextLog.dropped || BinaryLog.dropped)
+    printf(">> Log messages dropped: %lu, binary records dropped: %lu.\n\n", (unsigned long)TextLog.dropped,
+           (unsigned long)BinaryLog.dropped);
+  if (Benchmark && SteadyStateAllocations != 0) Die("%lu heap allocations after startup", SteadyStateAllocations);
   return (0);
 }
 
-void Delay(long ms) { peep(ms, 1000, OFF); }
-
 /*
  * Generate WWV/H 0 or 1 data pulse.
  */
@@ -1711,26 +2471,25 @@ void WWV_Second(int code, /* DATA0, DATA1, PI */
    * engineers increased that to 6 dB because the Heath GC-1000
    * WWV/H radio clock worked much better.
    */
-  peep(5, tone, HIGH); /* send seconds tick */
-  peep(25, tone, OFF);
-  peep(code - 30, 100, LOW); /* send data */
+  SendTemplate(&WwvTickTemplate, 30 * 1000);          /* send seconds tick */
+  SendTemplate(&WwvDataTemplate, (code - 30) * 1000); /* send data */
 
   /* The quiet time is shortened or lengthened to get us back on time */
   if (Rate < 0) {
-    peep(990 - code, 100, OFF);
+    SendSilence(990 - code);
 
     TotalCyclesRemoved += 10;
 
-    if (Debug) printf("\n* Shorter Second: ");
+    if (Debug) Log("\n* Shorter Second: ");
   } else {
     if (Rate > 0) {
-      peep(1010 - code, 100, OFF);
+      SendSilence(1010 - code);
 
       TotalCyclesAdded += 10;
 
-      if (Debug) printf("\n* Longer Second: ");
+      if (Debug) Log("\n* Longer Second: ");
     } else
-      peep(1000 - code, 100, OFF);
+      SendSilence(1000 - code);
   }
 }
 
@@ -1751,66 +2510,77 @@ void WWV_SecondNoTick(int code, /* DATA0, DATA1, PI */
    * engineers increased that to 6 dB because the Heath GC-1000
    * WWV/H radio clock worked much better.
    */
-  peep(30, tone, OFF);       /* send seconds non-tick */
-  peep(code - 30, 100, LOW); /* send data */
+  SendSilence(30);                                    /* send seconds non-tick */
+  SendTemplate(&WwvDataTemplate, (code - 30) * 1000); /* send data */
 
   /* The quiet time is shortened or lengthened to get us back on time */
   if (Rate < 0) {
-    peep(990 - code, 100, OFF);
+    SendSilence(990 - code);
 
     TotalCyclesRemoved += 10;
 
-    if (Debug) printf("\n* Shorter Second: ");
+    if (Debug) Log("\n* Shorter Second: ");
   } else {
     if (Rate > 0) {
-      peep(1010 - code, 100, OFF);
+      SendSilence(1010 - code);
 
       TotalCyclesAdded += 10;
 
-      if (Debug) printf("\n* Longer Second: ");
+      if (Debug) Log("\n* Longer Second: ");
     } else
-      peep(1000 - code, 100, OFF);
+      SendSilence(1000 - code);
   }
 }
 
 /*
- * Generate cycles of 100 Hz or any multiple of 100 Hz.
+ * Advance the sample clock, and pass the samples to each sink.
  */
-void peep(int pulse, /* pulse length (ms) */
-          int freq,  /* frequency (Hz) */
-          int amp    /* amplitude */
-) {
-  double dpulse = pulse;
-  double dfreq = freq;
-  double damp;
-
-  switch (amp) {
-    case OFF:
-      damp = 0.;
-      break;
-    case LOW:
-      damp = 0.25;
-      break;
-    case HIGH:
-      damp = 0.75;
-      break;
-    default:
-      Die("???");
-  }
-
-  int n_samples = (int)(SampleRate * dpulse / 1000.);
+void Emit(const void *samples, int n_samples) {
+  SampleClock += n_samples;
+  for (int i = 0; i < SinkCount; i++) Sinks[i].write(&Sinks[i], samples, n_samples);
+}
 
-  float *buffer;
-  buffer = malloc(sizeof(float) * n_samples);
+/*
+ * Write samples to the audio stream, queue them for the callback, or
+ * render them into a slot for the device writer.
+ */
+void DeviceWrite(struct Sink *sink, const void *samples, int n_samples) {
+  (void)sink;
+  if (CallbackMode)
+    RingWrite(samples, n_samples);
+  else if (Ahead.running)
+    QueueAhead(samples, n_samples);
+  else
+    WriteDevice(samples, n_samples);
+}
 
-  for (int i = 0; i < n_samples; i++) {
-    buffer[i] = damp * sin(dfreq * 2 * M_PI * ((double)i / SampleRate));
+/*
+ * Blocking write to the device, timed for the metrics if they are being
+ * written.  Underflows are counted, and reported by the generator.
+ */
+void WriteDevice(const void *samples, int n_samples) {
+  struct timespec start, end;
+  PaError err = paNoError;
+  if (Metrics.path != NULL) clock_gettime(CLOCK_MONOTONIC, &start);
+  if (Alsa.pcm != NULL)
+    AlsaWrite(samples, n_samples);
+  else if (Rtp.fd >= 0)
+    RtpWrite(samples, n_samples);
+  else
+    err = Pa_WriteStream(stream, samples, n_samples);
+
+  if (Metrics.path != NULL) {
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    int64_t ns = (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
+    int bucket = 0;
+    while (bucket < METRICS_WRITE_BUCKETS && ns > 1000LL << bucket) bucket++;
+    atomic_fetch_add_explicit(&Metrics.writes[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&Metrics.write_ns, ns, memory_order_relaxed);
   }
-  PaError err = Pa_WriteStream(stream, buffer, n_samples);
-  free(buffer);
+
   switch (err) {
     case paOutputUnderflowed:
-      printf("underflow... sadness\n");
+      atomic_fetch_add_explicit(&Metrics.underflows, 1, memory_order_relaxed);
       break;
     case paNoError:
       break;
@@ -1819,168 +2589,3024 @@ void peep(int pulse, /* pulse length (ms) */
   }
 }
 
-/* Calc day of year from year month & day */
-/* Year - 0 means 2000, 100 means 2100. */
-/* Month - 1 means January, 12 means December. */
-/* DayOfMonth - 1 is first day of month */
-int ConvertMonthDayToDayOfYear(int YearValue, int MonthValue, int DayOfMonthValue) {
-  int ReturnValue;
-  int LeapYear;
-  int MonthCounter;
-
-  /* Array of days in a month.  Note that here January is zero. */
-  /* NB: have to add 1 to days in February in a leap year! */
-  int DaysInMonth[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+void RenderWrite(struct Sink *sink, const void *samples, int n_samples) {
+  (void)sink;
+  if (Benchmark) return;
+  if (fwrite(samples, OutputFormat->bytes, n_samples, RenderFile.fp) != (size_t)n_samples)
+    Die("write to render file failed: %s", strerror(errno));
+  RenderFile.bytes += (uint64_t)OutputFormat->bytes * n_samples;
+}
 
-  LeapYear = FALSE;
-  if ((YearValue % 4) == 0) {
-    if ((YearValue % 100) == 0) {
-      if ((YearValue % 400) == 0) {
-        LeapYear = TRUE;
-      }
-    } else {
-      LeapYear = TRUE;
+/*
+ * Parse an -O sink, stdout or capture:prefix[:seconds], and set it up.
+ * Samples written to stdout are raw, in OutputFormat; the messages that
+ * would have gone there go to stderr instead.
+ */
+void AddSink(const char *spec) {
+  struct Sink *sink = &Sinks[SinkCount];
+  struct stat st;
+
+  if (SinkCount == MAX_SINKS) Die("Too many sinks (at most %d -O).", MAX_SINKS - 1);
+  sink->name = spec;
+  sink->write = QueueSamples;
+  sink->second = -1;
+  if (strcmp(spec, SINK_STDOUT) == 0) {
+    for (int i = 1; i < SinkCount; i++)
+      if (Sinks[i].flush == PipeFlush) Die("Only one sink can be stdout.");
+    fflush(stdout);
+    sink->fd = dup(STDOUT_FILENO);
+    if (sink->fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) Die("can't take over stdout: %s", strerror(errno));
+    sink->pipe = fstat(sink->fd, &st) == 0 && S_ISFIFO(st.st_mode);
+    sink->flush = PipeFlush;
+    signal(SIGPIPE, SIG_IGN); /* a reader going away is an error on the sink, not the end of tg2 */
+  } else if (strncmp(spec, SINK_CAPTURE_PREFIX, strlen(SINK_CAPTURE_PREFIX)) == 0) {
+    char *path = strdup(spec + strlen(SINK_CAPTURE_PREFIX));
+    char *seconds = strrchr(path, ':');
+
+    sink->rotate = SINK_CAPTURE_SECONDS;
+    if (seconds != NULL) {
+      *seconds++ = '\0';
+      if (sscanf(seconds, "%d", &sink->rotate) != 1 || sink->rotate <= 0) Die("Bad capture length (%s)", spec);
     }
+    if (*path == '\0') Die("Bad capture file (%s)", spec);
+    sink->path = path;
+    sink->fd = -1; /* opened at the first second */
+    sink->flush = CaptureFlush;
+    sink->mark = CaptureMark;
+  } else {
+    Die("Bad sink (%s), should be %s or %sprefix[:seconds]", spec, SINK_STDOUT, SINK_CAPTURE_PREFIX);
   }
 
-  if (Debug)
-    printf("\nConvertMonthDayToDayOfYear(): Year %d %s a leap year.\n", YearValue + 2000, LeapYear ? "is" : "is not");
+  sink->size = SINK_QUEUE_ENTRIES;
+  sink->queue = Allocate(sink->size * sizeof(struct iovec), ARENA_ALIGNMENT);
+  memset(sink->queue, 0, sink->size * sizeof(struct iovec)); /* fault it in now */
+  atomic_init(&sink->head, 0);
+  atomic_init(&sink->tail, 0);
+  atomic_init(&sink->dropped, 0);
+  SinkCount++;
+}
 
-  /* Day of month given us starts in this algorithm. */
-  ReturnValue = DayOfMonthValue;
+/*
+ * Queue a reference to the samples.  The buffer is never written again,
+ * so the sink thread can take its time.
+ */
+void QueueSamples(struct Sink *sink, const void *samples, int n_samples) {
+  if (n_samples > 0 && !PushSink(sink, samples, (size_t)OutputFormat->bytes * n_samples))
+    atomic_fetch_add_explicit(&sink->dropped, n_samples, memory_order_relaxed);
+}
 
-  /* Add in days in month for each month past January. */
-  for (MonthCounter = 1; MonthCounter < MonthValue; MonthCounter++) {
-    ReturnValue += DaysInMonth[MonthCounter - 1];
+int PushSink(struct Sink *sink, const void *base, size_t length) {
+  const struct timespec wait = {0, 100000};
+  uint64_t head = atomic_load_explicit(&sink->head, memory_order_relaxed);
+
+  while (head - atomic_load_explicit(&sink->tail, memory_order_acquire) == sink->size) {
+    if (RenderFile.fp == NULL) return FALSE; /* no stalling the device for a sink */
+    nanosleep(&wait, NULL);
   }
+  sink->queue[head & (sink->size - 1)] = (struct iovec){(void *)base, length};
+  atomic_store_explicit(&sink->head, head + 1, memory_order_release);
+  return TRUE;
+}
 
-  /* Add a day for leap years where we are past February. */
-  if ((LeapYear) && (MonthValue > 2)) {
-    ReturnValue++;
+void MarkSinks(int64_t seconds) {
+  for (int i = 1; i < SinkCount; i++)
+    if (Sinks[i].mark != NULL) PushSink(&Sinks[i], NULL, seconds);
+}
+
+/*
+ * Write buffers to stdout: spliced into a pipe, gathered into one write
+ * otherwise.  On an error the sink gives up and drops the rest.
+ */
+void PipeFlush(struct Sink *sink, struct iovec *iov, int n) {
+  while (n > 0) {
+    ssize_t done = sink->pipe ? vmsplice(sink->fd, iov, n, 0) : writev(sink->fd, iov, n);
+
+    if (done < 0 && errno == EINTR) continue;
+    if (done < 0 && sink->pipe && errno == EINVAL) { /* can't splice here after all */
+      sink->pipe = FALSE;
+      continue;
+    }
+    if (done < 0) {
+      fprintf(stderr, "Warning: %s: %s, no more samples will be sent.\n", sink->name, strerror(errno));
+      close(sink->fd);
+      sink->fd = -1;
+      return;
+    }
+    sink->bytes += done;
+    for (; n > 0 && (size_t)done >= iov->iov_len; iov++, n--) done -= iov->iov_len;
+    if (n > 0) {
+      iov->iov_base = (char *)iov->iov_base + done;
+      iov->iov_len -= done;
+    }
   }
+}
 
-  if (Debug)
-    printf(
-        "\nConvertMonthDayToDayOfYear(): %4.4d-%2.2d-%2.2d represents day %3d "
-        "of year.\n",
-        YearValue + 2000, MonthValue, DayOfMonthValue, ReturnValue);
+void CaptureFlush(struct Sink *sink, struct iovec *iov, int n) {
+  PipeFlush(sink, iov, n); /* a regular file, so writev() */
+}
 
-  return (ReturnValue);
+/*
+ * Start a new capture file every rotate seconds, named for the time of
+ * its first sample: prefix-YYDDD-HHMMSS.raw.
+ */
+void CaptureMark(struct Sink *sink, int64_t seconds) {
+  char name[PATH_MAX];
+  int year, day, hour, minute, second;
+
+  if (seconds == sink->second) return; /* a leap second, and the second after it */
+  sink->second = seconds;
+  if (sink->fd >= 0 && seconds % sink->rotate != 0) return;
+  if (sink->fd >= 0 && close(sink->fd) != 0) fprintf(stderr, "Warning: %s: %s\n", sink->name, strerror(errno));
+
+  SecondsToCalendar(seconds, &year, &day, &hour, &minute, &second);
+  snprintf(name, sizeof(name), "%s-%02d%03d-%02d%02d%02d.raw", sink->path, year, day, hour, minute, second);
+  sink->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (sink->fd < 0) fprintf(stderr, "Warning: can't open capture file %s: %s\n", name, strerror(errno));
 }
 
-void Help(void) {
-  printf("\n\nTime Code Generation - IRIG-B or WWV, v%d.%d, %s dmw", VERSION, ISSUE, ISSUE_DATE);
-  printf("\n\nRCS Info:");
-  printf(
-      "\n  $Header: /home/dmw/src/IRIG_generation/ntp-4.2.2p3/util/RCS/tg.c,v "
-      "1.28 2007/02/12 23:57:45 dmw Exp $");
-  printf("\n\nUsage: %s [option]*", CommandName);
-  printf(
-      "\n         -a name|N                      Audio device by name or "
-      "number.");
-  printf(
-      "\n         -b yymmddhhmm                  Remove leap second at end of "
-      "minute specified");
-  printf(
-      "\n         -c seconds_to_send             Number of seconds to send "
-      "(default 0 = forever)");
-  printf(
-      "\n         -d                             Start with IEEE 1344 DST "
-      "active");
-  printf("\n         -D milliseconds                Latency through the codec");
-  printf(
-      "\n         -f format_type                 i = Modulated IRIG-B 1998 (no "
-      "year coded)");
-  printf(
-      "\n                                        2 = Modulated IRIG-B 2002 "
-      "(year coded)");
-  printf(
-      "\n                                        3 = Modulated IRIG-B w/IEEE "
-      "1344 (year & control funcs) (default)");
-  printf("\n                                        w = WWV(H)");
-  printf(
-      "\n         -g yymmddhhmm                  Switch into/out of DST at "
-      "beginning of minute specified");
-  printf(
-      "\n         -i yymmddhhmm                  Insert leap second at end of "
-      "minute specified");
-  printf(
-      "\n         -j                             Disable time rate correction "
-      "against system clock (default enabled)");
-  printf(
-      "\n         -k nn                          Force rate correction for "
-      "testing (+1 = add cycle, -1 = remove cycle)");
-  printf(
-      "\n         -l time_offset                 Set offset of time sent to "
-      "UTC as per computer, +/- float hours");
-  printf(
-      "\n         -o time_offset                 Set IEEE 1344 time offset, "
-      "+/-, to 0.5 hour (default 0)");
-  printf(
-      "\n         -q quality_code_hex            Set IEEE 1344 quality code "
-      "(default 0)");
-  printf("\n         -r rate                        Set sample rate (Hz)");
-  printf(
-      "\n         -s                             Set leap warning bit (WWV[H] "
-      "only)");
-  printf(
-      "\n         -t sync_frequency              WWV(H) on-time pulse tone "
-      "frequency (default 1200)");
-  printf(
-      "\n         -u DUT1_offset                 Set WWV(H) DUT1 offset -7 to "
-      "+7 (default 0)");
-  printf(
-      "\n         -x                             Turn off verbose output "
-      "(default on)");
-  printf(
-      "\n         -y yymmddhhmmss                Set initial date and time as "
-      "specified (default system time)");
-  printf(
-      "\n\nThis software licenced under the GPL, modifications performed 2006 "
-      "& 2007 by Dean Weiten");
-  printf(
-      "\nContact: Dean Weiten, Norscan Instruments Ltd., Winnipeg, MB, Canada, "
-      "ph (204)-233-9138, E-mail dmw@norscan.com");
-  printf("\n\n");
+void StartSinks(void) {
+  if (SinkCount == 1) return;
+  atomic_init(&SinkStop, FALSE);
+  if (pthread_create(&SinkThread, NULL, SinkWriter, NULL) != 0) Die("can't start the sink thread");
+  SinksRunning = TRUE;
 }
 
-/* Reverse string order for nicer print. */
-void ReverseString(char *str) {
-  int StringLength;
-  int IndexCounter;
-  int CentreOfString;
-  char TemporaryCharacter;
+void StopSinks(void) {
+  SinksRunning = FALSE;
+  atomic_store(&SinkStop, TRUE);
+  pthread_join(SinkThread, NULL);
+  for (int i = 1; i < SinkCount; i++)
+    if (Sinks[i].fd >= 0 && close(Sinks[i].fd) != 0)
+      fprintf(stderr, "Warning: %s: %s\n", Sinks[i].name, strerror(errno));
+}
+
+void *SinkWriter(void *arg) {
+  const struct timespec poll = {0, SINK_POLL_MS * 1000000L};
+
+  (void)arg;
+  for (;;) {
+    int stop = atomic_load(&SinkStop); /* before draining, so nothing queued before the stop is missed */
+    int written = 0;
+
+    for (int i = 1; i < SinkCount; i++) written += DrainSink(&Sinks[i]);
+    if (stop) return NULL;
+    if (written == 0) nanosleep(&poll, NULL);
+  }
+}
+
+/*
+ * Write out everything queued for a sink, SINK_BATCH buffers at a time,
+ * and act on the marks between them.
+ */
+int DrainSink(struct Sink *sink) {
+  uint64_t head = atomic_load_explicit(&sink->head, memory_order_acquire);
+  uint64_t tail = atomic_load_explicit(&sink->tail, memory_order_relaxed);
+  int drained = head - tail;
+
+  while (tail != head) {
+    struct iovec batch[SINK_BATCH];
+    int n = 0;
+
+    while (tail != head && n < SINK_BATCH) {
+      const struct iovec *entry = &sink->queue[tail & (sink->size - 1)];
+
+      if (entry->iov_base == NULL) {
+        if (n > 0) break; /* write out what comes before it first */
+        sink->mark(sink, (int64_t)entry->iov_len);
+      } else {
+        batch[n++] = *entry;
+      }
+      tail++;
+    }
+    if (n > 0 && sink->fd >= 0) sink->flush(sink, batch, n);
+    atomic_store_explicit(&sink->tail, tail, memory_order_release);
+  }
+  return drained;
+}
 
-  StringLength = strlen(str);
-  CentreOfString = (StringLength / 2) + 1;
-  for (IndexCounter = StringLength; IndexCounter >= CentreOfString; IndexCounter--) {
-    TemporaryCharacter = str[IndexCounter - 1];
-    str[IndexCounter - 1] = str[StringLength - IndexCounter];
-    str[StringLength - IndexCounter] = TemporaryCharacter;
+/*
+ * Listen on the control socket.  A socket left behind by an earlier run is
+ * replaced, but nothing else at the path is.
+ */
+void StartControl(void) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  struct stat st;
+
+  if (strlen(Control.path) >= sizeof addr.sun_path) Die("control socket path %s is too long", Control.path);
+  strcpy(addr.sun_path, Control.path);
+  if (lstat(Control.path, &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) Die("%s is in the way of the control socket", Control.path);
+    unlink(Control.path);
   }
+  if ((Control.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 ||
+      bind(Control.fd, (struct sockaddr *)&addr, sizeof addr) < 0 || listen(Control.fd, 4) < 0)
+    Die("can't listen on %s: %s", Control.path, strerror(errno));
+
+  Control.back = 0;
+  Control.front = 1;
+  atomic_init(&Control.middle, 2);
+  atomic_init(&Control.applied, 0);
+  atomic_init(&Control.stop, FALSE);
+  if (pthread_create(&Control.thread, NULL, ControlServer, NULL) != 0) Die("can't start the control thread");
+  printf("control socket %s\n", Control.path);
 }
 
-size_t strlcat(char *dst, const char *src, size_t size) {
-  char *d = dst;
-  const char *s = src;
-  size_t n = size;
-  size_t dlen;
+void StopControl(void) {
+  if (Control.fd < 0) return;
+  atomic_store(&Control.stop, TRUE);
+  pthread_join(Control.thread, NULL);
+  close(Control.fd);
+  unlink(Control.path);
+  Control.fd = -1;
+}
 
-  while (n-- != 0 && *d != '\0')
-    d++;
-  dlen = d - dst;
-  n = size - dlen;
+/*
+ * Control thread: one client at a time, waking every CONTROL_POLL_MS to
+ * see if it should stop.
+ */
+void *ControlServer(void *arg) {
+  (void)arg;
+  while (!atomic_load(&Control.stop)) {
+    struct pollfd pfd = {Control.fd, POLLIN, 0};
+
+    if (poll(&pfd, 1, CONTROL_POLL_MS) <= 0) continue;
+    int client = accept4(Control.fd, NULL, NULL, SOCK_CLOEXEC);
+    if (client < 0) continue;
+    ServeControl(client);
+    close(client);
+  }
+  return NULL;
+}
 
-  if (n == 0)
-    return dlen + strlen(s);
-  while (*s != '\0') {
-    if (n != 1) {
-      *d++ = *s;
-      n--;
+/*
+ * Carry out a client's commands, a line at a time, replying to each, until
+ * it hangs up; a last line without a newline counts.
+ */
+void ServeControl(int fd) {
+  char line[CONTROL_LINE], reply[CONTROL_LINE];
+  size_t used = 0;
+
+  while (!atomic_load(&Control.stop)) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+
+    if (poll(&pfd, 1, CONTROL_POLL_MS) <= 0) continue;
+    ssize_t n = read(fd, line + used, sizeof line - 1 - used);
+    if (n > 0)
+      used += n;
+    else if (used > 0)
+      line[used++] = '\n';
+    else
+      return;
+
+    char *end;
+    while ((end = memchr(line, '\n', used)) != NULL) {
+      *end = '\0';
+      ControlCommand(line, reply, sizeof reply);
+      if (send(fd, reply, strlen(reply), MSG_NOSIGNAL) < 0) return;
+      used -= end + 1 - line;
+      memmove(line, end + 1, used);
+    }
+    if (n <= 0) return;
+    if (used == sizeof line - 1) {
+      send(fd, "error: line too long\n", 21, MSG_NOSIGNAL);
+      return;
     }
-    s++;
   }
-  *d = '\0';
+}
+
+/*
+ * Carry out one command, leaving a line of reply.  Commands are
+ *   leap insert|delete yymmddhhmm   leap second at the end of that minute
+ *   leap none                       cancel it
+ *   dst yymmddhhmm|none             switch into or out of DST at the start of that minute
+ *   quality h                       IEEE 1344 time quality, hex 0 to f
+ *   offset hours                    IEEE 1344 time offset, +/- to the half hour
+ *   status                          the parameters as last set, and if applied yet
+ * as for -i, -b, -g, -q and -o.  Changes apply at the next frame boundary.
+ */
+void ControlCommand(const char *line, char *reply, size_t size) {
+  struct ControlParams *p = &Control.requested;
+  char word[16] = "", arg[16] = "", when[16] = "";
+  int year, day, hour, minute;
+  enum ControlGroup group;
+  unsigned quality;
+  float hours;
+
+  sscanf(line, "%15s %15s %15s", word, arg, when);
+  if (strcmp(word, "leap") == 0 && strcmp(arg, "none") == 0) {
+    p->insert_leap = p->delete_leap = FALSE;
+    p->leap_day = 0; /* matches no day, so no warning either */
+    group = CONTROL_LEAP;
+  } else if (strcmp(word, "leap") == 0 && (strcmp(arg, "insert") == 0 || strcmp(arg, "delete") == 0) &&
+             ParseControlMinute(when, &year, &day, &hour, &minute)) {
+    p->insert_leap = (strcmp(arg, "insert") == 0);
+    p->delete_leap = !p->insert_leap;
+    p->leap_year = year;
+    p->leap_day = day;
+    p->leap_hour = hour;
+    p->leap_minute = minute;
+    group = CONTROL_LEAP;
+  } else if (strcmp(word, "dst") == 0 && strcmp(arg, "none") == 0) {
+    p->dst_switch = FALSE;
+    group = CONTROL_DST;
+  } else if (strcmp(word, "dst") == 0 && ParseControlMinute(arg, &year, &day, &hour, &minute)) {
+    p->dst_switch = TRUE;
+    p->dst_year = year;
+    p->dst_day = day;
+    p->dst_hour = hour;
+    p->dst_minute = minute;
+    group = CONTROL_DST;
+  } else if (strcmp(word, "quality") == 0 && sscanf(arg, "%x", &quality) == 1 && quality <= 0x0F) {
+    p->quality = quality;
+    group = CONTROL_QUALITY;
+  } else if (strcmp(word, "offset") == 0 && sscanf(arg, "%f", &hours) == 1 && fabsf(hours) <= 15.5) {
+    SetTimeOffset(hours, &p->offset_sign, &p->offset_ones, &p->offset_half);
+    group = CONTROL_OFFSET;
+  } else if (strcmp(word, "status") == 0) {
+    char leap[32] = "none", dst[32] = "none";
+
+    if (p->insert_leap || p->delete_leap)
+      snprintf(leap, sizeof leap, "%s %02d-%03d %02d:%02d", p->insert_leap ? "insert" : "delete", p->leap_year,
+               p->leap_day, p->leap_hour, p->leap_minute);
+    if (p->dst_switch)
+      snprintf(dst, sizeof dst, "%02d-%03d %02d:%02d", p->dst_year, p->dst_day, p->dst_hour, p->dst_minute);
+    snprintf(reply, size, "leap %s, dst %s, quality %x, offset %c%d.%d h, change %u of %u applied\n", leap, dst,
+             p->quality, p->offset_sign ? '-' : '+', p->offset_ones, p->offset_half ? 5 : 0,
+             atomic_load_explicit(&Control.applied, memory_order_acquire), p->sequence);
+    return;
+  } else {
+    snprintf(reply, size, "error: can't do \"%s\"\n", line);
+    return;
+  }
+
+  p->generation[group]++;
+  p->sequence++;
+  PublishControl();
+  snprintf(reply, size, "ok, change %u at the next frame\n", p->sequence);
+}
+
+/* Parse yymmddhhmm, as for -i, -b and -g; FALSE if it isn't a time. */
+int ParseControlMinute(const char *text, int *year, int *day, int *hour, int *minute) {
+  int month, day_of_month, length = 0;
+
+  if (sscanf(text, "%2d%2d%2d%2d%2d%n", year, &month, &day_of_month, hour, minute, &length) != 5 || length != 10 ||
+      text[length] != '\0')
+    return FALSE;
+  if (month < 1 || month > 12 || day_of_month < 1 || day_of_month > 31 || *hour > 23 || *minute > 59) return FALSE;
+  *day = ConvertMonthDayToDayOfYear(*year, month, day_of_month);
+  return TRUE;
+}
+
+/*
+ * Control thread: put the requested parameters in the back slot and swap
+ * it for the middle one, marked fresh.
+ */
+void PublishControl(void) {
+  Control.slots[Control.back] = Control.requested;
+  Control.back =
+      atomic_exchange_explicit(&Control.middle, Control.back | CONTROL_FRESH, memory_order_acq_rel) & ~CONTROL_FRESH;
+}
+
+/*
+ * Generator: if the middle slot is fresh, swap the front slot for it and
+ * return it; it stays put until the next swap.
+ */
+const struct ControlParams *TakeControl(void) {
+  if (Control.fd < 0 || !(atomic_load_explicit(&Control.middle, memory_order_relaxed) & CONTROL_FRESH)) return NULL;
+  Control.front = atomic_exchange_explicit(&Control.middle, Control.front, memory_order_acq_rel) & ~CONTROL_FRESH;
+  return &Control.slots[Control.front];
+}
+
+/*
+ * Load the schedule for the run; a file that can't be read is fatal here,
+ * only a warning when it's loaded again.
+ */
+void StartSchedule(void) {
+  if (Schedule.zone != NULL) {
+    if (Schedule.zone[0] == '/')
+      snprintf(Schedule.zone_path, sizeof Schedule.zone_path, "%s", Schedule.zone);
+    else
+      snprintf(Schedule.zone_path, sizeof Schedule.zone_path, "%s/%s",
+               getenv("TZDIR") != NULL ? getenv("TZDIR") : ZONEINFO_DIR, Schedule.zone);
+  }
+  Schedule.back = 0;
+  Schedule.front = 1;
+  atomic_init(&Schedule.middle, 2);
+  Schedule.checked = time(NULL);
+  if (!LoadSchedule(&Schedule.slots[Schedule.front])) Die("Can't load the leap second and DST schedule.");
+  if (Verbose)
+    printf("Schedule has %d leap second and DST events.\n", Schedule.slots[Schedule.front].count);
+}
+
+int LoadSchedule(struct EventTable *table) {
+  struct stat st;
+
+  table->count = 0;
+  if (Schedule.zone != NULL) {
+    if (stat(Schedule.zone_path, &st) == 0) Schedule.zone_mtime = st.st_mtim;
+    if (!LoadZone(table)) return FALSE;
+    qsort(table->events, table->count, sizeof *table->events, CompareEvents); /* for ZoneOffset() */
+  }
+  if (Schedule.leap_path != NULL) {
+    if (stat(Schedule.leap_path, &st) == 0) Schedule.leap_mtime = st.st_mtim;
+    if (!LoadLeapSeconds(table)) return FALSE;
+  }
+  qsort(table->events, table->count, sizeof *table->events, CompareEvents);
+  return TRUE;
+}
+
+/*
+ * Each line of a leap-seconds.list is an NTP time, the start of a UTC
+ * day, and TAI - UTC from then on; a change in it is a leap second at the
+ * end of the day before.  "#@" gives the time the list expires.
+ */
+int LoadLeapSeconds(struct EventTable *table) {
+  FILE *fp = fopen(Schedule.leap_path, "r");
+  char line[SCHEDULE_LINE];
+  long long ntp, expires = 0;
+  int offset, previous = -1, full = FALSE;
+
+  if (fp == NULL) {
+    fprintf(stderr, "Warning: can't read %s: %s\n", Schedule.leap_path, strerror(errno));
+    return FALSE;
+  }
+  while (fgets(line, sizeof line, fp) != NULL) {
+    if (line[0] == '#') {
+      if (line[1] == '@') sscanf(line + 2, "%lld", &expires);
+      continue;
+    }
+    if (sscanf(line, "%lld %d", &ntp, &offset) != 2) continue;
+    if (previous >= 0 && offset != previous && ntp >= NTP_TO_2000 + SECONDS_PER_MINUTE) {
+      int64_t utc = ntp - NTP_TO_2000 - SECONDS_PER_MINUTE; /* the last minute of the day */
+
+      full |= !AddEvent(table, utc + ZoneOffset(table, utc), utc,
+                        offset > previous ? EVENT_LEAP_INSERT : EVENT_LEAP_DELETE, 0);
+    }
+    previous = offset;
+  }
+  fclose(fp);
+  if (previous < 0) {
+    fprintf(stderr, "Warning: %s isn't a leap-seconds.list.\n", Schedule.leap_path);
+    return FALSE;
+  }
+  if (full) fprintf(stderr, "Warning: too many events, leap seconds from %s left out.\n", Schedule.leap_path);
+  if (expires != 0 && expires - NTP_TO_2000 + UNIX_TO_2000 < time(NULL))
+    fprintf(stderr, "Warning: %s has expired, so leap seconds after it are missing.\n", Schedule.leap_path);
+  return TRUE;
+}
+
+/* A big-endian signed integer of 4 or 8 bytes. */
+static long long BigEndian(const unsigned char *p, int bytes) {
+  uint64_t value = 0;
+
+  for (int i = 0; i < bytes; i++) value = value << 8 | p[i];
+  return bytes == 4 ? (long long)(int32_t)value : (long long)value;
+}
+
+/*
+ * A TZif file has a table of transitions, each a UTC time and the local
+ * time type from then on, each type a UTC offset and whether it is DST.
+ * Version 1 data, with 32-bit times, comes first; later versions follow
+ * it with the same again with 64-bit times, and a TZ rule for times after
+ * the table.  A transition that turns DST on or off is a DST switch, in
+ * the minute it happens in by the clock before it.
+ */
+int LoadZone(struct EventTable *table) {
+  static unsigned char data[ZONE_FILE_MAX]; /* the log writer and main don't load at once */
+  FILE *fp = fopen(Schedule.zone_path, "rb");
+  size_t size;
+  const unsigned char *p = data;
+  int time_size = 4, full = FALSE;
+
+  if (fp == NULL) {
+    fprintf(stderr, "Warning: can't read %s: %s\n", Schedule.zone_path, strerror(errno));
+    return FALSE;
+  }
+  size = fread(data, 1, sizeof data, fp);
+  fclose(fp);
+
+  long n_times, n_types, block;
+  for (;;) {
+    if (p + 44 > data + size || memcmp(p, "TZif", 4) != 0) break;
+    n_times = BigEndian(p + 32, 4);
+    n_types = BigEndian(p + 36, 4);
+    block = n_times * (time_size + 1) + n_types * 6 + BigEndian(p + 40, 4) + BigEndian(p + 28, 4) * (time_size + 4) +
+            BigEndian(p + 24, 4) + BigEndian(p + 20, 4);
+    if (p + 44 + block > data + size) break;
+    if (data[4] >= '2' && time_size == 4) {
+      p += 44 + block; /* to the 64-bit data */
+      time_size = 8;
+      continue;
+    }
+    p += 44;
+    time_size = -time_size; /* found */
+    break;
+  }
+  if (time_size > 0 || n_types == 0) {
+    fprintf(stderr, "Warning: %s isn't a TZif file.\n", Schedule.zone_path);
+    return FALSE;
+  }
+  time_size = -time_size;
+
+  const unsigned char *indices = p + n_times * time_size, *types = indices + n_times;
+  int previous = 0; /* type before the first transition */
+  int64_t utc = INT64_MIN;
+
+  Schedule.zone_offset = BigEndian(types, 4);
+  for (long i = 0; i < n_times; i++) {
+    int type = indices[i];
+
+    if (type >= n_types) {
+      fprintf(stderr, "Warning: %s is damaged.\n", Schedule.zone_path);
+      return FALSE;
+    }
+    utc = BigEndian(p + i * time_size, time_size) - UNIX_TO_2000;
+    if (types[type * 6 + 4] != types[previous * 6 + 4] && utc >= -UNIX_TO_2000) { /* from 1970 */
+      int64_t at = utc + BigEndian(types + previous * 6, 4);
+
+      full |= !AddEvent(table, at - at % SECONDS_PER_MINUTE, utc, types[type * 6 + 4] ? EVENT_DST_ON : EVENT_DST_OFF,
+                        BigEndian(types + type * 6, 4));
+    }
+    previous = type;
+  }
+  if (time_size == 8) {
+    const char *footer = (const char *)p + block;
+
+    if (footer < (const char *)data + size && footer[0] == '\n' &&
+        memchr(footer + 1, '\n', (const char *)data + size - footer - 1) != NULL)
+      AddZoneRules(table, footer + 1, utc);
+  }
+  if (full) fprintf(stderr, "Warning: too many events, DST switches from %s left out.\n", Schedule.zone_path);
+  return TRUE;
+}
+
+/* A TZ rule name, letters or <quoted>; the end of it, NULL if none. */
+static const char *ZoneRuleName(const char *s) {
+  const char *start = s;
+
+  if (*s == '<') return (s = strchr(s, '>')) != NULL ? s + 1 : NULL;
+  while (isalpha((unsigned char)*s)) s++;
+  return s > start ? s : NULL;
+}
+
+/* A TZ rule time, [+-]hh[:mm[:ss]], in seconds; the end of it, NULL if none. */
+static const char *ZoneRuleTime(const char *s, long *value) {
+  int sign = (*s == '-') ? -1 : 1;
+  char *end;
+
+  if (*s == '+' || *s == '-') s++;
+  if (!isdigit((unsigned char)*s)) return NULL;
+  *value = strtol(s, &end, 10) * SECONDS_PER_HOUR;
+  for (int scale = SECONDS_PER_MINUTE; *end == ':' && scale >= 1; scale /= SECONDS_PER_MINUTE)
+    *value += strtol(end + 1, &end, 10) * scale;
+  *value *= sign;
+  return end;
+}
+
+/* The start of the Mm.w.d day of a year, the d'th day of the week (0 is
+ * Sunday) in week w (5 is the last) of month m, in s since 2000. */
+static int64_t ZoneRuleDay(int year, int month, int week, int weekday) {
+  static const int DaysBefore[] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334, 365};
+  int leap = (year % 4 == 0 && month > 2);
+  long first = CalendarToSeconds(year, DaysBefore[month - 1] + leap + 1, 0, 0, 0) / SECONDS_PER_DAY; /* the 1st */
+  int day = (weekday - (first + 6) % 7 + 7) % 7 + (week - 1) * 7; /* 2000-01-01 was a Saturday */
+
+  while (day >= DaysBefore[month] - DaysBefore[month - 1] + (year % 4 == 0 && month == 2)) day -= 7;
+  return (int64_t)(first + day) * SECONDS_PER_DAY;
+}
+
+/*
+ * Follow a zone's TZ rule, such as "PST8PDT,M3.2.0,M11.1.0", from the end
+ * of its table to the end of the century.  Offsets in it are west of UTC,
+ * DST is an hour ahead unless it says otherwise, and it switches at 2:00
+ * by the clock before unless it says otherwise.  Only the Mm.w.d form of
+ * switch is followed, which is what zones have used for decades.
+ */
+void AddZoneRules(struct EventTable *table, const char *rule, int64_t after) {
+  long standard, dst, start_time = 2 * SECONDS_PER_HOUR, end_time = 2 * SECONDS_PER_HOUR;
+  int start[3], end[3], n = 0, full = FALSE;
+  const char *s;
+
+  if ((s = ZoneRuleName(rule)) == NULL || (s = ZoneRuleTime(s, &standard)) == NULL) return;
+  if (*s == '\n') return; /* no DST */
+  if ((s = ZoneRuleName(s)) == NULL) return;
+  dst = standard - SECONDS_PER_HOUR;
+  if (*s != ',' && (s = ZoneRuleTime(s, &dst)) == NULL) return;
+  if (sscanf(s, ",M%d.%d.%d%n", &start[0], &start[1], &start[2], &n) == 3) {
+    s += n;
+    n = 0;
+    if (*s == '/' && (s = ZoneRuleTime(s + 1, &start_time)) == NULL) return;
+    sscanf(s, ",M%d.%d.%d%n", &end[0], &end[1], &end[2], &n);
+  }
+  if (n == 0) {
+    fprintf(stderr, "Warning: %s: rule \"%.*s\" not followed, so no DST switches after the table.\n",
+            Schedule.zone_path, (int)strcspn(rule, "\n"), rule);
+    return;
+  }
+  s += n;
+  if (*s == '/' && ZoneRuleTime(s + 1, &end_time) == NULL) return;
+
+  int year, day, hour, minute, second;
+  SecondsToCalendar(after > 0 ? after : 0, &year, &day, &hour, &minute, &second);
+  for (; year <= SCHEDULE_LAST_YEAR; year++) {
+    int64_t on = ZoneRuleDay(year, start[0], start[1], start[2]) + start_time; /* by standard time */
+    int64_t off = ZoneRuleDay(year, end[0], end[1], end[2]) + end_time;       /* by DST */
+
+    if (on + standard > after) full |= !AddEvent(table, on, on + standard, EVENT_DST_ON, -dst);
+    if (off + dst > after) full |= !AddEvent(table, off, off + dst, EVENT_DST_OFF, -standard);
+  }
+  if (full) fprintf(stderr, "Warning: too many events, DST switches from %s left out.\n", Schedule.zone_path);
+}
+
+int AddEvent(struct EventTable *table, int64_t at, int64_t utc, int kind, int offset) {
+  if (table->count == SCHEDULE_EVENTS) return FALSE;
+  table->events[table->count++] = (struct ScheduleEvent){at, utc, kind, offset};
+  return TRUE;
+}
+
+/* s from UTC to the time sent at a UTC time: the zone's offset then, or -l. */
+int ZoneOffset(const struct EventTable *table, int64_t utc) {
+  int offset = Schedule.zone_offset;
+
+  if (Schedule.zone == NULL) return Schedule.offset;
+  for (int i = 0; i < table->count && table->events[i].utc <= utc; i++)
+    if (table->events[i].kind == EVENT_DST_ON || table->events[i].kind == EVENT_DST_OFF)
+      offset = table->events[i].offset;
+  return offset;
+}
+
+int CompareEvents(const void *a, const void *b) {
+  const struct ScheduleEvent *x = a, *y = b;
+
+  return (x->at > y->at) - (x->at < y->at);
+}
+
+/*
+ * Log writer: every SCHEDULE_CHECK_SECONDS, see whether either file has
+ * changed, and if so load it again and hand the generator the new table.
+ */
+void CheckSchedule(void) {
+  struct stat leap, zone;
+  time_t now = time(NULL);
+
+  if (now - Schedule.checked < SCHEDULE_CHECK_SECONDS) return;
+  Schedule.checked = now;
+  if ((Schedule.leap_path == NULL || stat(Schedule.leap_path, &leap) != 0 ||
+       memcmp(&leap.st_mtim, &Schedule.leap_mtime, sizeof leap.st_mtim) == 0) &&
+      (Schedule.zone == NULL || stat(Schedule.zone_path, &zone) != 0 ||
+       memcmp(&zone.st_mtim, &Schedule.zone_mtime, sizeof zone.st_mtim) == 0))
+    return;
+
+  if (!LoadSchedule(&Schedule.slots[Schedule.back])) {
+    fprintf(stderr, "Warning: schedule not reloaded, keeping the old one.\n");
+    return;
+  }
+  printf("\n>> Schedule reloaded, %d events.\n", Schedule.slots[Schedule.back].count);
+  fflush(stdout);
+  Schedule.back = atomic_exchange_explicit(&Schedule.middle, Schedule.back | SCHEDULE_FRESH, memory_order_acq_rel) &
+                  ~SCHEDULE_FRESH;
+}
+
+/*
+ * Generator: if the middle slot is fresh, swap the front slot for it and
+ * return it, as TakeControl() does.
+ */
+const struct EventTable *TakeSchedule(void) {
+  if (!(atomic_load_explicit(&Schedule.middle, memory_order_relaxed) & SCHEDULE_FRESH)) return NULL;
+  Schedule.front = atomic_exchange_explicit(&Schedule.middle, Schedule.front, memory_order_acq_rel) & ~SCHEDULE_FRESH;
+  return &Schedule.slots[Schedule.front];
+}
+
+int FirstEvent(const struct EventTable *table, int64_t at) {
+  int low = 0, high = table->count;
+
+  while (low < high) {
+    int middle = (low + high) / 2;
+
+    if (table->events[middle].at < at)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+
+int64_t ScheduleArmTime(void) {
+  const struct EventTable *table = &Schedule.slots[Schedule.front];
+
+  return Schedule.next < table->count ? table->events[Schedule.next].at - SECONDS_PER_MINUTE : NO_EVENT;
+}
+
+/*
+ * Select the audio device by name or number (default device otherwise),
+ * and open a mono stream on it at SampleRate.
+ */
+void OpenAudioDevice(const char *deviceNumOrName) {
+  PaError err;
+  err = Pa_Initialize();
+  if (err != paNoError) Die("Pa_Initialize failed: %s\n", Pa_GetErrorText(err));
+
+  int numDevices = Pa_GetDeviceCount();
+  if (numDevices < 0) Die("no audio devices");
+
+  int deviceNum = -1;
+  for (int i = 0; i < numDevices; i++) {
+    const PaDeviceInfo *deviceInfo = Pa_GetDeviceInfo(i);
+    printf("%02d: %s\n", i, deviceInfo->name);
+    if (strcmp(deviceNumOrName, deviceInfo->name) == 0) {
+      deviceNum = i;
+    }
+  }
+
+  if (deviceNum < 0) {
+    if (*deviceNumOrName) {
+      sscanf(deviceNumOrName, "%d", &deviceNum);
+    } else {
+      deviceNum = Pa_GetDefaultOutputDevice();
+      if (deviceNum == paNoDevice) Die("No default output device");
+    }
+  }
+
+  if (deviceNum < 0 || deviceNum >= numDevices) Die("Can't find device (bad device specification).");
+
+  const PaDeviceInfo *deviceInfo = Pa_GetDeviceInfo(deviceNum);
+  printf("using device %s\n", deviceInfo->name);
+  State.device = deviceInfo->name;
+
+  PaStreamParameters outputParameters;
+  memset(&outputParameters, 0, sizeof outputParameters);
+  outputParameters.device = deviceNum;
+  outputParameters.channelCount = 1;
+  outputParameters.suggestedLatency = Pa_GetDeviceInfo(outputParameters.device)->defaultLowOutputLatency;
+
+  for (size_t i = 0; i < N_ELEMENTS(SampleFormats); i++) {
+    struct SampleFormat *format = (OutputFormat != NULL) ? OutputFormat : &SampleFormats[i];
+
+    outputParameters.sampleFormat = format->pa;
+    if (Pa_IsFormatSupported(NULL, &outputParameters, SampleRate) == paFormatIsSupported) {
+      OutputFormat = format;
+      break;
+    }
+    if (format == OutputFormat) Die("Audio output format %s is not supported.", format->name);
+  }
+  if (OutputFormat == NULL) Die("Audio output format is not supported.");
+  printf("sample format=%s\n", OutputFormat->name);
+
+  err = Pa_OpenStream(&stream, NULL, /* no input */
+                      &outputParameters, SampleRate, BUFLNG,
+                      paClipOff, /* we won't output out of range samples so don't bother clipping them */
+                      CallbackMode ? OutputCallback : NULL, /* no callback for blocking API */
+                      CallbackMode ? &OutputRing : NULL);   /* callback userData */
+  if (err != paNoError) Die("Pa_OpenStream failed: %s\n", Pa_GetErrorText(err));
+
+  const PaStreamInfo *info = Pa_GetStreamInfo(stream);
+  if (info == NULL) Die("failed to get stream info");
+  printf("sample rate=%f\n", info->sampleRate);
+}
+
+void StartAudioDevice(void) {
+  if (Alsa.pcm != NULL) {
+    StartAlsaDevice();
+    return;
+  }
+  if (Rtp.fd >= 0) {
+    StartRtpDevice();
+    return;
+  }
+
+  /* Give the callback something to play while we align to the second. */
+  if (CallbackMode) EmitSilence(OutputRing.size / 2);
+
+  printf("Starting stream\n");
+  PaError err = Pa_StartStream(stream);
+  if (err != paNoError) Die("Pa_StartStream failed: %s\n", Pa_GetErrorText(err));
+
+  if (CallbackMode) {
+    /* Wait for the first callbacks, so there is a DAC time to measure from. */
+    for (int i = 0; i < 100 && atomic_load(&OutputRing.timing_sequence) == 0; i++) Pa_Sleep(10);
+  }
+}
+
+/*
+ * Open an ALSA PCM for mmap writes of mono samples at exactly the
+ * sample rate, with a short ring, timestamped on the monotonic clock.
+ */
+void OpenAlsaDevice(const char *name) {
+  snd_pcm_hw_params_t *hw;
+  snd_pcm_sw_params_t *sw;
+  unsigned buffer_us = ALSA_BUFFER_US, period_us = ALSA_PERIOD_US;
+  int err;
+
+  if ((err = snd_pcm_open(&Alsa.pcm, name, SND_PCM_STREAM_PLAYBACK, 0)) < 0)
+    Die("Can't open ALSA device %s: %s", name, snd_strerror(err));
+  State.device = name;
+
+  snd_pcm_hw_params_alloca(&hw);
+  snd_pcm_hw_params_any(Alsa.pcm, hw);
+  if ((err = snd_pcm_hw_params_set_access(Alsa.pcm, hw, SND_PCM_ACCESS_MMAP_INTERLEAVED)) < 0)
+    Die("%s can't do mmap output: %s", name, snd_strerror(err));
+  if (OutputFormat != NULL) {
+    if ((err = snd_pcm_hw_params_set_format(Alsa.pcm, hw, OutputFormat->alsa)) < 0)
+      Die("%s can't play %s samples: %s", name, OutputFormat->name, snd_strerror(err));
+  } else {
+    for (size_t i = 0; OutputFormat == NULL && i < N_ELEMENTS(SampleFormats); i++) {
+      if (snd_pcm_hw_params_set_format(Alsa.pcm, hw, SampleFormats[i].alsa) == 0) OutputFormat = &SampleFormats[i];
+    }
+    if (OutputFormat == NULL) Die("%s can't play any of our sample formats", name);
+  }
+  if ((err = snd_pcm_hw_params_set_channels(Alsa.pcm, hw, 1)) < 0)
+    Die("%s can't play mono: %s", name, snd_strerror(err));
+  if ((err = snd_pcm_hw_params_set_rate_resample(Alsa.pcm, hw, 0)) < 0 ||
+      (err = snd_pcm_hw_params_set_rate(Alsa.pcm, hw, (unsigned)SampleRate, 0)) < 0)
+    Die("%s can't play at %.0f Hz: %s", name, SampleRate, snd_strerror(err));
+  snd_pcm_hw_params_set_buffer_time_near(Alsa.pcm, hw, &buffer_us, NULL);
+  snd_pcm_hw_params_set_period_time_near(Alsa.pcm, hw, &period_us, NULL);
+  if ((err = snd_pcm_hw_params(Alsa.pcm, hw)) < 0) Die("Can't set up %s: %s", name, snd_strerror(err));
+  snd_pcm_hw_params_get_buffer_size(hw, &Alsa.buffer_frames);
+  snd_pcm_hw_params_get_period_size(hw, &Alsa.period_frames, NULL);
+
+  /* Start once the ring is full, and again after an underrun. */
+  snd_pcm_sw_params_alloca(&sw);
+  snd_pcm_sw_params_current(Alsa.pcm, sw);
+  snd_pcm_sw_params_set_start_threshold(Alsa.pcm, sw, Alsa.buffer_frames);
+  snd_pcm_sw_params_set_avail_min(Alsa.pcm, sw, Alsa.period_frames);
+  snd_pcm_sw_params_set_tstamp_mode(Alsa.pcm, sw, SND_PCM_TSTAMP_ENABLE);
+  snd_pcm_sw_params_set_tstamp_type(Alsa.pcm, sw, SND_PCM_TSTAMP_TYPE_MONOTONIC);
+  if ((err = snd_pcm_sw_params(Alsa.pcm, sw)) < 0) Die("Can't set up %s: %s", name, snd_strerror(err));
+
+  printf("using ALSA device %s, %s samples, ring %lu frames, period %lu frames\n", name, OutputFormat->name,
+         (unsigned long)Alsa.buffer_frames, (unsigned long)Alsa.period_frames);
+}
+
+/*
+ * Fill the ring with silence, outside the sample clock, which starts the
+ * device, so there is a DAC time to align to the second from.
+ */
+void StartAlsaDevice(void) {
+  int32_t silence[BUFLNG] = {0}; /* zero in every format */
+
+  printf("Starting stream\n");
+  for (snd_pcm_uframes_t n = 0; n < Alsa.buffer_frames; n += BUFLNG)
+    AlsaWrite(silence, (Alsa.buffer_frames - n < BUFLNG) ? Alsa.buffer_frames - n : BUFLNG);
+}
+
+/*
+ * Copy samples into the ring as room comes free, waiting for the device
+ * when it is full.
+ */
+void AlsaWrite(const void *samples, int n_samples) {
+  const char *next = samples;
+
+  while (n_samples > 0) {
+    snd_pcm_sframes_t avail = snd_pcm_avail_update(Alsa.pcm);
+
+    if (avail < 0) {
+      AlsaRecover(avail);
+      continue;
+    }
+    if (avail == 0) {
+      int err = snd_pcm_wait(Alsa.pcm, ALSA_WAIT_MS);
+      if (err < 0) AlsaRecover(err);
+      continue;
+    }
+
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t offset, frames = (avail < n_samples) ? (snd_pcm_uframes_t)avail : (snd_pcm_uframes_t)n_samples;
+    int err = snd_pcm_mmap_begin(Alsa.pcm, &areas, &offset, &frames);
+    if (err < 0) {
+      AlsaRecover(err);
+      continue;
+    }
+    memcpy((char *)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8, next, OutputFormat->bytes * frames);
+
+    /* A short commit only takes some of them; the rest go round again. */
+    snd_pcm_sframes_t committed = snd_pcm_mmap_commit(Alsa.pcm, offset, frames);
+    if (committed < 0) {
+      AlsaRecover((int)committed);
+      continue;
+    }
+    next += OutputFormat->bytes * committed;
+    n_samples -= committed;
+  }
+}
+
+/*
+ * After an underrun the ring is emptied, and the device starts again
+ * once it is full; the rate discipline sees the jump as on-time error.
+ */
+void AlsaRecover(int err) {
+  if (err == -EPIPE) atomic_fetch_add_explicit(&Metrics.underflows, 1, memory_order_relaxed);
+  if ((err = snd_pcm_recover(Alsa.pcm, err, 1)) < 0) Die("ALSA output failed: %s", snd_strerror(err));
+}
+
+/*
+ * The time from now until the next sample written is played, from the
+ * driver's timestamped delay.
+ */
+double AlsaLatency(void) {
+  snd_pcm_status_t *status;
+  snd_htimestamp_t stamp;
+  struct timespec now;
+
+  snd_pcm_status_alloca(&status);
+  if (snd_pcm_status(Alsa.pcm, status) < 0 || snd_pcm_status_get_state(status) != SND_PCM_STATE_RUNNING) return NAN;
+  snd_pcm_status_get_htstamp(status, &stamp);
+  if (stamp.tv_sec == 0 && stamp.tv_nsec == 0) return NAN;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (stamp.tv_sec - now.tv_sec) + (stamp.tv_nsec - now.tv_nsec) * 1e-9 +
+         (double)snd_pcm_status_get_delay(status) / SampleRate;
+}
+
+void CloseAlsaDevice(void) {
+  snd_pcm_drain(Alsa.pcm);
+  snd_pcm_close(Alsa.pcm);
+  Alsa.pcm = NULL;
+}
+
+/*
+ * Resolve and connect to the receiver, marking the packets for expedited
+ * forwarding, and print the SDP a receiver needs to play the stream.
+ */
+void OpenRtpDevice(const char *name) {
+  struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_DGRAM}, *address;
+  char *host = strdup(name);
+  char *port = strrchr(host, ':');
+  int err;
+
+  Rtp.bytes = 3;
+  Rtp.payload_type = RTP_PAYLOAD_L24;
+  if (port != NULL && (strcasecmp(port + 1, "L16") == 0 || strcasecmp(port + 1, "L24") == 0)) {
+    if (strcasecmp(port + 1, "L16") == 0) {
+      Rtp.bytes = 2;
+      Rtp.payload_type = RTP_PAYLOAD_L16;
+    }
+    *port = '\0';
+    port = strrchr(host, ':');
+  }
+  if (port == NULL || port == host) Die("Bad RTP destination (%s), should be host:port[:L16|:L24]", name);
+  *port++ = '\0';
+
+  if ((err = getaddrinfo(host, port, &hints, &address)) != 0) Die("Can't resolve %s: %s", name, gai_strerror(err));
+  Rtp.fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+  if (Rtp.fd < 0 || connect(Rtp.fd, address->ai_addr, address->ai_addrlen) < 0)
+    Die("Can't send to %s: %s", name, strerror(errno));
+
+  int tos = RTP_DSCP << 2;
+  if ((address->ai_family == AF_INET && setsockopt(Rtp.fd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) < 0) ||
+      (address->ai_family == AF_INET6 && setsockopt(Rtp.fd, IPPROTO_IPV6, IPV6_TCLASS, &tos, sizeof(tos)) < 0))
+    fprintf(stderr, "Warning: can't set DSCP %d on the RTP stream: %s\n", RTP_DSCP, strerror(errno));
+
+  Rtp.packet_samples = (int)llround(SampleRate * RTP_PACKET_US / 1e6);
+  Rtp.packet = Allocate(RTP_HEADER_BYTES + (size_t)Rtp.bytes * Rtp.packet_samples, ARENA_ALIGNMENT);
+  srandom((unsigned)time(NULL) ^ (unsigned)getpid()); /* RFC 3550: random SSRC and first sequence number */
+  Rtp.ssrc = (uint32_t)random();
+  Rtp.sequence = (uint16_t)random();
+
+  printf("sending RTP to %s port %s, %d samples a packet\n", host, port, Rtp.packet_samples);
+  printf("v=0\no=- %u 0 IN IP%c %s\ns=tg2\nc=IN IP%c %s\nt=0 0\nm=audio %s RTP/AVP %d\n", Rtp.ssrc,
+         address->ai_family == AF_INET6 ? '6' : '4', host, address->ai_family == AF_INET6 ? '6' : '4', host, port,
+         Rtp.payload_type);
+  printf("a=rtpmap:%d L%d/%.0f/1\na=ptime:%g\na=mediaclk:direct=0\n", Rtp.payload_type, 8 * Rtp.bytes, SampleRate,
+         RTP_PACKET_US / 1000.);
+  freeaddrinfo(address);
+}
+
+/*
+ * Start the media clock on a whole sample of the system clock, far enough
+ * ahead to finish starting up, and mark it on the monotonic clock the
+ * packets are paced by.
+ */
+void StartRtpDevice(void) {
+  struct timespec real, now;
+
+  clock_gettime(CLOCK_REALTIME, &real);
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t rate = (uint64_t)SampleRate;
+  uint64_t ns = (uint64_t)real.tv_nsec + RTP_START_US * 1000;
+  uint64_t sample = (ns * rate + 999999999) / 1000000000; /* first whole sample at or after then */
+  int64_t wait_ns = (int64_t)(sample * 1000000000 / rate) - (int64_t)real.tv_nsec;
+
+  Rtp.origin = (uint64_t)real.tv_sec * rate + sample;
+  Rtp.first = Rtp.sample = SampleClock;
+  Rtp.start.tv_sec = now.tv_sec + (now.tv_nsec + wait_ns) / 1000000000;
+  Rtp.start.tv_nsec = (now.tv_nsec + wait_ns) % 1000000000;
+  printf("Starting stream\n");
+}
+
+/*
+ * Convert samples into the packet, sending it each time it is full.
+ * Integer samples are shifted to the payload width.
+ */
+void RtpWrite(const void *samples, int n_samples) {
+  float full_scale = (float)((1 << (8 * Rtp.bytes - 1)) - 1);
+  int widen = 8 * (Rtp.bytes - OutputFormat->bytes);
+  const float *floats = samples;
+
+  while (n_samples > 0) {
+    int n = (Rtp.packet_samples - Rtp.filled < n_samples) ? Rtp.packet_samples - Rtp.filled : n_samples;
+    unsigned char *p = Rtp.packet + RTP_HEADER_BYTES + (size_t)Rtp.bytes * Rtp.filled;
+
+    for (int i = 0; i < n; i++) {
+      int32_t value;
+
+      if (OutputFormat->full_scale == 0) {
+        float scaled = floats[i] * full_scale;
+        value = (int32_t)lrintf(scaled > full_scale ? full_scale : (scaled < -full_scale ? -full_scale : scaled));
+      } else {
+        value = GetSample(samples, i);
+        value = (widen >= 0) ? value * (1 << widen) : value >> -widen;
+      }
+      for (int shift = 8 * (Rtp.bytes - 1); shift >= 0; shift -= 8) *p++ = (unsigned char)(value >> shift);
+    }
+    samples = (const char *)samples + (size_t)OutputFormat->bytes * n;
+    floats = samples;
+    n_samples -= n;
+    Rtp.filled += n;
+    if (Rtp.filled == Rtp.packet_samples) SendRtpPacket();
+  }
+}
+
+void SendRtpPacket(void) {
+  uint64_t rate = (uint64_t)SampleRate;
+  uint64_t offset = Rtp.sample - Rtp.first;
+  uint32_t timestamp = (uint32_t)(Rtp.origin + offset);
+  unsigned char *p = Rtp.packet;
+  struct timespec due = Rtp.start, now;
+
+  p[0] = 0x80; /* version 2 */
+  p[1] = Rtp.payload_type;
+  p[2] = Rtp.sequence >> 8;
+  p[3] = Rtp.sequence;
+  for (int i = 0; i < 4; i++) p[4 + i] = timestamp >> (24 - 8 * i), p[8 + i] = Rtp.ssrc >> (24 - 8 * i);
+
+  due.tv_sec += offset / rate;
+  due.tv_nsec += (offset % rate) * 1000000000 / rate;
+  if (due.tv_nsec >= 1000000000) {
+    due.tv_sec++;
+    due.tv_nsec -= 1000000000;
+  }
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR) continue;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if ((now.tv_sec - due.tv_sec) * 1000000000LL + (now.tv_nsec - due.tv_nsec) >= RTP_PACKET_US * 1000LL) {
+    Rtp.late++;
+    atomic_fetch_add_explicit(&Metrics.underflows, 1, memory_order_relaxed);
+  }
+
+  if (send(Rtp.fd, Rtp.packet, RTP_HEADER_BYTES + (size_t)Rtp.bytes * Rtp.filled, 0) < 0 && Rtp.errors++ == 0)
+    fprintf(stderr, "Warning: RTP send failed: %s\n", strerror(errno));
+  Rtp.packets++;
+  Rtp.sequence++;
+  Rtp.sample += Rtp.filled;
+  Rtp.filled = 0;
+}
+
+/*
+ * The time from now until the next sample written is due.
+ */
+double RtpLatency(void) {
+  struct timespec now;
+  uint64_t offset = Rtp.sample + Rtp.filled - Rtp.first;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (Rtp.start.tv_sec - now.tv_sec) + (Rtp.start.tv_nsec - now.tv_nsec) * 1e-9 + offset / SampleRate;
+}
+
+void CloseRtpDevice(void) {
+  if (Rtp.filled > 0) SendRtpPacket();
+  close(Rtp.fd);
+  Rtp.fd = -1;
+  Log("\n>> RTP: %llu packets sent, %llu late, %llu failed.\n", (unsigned long long)Rtp.packets,
+      (unsigned long long)Rtp.late, (unsigned long long)Rtp.errors);
+}
+
+/*
+ * Open the file to render to.  "-" renders to stdout, in which case what
+ * would have been printed goes to stderr instead.
+ */
+void OpenRenderFile(const char *path) {
+  size_t length = strlen(path);
+
+  if (strcmp(path, "-") == 0) {
+    int fd = dup(STDOUT_FILENO);
+    if (fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) Die("can't redirect stdout: %s", strerror(errno));
+    RenderFile.fp = fdopen(fd, "wb");
+  } else {
+    RenderFile.fp = fopen(path, RenderFile.part ? "r+b" : "wb");
+    RenderFile.wav = (length >= 4 && strcasecmp(path + length - 4, ".wav") == 0);
+  }
+  if (RenderFile.fp == NULL) Die("can't open %s: %s", path, strerror(errno));
+  setvbuf(RenderFile.fp, NULL, _IOFBF, 1 << 20);
+
+  RenderFile.bytes = 0;
+  if (RenderFile.wav && !RenderFile.part) WriteWavHeader();
+  printf("rendering to %s\n", path);
+}
+
+static void PutLe(unsigned char **p, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; i++) *(*p)++ = (value >> (8 * i)) & 0xFF;
+}
+
+/*
+ * Write the WAV header at the start of the file for the data written so
+ * far; RF64 with a ds64 chunk if the sizes no longer fit in 32 bits.
+ */
+void WriteWavHeader(void) {
+  unsigned char header[WAV_HEADER_BYTES];
+  unsigned char *p = header;
+  uint64_t riff_bytes = WAV_HEADER_BYTES - 8 + RenderFile.bytes;
+  int rf64 = riff_bytes > 0xFFFFFFFF;
+
+  memcpy(p, rf64 ? "RF64" : "RIFF", 4), p += 4;
+  PutLe(&p, rf64 ? 0xFFFFFFFF : riff_bytes, 4);
+  memcpy(p, "WAVE", 4), p += 4;
+
+  memcpy(p, rf64 ? "ds64" : "JUNK", 4), p += 4;
+  PutLe(&p, 28, 4);
+  PutLe(&p, rf64 ? riff_bytes : 0, 8);
+  PutLe(&p, rf64 ? RenderFile.bytes : 0, 8);
+  PutLe(&p, rf64 ? RenderFile.bytes / OutputFormat->bytes : 0, 8);
+  PutLe(&p, 0, 4); /* no table */
+
+  memcpy(p, "fmt ", 4), p += 4;
+  PutLe(&p, 16, 4);
+  PutLe(&p, OutputFormat->full_scale ? WAVE_FORMAT_PCM : WAVE_FORMAT_IEEE_FLOAT, 2);
+  PutLe(&p, 1, 2); /* mono */
+  PutLe(&p, lround(SampleRate), 4);
+  PutLe(&p, lround(SampleRate) * OutputFormat->bytes, 4);
+  PutLe(&p, OutputFormat->bytes, 2);
+  PutLe(&p, 8 * OutputFormat->bytes, 2);
+
+  memcpy(p, "data", 4), p += 4;
+  PutLe(&p, rf64 ? 0xFFFFFFFF : RenderFile.bytes, 4);
+
+  if (fwrite(header, 1, sizeof header, RenderFile.fp) != sizeof header)
+    Die("write to render file failed: %s", strerror(errno));
+}
+
+void CloseRenderFile(void) {
+  if (RenderFile.wav && !RenderFile.part) {
+    if (fseeko(RenderFile.fp, 0, SEEK_SET) != 0) Die("can't rewrite WAV header: %s", strerror(errno));
+    WriteWavHeader();
+  }
+  if (fclose(RenderFile.fp) != 0) Die("write to render file failed: %s", strerror(errno));
+  RenderFile.fp = NULL;
+}
+
+/*
+ * Seek to where a batch chunk's samples go in the job's file.  The first
+ * chunk also writes the header, sized for the whole job.
+ */
+void PlaceRenderChunk(uint64_t first_sample, uint64_t total_samples) {
+  if (RenderFile.wav && first_sample == 0) {
+    RenderFile.bytes = OutputFormat->bytes * total_samples;
+    WriteWavHeader();
+  }
+  off_t offset = (RenderFile.wav ? WAV_HEADER_BYTES : 0) + OutputFormat->bytes * first_sample;
+  if (fseeko(RenderFile.fp, offset, SEEK_SET) != 0) Die("can't seek render file: %s", strerror(errno));
+  RenderFile.bytes = 0;
+}
+
+/*
+ * Render the jobs in a manifest, spread over a pool of worker threads.
+ */
+int BatchRender(const char *manifest, int workers) {
+  FILE *fp = fopen(manifest, "r");
+  if (fp == NULL) Die("can't open %s: %s", manifest, strerror(errno));
+
+  struct BatchJob *jobs = NULL;
+  int n_jobs = 0;
+  int n_chunks = 0;
+  char *line = NULL;
+  size_t line_size = 0;
+  int line_number = 0;
+
+  while (getline(&line, &line_size, fp) >= 0) {
+    line_number++;
+    char *path = strtok(line, " \t\r\n");
+    if (path == NULL || *path == '#') continue;
+
+    jobs = realloc(jobs, sizeof(struct BatchJob) * (n_jobs + 1));
+    if (jobs == NULL) Die("out of memory");
+    struct BatchJob *job = &jobs[n_jobs++];
+    memset(job, 0, sizeof *job);
+    job->path = path;
+    job->split = TRUE;
+
+    /* The job's options, after our own name as getopt expects. */
+    job->argv = malloc(sizeof(char *) * (line_size / 2 + 2)); /* at most every other character starts one */
+    if (job->argv == NULL) Die("out of memory");
+    job->argv[job->argc++] = CommandName;
+    for (char *arg; (arg = strtok(NULL, " \t\r\n")) != NULL;) job->argv[job->argc++] = arg;
+    job->argv[job->argc] = NULL;
+
+    int have_start = FALSE;
+    int option;
+    opterr = 0;
+    optind = 0;
+    while ((option = getopt(job->argc, job->argv, TG2_OPTIONS)) != -1) {
+      switch (option) {
+        case 'c':
+          sscanf(optarg, "%d", &job->seconds);
+          break;
+        case 'y':
+          have_start = TRUE;
+          break;
+        case 's': /* adds a second at the end of the year */
+        case 'k': /* changes the length of every second */
+          job->split = FALSE;
+          break;
+        case 'B':
+        case 'J':
+        case 'L':
+        case 'm':
+        case 'M':
+        case 'O':
+        case 'P':
+        case 'S':
+        case 'U':
+        case 'w':
+          Die("%s:%d: -%c can't be used in a batch job", manifest, line_number, option);
+          break;
+        case '?':
+          Die("%s:%d: bad option -%c", manifest, line_number, optopt);
+          break;
+      }
+    }
+    if (!have_start || job->seconds <= 0)
+      Die("%s:%d: a batch job needs a start time (-y) and a length (-c)", manifest, line_number);
+    n_chunks += job->split ? (job->seconds + BATCH_CHUNK_SECONDS - 1) / BATCH_CHUNK_SECONDS : 1;
+
+    line = NULL; /* the job keeps pointers into it */
+    line_size = 0;
+  }
+  fclose(fp);
+  if (n_jobs == 0) Die("no jobs in %s", manifest);
+
+  if (workers <= 0) workers = sysconf(_SC_NPROCESSORS_ONLN);
+  if (workers <= 0) workers = 1;
+  if (workers > n_chunks) workers = n_chunks;
+
+  /* Deal the chunks out in order, a contiguous run to each worker. */
+  BatchWorkers = workers;
+  WorkQueues = calloc(workers, sizeof(struct WorkQueue));
+  struct BatchChunk *chunks = calloc(n_chunks, sizeof(struct BatchChunk));
+  if (WorkQueues == NULL || chunks == NULL) Die("out of memory");
+
+  int chunk = 0;
+  long total_seconds = 0;
+  for (int i = 0; i < n_jobs; i++) {
+    int fd = open(jobs[i].path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) Die("can't create %s: %s", jobs[i].path, strerror(errno));
+    close(fd);
+
+    int step = jobs[i].split ? BATCH_CHUNK_SECONDS : jobs[i].seconds;
+    for (int first = 0; first < jobs[i].seconds; first += step) {
+      chunks[chunk].job = &jobs[i];
+      chunks[chunk].first = first;
+      chunks[chunk].count = (jobs[i].seconds - first < step) ? jobs[i].seconds - first : step;
+      chunk++;
+    }
+    total_seconds += jobs[i].seconds;
+  }
+  for (int w = 0; w < workers; w++) {
+    pthread_mutex_init(&WorkQueues[w].lock, NULL);
+    WorkQueues[w].chunks = chunks + (long)n_chunks * w / workers;
+    WorkQueues[w].front = 0;
+    WorkQueues[w].back = (long)n_chunks * (w + 1) / workers - (long)n_chunks * w / workers;
+  }
+
+  printf("Rendering %d jobs, %ld seconds, in %d chunks on %d workers.\n", n_jobs, total_seconds, n_chunks, workers);
+  struct timespec start_time, end_time;
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+  pthread_t *threads = calloc(workers, sizeof(pthread_t));
+  if (threads == NULL) Die("out of memory");
+  for (long w = 0; w < workers; w++)
+    if (pthread_create(&threads[w], NULL, BatchWorker, (void *)w) != 0) Die("can't start worker");
+  for (int w = 0; w < workers; w++) pthread_join(threads[w], NULL);
+
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+  double elapsed = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_nsec - start_time.tv_nsec) * 1e-9;
+
+  int failures = 0;
+  for (int i = 0; i < n_jobs; i++) {
+    if (jobs[i].failed) {
+      printf("FAILED %s\n", jobs[i].path);
+      failures++;
+    } else if (Verbose) {
+      printf("wrote %s\n", jobs[i].path);
+    }
+  }
+  for (int w = 0; w < workers; w++)
+    if (Verbose) printf("worker %d: %d chunks, %d stolen\n", w, WorkQueues[w].rendered, WorkQueues[w].steals);
+  printf(">> Rendered %ld seconds in %.3f s, %.0fx realtime; %d of %d jobs failed.\n", total_seconds, elapsed,
+         total_seconds / elapsed, failures, n_jobs);
+
+  return failures ? 1 : 0;
+}
+
+void *BatchWorker(void *arg) {
+  int w = (int)(long)arg;
+  struct BatchChunk chunk;
+
+  while (TakeChunk(w, &chunk)) RunChunk(&chunk);
+  return NULL;
+}
+
+/*
+ * Take the next chunk from the front of our own queue or, once that is
+ * empty, steal the last chunk from the back of another worker's.
+ */
+int TakeChunk(int w, struct BatchChunk *chunk) {
+  for (int i = 0; i < BatchWorkers; i++) {
+    struct WorkQueue *q = &WorkQueues[(w + i) % BatchWorkers];
+    int found = FALSE;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->front < q->back) {
+      *chunk = (i == 0) ? q->chunks[q->front++] : q->chunks[--q->back];
+      found = TRUE;
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    if (found) {
+      WorkQueues[w].rendered++;
+      if (i != 0) WorkQueues[w].steals++;
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+/*
+ * Render a chunk by running ourselves on the job's options, with its
+ * output sent to the job's file and stdout discarded.
+ */
+void RunChunk(const struct BatchChunk *chunk) {
+  struct BatchJob *job = chunk->job; /* shared by the job's chunks, to mark it failed */
+  char part[32], count[16];
+  char *argv[job->argc + 8];
+  int argc = 0;
+
+  for (int i = 0; i < job->argc; i++) argv[argc++] = job->argv[i];
+  argv[argc++] = "-x";
+  argv[argc++] = "-w";
+  argv[argc++] = job->path;
+  if (job->split) {
+    snprintf(part, sizeof part, "%d:%d", chunk->first, job->seconds);
+    argv[argc++] = "-S";
+    argv[argc++] = part;
+  }
+  snprintf(count, sizeof count, "%d", chunk->count);
+  argv[argc++] = "-c";
+  argv[argc++] = count;
+  argv[argc] = NULL;
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+  pid_t pid;
+  int status = 0;
+  int err = posix_spawn(&pid, "/proc/self/exe", &actions, NULL, argv, NULL);
+  posix_spawn_file_actions_destroy(&actions);
+  if (err == 0 && waitpid(pid, &status, 0) < 0) err = errno;
+
+  if (err != 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "%s: seconds %d to %d failed\n", job->path, chunk->first, chunk->first + chunk->count);
+    job->failed = TRUE;
+  }
+}
+
+/*
+ * The time from now until the next sample written to a blocking device
+ * is played.
+ */
+double DeviceLatency(void) {
+  if (AudioDelayMs >= 0) return AudioDelayMs / 1000.;
+  if (Alsa.pcm != NULL) {
+    double latency = AlsaLatency();
+    return isnan(latency) ? (double)Alsa.buffer_frames / SampleRate : latency; /* not running yet, so full */
+  }
+  if (Rtp.fd >= 0) return RtpLatency();
+  return Pa_GetStreamInfo(stream)->outputLatency;
+}
+
+/*
+ * Estimate the system time at which a sample reaches the DAC, and update
+ * the latency estimate.
+ */
+double EstimateDacTime(uint64_t sample) {
+  struct timespec ts;
+  double latency;
+  uint64_t next = SampleClock; /* the sample the latency is to */
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  double now = ts.tv_sec + ts.tv_nsec * 1e-9;
+
+  if (Ahead.running) {
+    unsigned sequence;
+    int64_t returned_ns, latency_ns;
+
+    do {
+      sequence = atomic_load_explicit(&Ahead.timing_sequence, memory_order_acquire);
+      next = atomic_load_explicit(&Ahead.timing_sample, memory_order_relaxed);
+      returned_ns = atomic_load_explicit(&Ahead.timing_ns, memory_order_relaxed);
+      latency_ns = atomic_load_explicit(&Ahead.timing_latency_ns, memory_order_relaxed);
+      atomic_thread_fence(memory_order_acquire);
+    } while ((sequence & 1) || sequence != atomic_load_explicit(&Ahead.timing_sequence, memory_order_relaxed));
+
+    /* The device's latency, to the next sample it was to write, when the
+     * last write returned. */
+    now = returned_ns * 1e-9;
+    latency = latency_ns * 1e-9;
+  } else if (CallbackMode && AudioDelayMs < 0 && atomic_load(&OutputRing.timing_sequence) != 0) {
+    unsigned sequence;
+    uint64_t dac_sample;
+    int64_t dac_ns;
+
+    do {
+      sequence = atomic_load_explicit(&OutputRing.timing_sequence, memory_order_acquire);
+      dac_sample = atomic_load_explicit(&OutputRing.timing_sample, memory_order_relaxed);
+      dac_ns = atomic_load_explicit(&OutputRing.timing_dac_ns, memory_order_relaxed);
+      atomic_thread_fence(memory_order_acquire);
+    } while ((sequence & 1) || sequence != atomic_load_explicit(&OutputRing.timing_sequence, memory_order_relaxed));
+
+    /* The DAC time of the next sample to be written, on the stream clock,
+     * less the stream clock now. */
+    latency = dac_ns * 1e-9 + (double)(SampleClock - dac_sample) / SampleRate - Pa_GetStreamTime(stream);
+  } else {
+    latency = DeviceLatency();
+  }
+
+  /* ALSA's is exact, and changes with how full the ring is, so isn't averaged; nor is RTP's. */
+  if (Timing.samples++ == 0 || Alsa.pcm != NULL || Rtp.fd >= 0)
+    Timing.latency = latency;
+  else
+    Timing.latency += (latency - Timing.latency) / LATENCY_SMOOTHING;
+
+  return now + Timing.latency - (double)(int64_t)(next - sample) / SampleRate;
+}
+
+void PrintTiming(void) {
+  Log(" Output latency = %.3f ms, on-time error = %+.3f ms, rate correction = %+.3f ppm (%s).\n",
+      1000. * Timing.latency, 1000. * Timing.on_time_error, 1e6 * Discipline.correction,
+      Discipline.updates == 0 ? "off" : (Discipline.updates < FLL_SECONDS ? "measuring" : "locked"));
+}
+
+/*
+ * Print the results of a benchmark run as one line of key=value pairs,
+ * so runs can be collected and compared between versions: the render
+ * rate, the time per frame sent and per frame encoded on its own, and the
+ * heap allocations and arena size, which goes with the sample format.
+ * Frames are IRIG frames, or WWV minutes.  Emit() drops the samples, so
+ * this is the generator alone, without the device.  The allocation counts
+ * cover only Allocate(), not what libc or the audio libraries allocate for
+ * themselves; a run with any after startup exits non-zero.
+ */
+void PrintBenchmark(double elapsed, uint64_t rendered, int seconds, int year, int day) {
+  double frames = (encode == IRIG) ? (double)seconds * Irig->pps / Irig->frame_bits : seconds / 60.;
+  struct rusage usage;
+
+  getrusage(RUSAGE_SELF, &usage);
+  double cpu =
+      usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+
+  printf(
+      "bench format=%c irig=%c rate=%.0f sample_format=%s seconds=%d samples=%llu elapsed_s=%.6f cpu_s=%.6f "
+      "samples_per_s=%.0f realtime=%.1f ns_per_frame=%.0f encode_ns_per_frame=%.1f allocations=%lu "
+      "steady_allocations=%lu arena_bytes=%zu max_rss_kb=%ld\n",
+      (encode == IRIG) ? (IrigIncludeIeee ? '3' : (IrigIncludeYear ? '2' : 'i')) : 'w', Irig->letter, SampleRate,
+      OutputFormat->name, seconds, (unsigned long long)rendered, elapsed, cpu, rendered / elapsed,
+      rendered / elapsed / SampleRate, 1e9 * elapsed / frames, EncodeBenchmark(year, day), AllocationCount,
+      SteadyStateAllocations, RenderArena.used, usage.ru_maxrss);
+}
+
+/*
+ * Time the encoding of a frame on its own, over a day's worth of times:
+ * for IRIG, packing it and its parity; for WWV, the minute's code string.
+ */
+double EncodeBenchmark(int year, int day) {
+  struct timespec start, end;
+  struct IrigFrame frame;
+  char string[16];
+  unsigned check = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < BENCH_ENCODE_FRAMES; i++) {
+    int second = i % SECONDS_PER_DAY;
+    int hour = second / SECONDS_PER_HOUR, minute = second / SECONDS_PER_MINUTE % 60;
+
+    if (encode == IRIG) {
+      check += EncodeIrigTime(&frame, year, day, hour, minute, second % 60, 0, ControlFunctions);
+      check += frame.bits[0];
+    } else {
+      check += snprintf(string, sizeof(string), "%01d%03d%02d%02d%01d", year % 100 / 10, day, hour, minute, year % 10);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  /* Use the results, so none of the work can be optimized away. */
+  if (check == 1) printf(" ");
+  return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / BENCH_ENCODE_FRAMES;
+}
+
+/*
+ * Start the metrics writer thread.
+ */
+void StartMetrics(void) {
+  Metrics.back = 0;
+  atomic_init(&Metrics.middle, 1);
+  Metrics.front = 2;
+  atomic_init(&Metrics.stop, FALSE);
+  if (pthread_create(&Metrics.thread, NULL, MetricsWriter, NULL) != 0) Die("can't start the metrics writer");
+}
+
+/*
+ * Fill in the back buffer and publish it.  This runs on the generator, so
+ * only copies what it already has.
+ */
+void PublishMetrics(int leap_pending, int leap_delete, int dst, int dst_pending, int time_quality) {
+  struct MetricsSnapshot *m = &Metrics.buffers[Metrics.back];
+
+  m->seconds_sent = ++Metrics.seconds_sent;
+  m->samples = SampleClock;
+  m->underflows = atomic_load_explicit(&Metrics.underflows, memory_order_relaxed);
+  m->ring_underruns = 0;
+  if (CallbackMode) {
+    m->underflows += atomic_load_explicit(&OutputRing.device_underflows, memory_order_relaxed);
+    m->ring_underruns = atomic_load_explicit(&OutputRing.underruns, memory_order_relaxed);
+  }
+  m->log_dropped = atomic_load_explicit(&TextLog.dropped, memory_order_relaxed);
+  m->sink_dropped = 0;
+  for (int i = 1; i < SinkCount; i++) m->sink_dropped += atomic_load_explicit(&Sinks[i].dropped, memory_order_relaxed);
+  m->on_time_error = Timing.on_time_error;
+  m->latency = Timing.latency;
+  m->look_ahead = Timing.ahead;
+  m->device_starved = atomic_load_explicit(&Ahead.starved, memory_order_relaxed);
+  m->sound_card_error = Discipline.frequency;
+  m->correction = Discipline.correction;
+  m->discipline_state = Discipline.updates == 0 ? 0 : (Discipline.updates < FLL_SECONDS ? 1 : 2);
+  m->cycles_added = TotalCyclesAdded;
+  m->cycles_removed = TotalCyclesRemoved;
+  m->leap_pending = leap_pending;
+  m->leap_delete = leap_delete;
+  m->dst = dst;
+  m->dst_pending = dst_pending;
+  m->time_quality = time_quality;
+  for (int i = 0; i <= METRICS_WRITE_BUCKETS; i++)
+    m->writes[i] = atomic_load_explicit(&Metrics.writes[i], memory_order_relaxed);
+  m->write_seconds = atomic_load_explicit(&Metrics.write_ns, memory_order_relaxed) * 1e-9;
+
+  Metrics.back = atomic_exchange_explicit(&Metrics.middle, Metrics.back | METRICS_FRESH, memory_order_acq_rel) &
+                 ~METRICS_FRESH;
+}
+
+/*
+ * Stop the writer, and write the last snapshot ourselves so the file
+ * ends with the end of the run.
+ */
+void StopMetrics(void) {
+  atomic_store(&Metrics.stop, TRUE);
+  pthread_join(Metrics.thread, NULL);
+
+  int middle = atomic_load(&Metrics.middle);
+  if (middle & METRICS_FRESH) WriteMetrics(&Metrics.buffers[middle & ~METRICS_FRESH]);
+}
+
+void *MetricsWriter(void *arg) {
+  const struct timespec interval = {METRICS_INTERVAL_MS / 1000, (METRICS_INTERVAL_MS % 1000) * 1000000L};
+
+  (void)arg;
+  while (!atomic_load(&Metrics.stop)) {
+    nanosleep(&interval, NULL);
+    if (!(atomic_load_explicit(&Metrics.middle, memory_order_relaxed) & METRICS_FRESH)) continue;
+
+    Metrics.front = atomic_exchange_explicit(&Metrics.middle, Metrics.front, memory_order_acq_rel) & ~METRICS_FRESH;
+    WriteMetrics(&Metrics.buffers[Metrics.front]);
+  }
+  return NULL;
+}
+
+/*
+ * Write a snapshot to a temporary file next to the metrics file, then
+ * rename it over it.  A failure is reported but not fatal: monitoring
+ * mustn't stop the time code.
+ */
+void WriteMetrics(const struct MetricsSnapshot *m) {
+  static const char *discipline_states[] = {"off", "measuring", "locked"};
+  char temp[PATH_MAX];
+  FILE *fp;
+
+  snprintf(temp, sizeof(temp), "%s.tmp", Metrics.path);
+  if ((fp = fopen(temp, "w")) == NULL) {
+    fprintf(stderr, "%s: can't write metrics: %s\n", temp, strerror(errno));
+    return;
+  }
+
+  fprintf(fp, "# HELP tg2_seconds_sent_total Seconds of time code generated.\n# TYPE tg2_seconds_sent_total counter\n");
+  fprintf(fp, "tg2_seconds_sent_total %llu\n", (unsigned long long)m->seconds_sent);
+  fprintf(fp, "# HELP tg2_samples_total Samples generated.\n# TYPE tg2_samples_total counter\n");
+  fprintf(fp, "tg2_samples_total %llu\n", (unsigned long long)m->samples);
+  fprintf(fp, "# HELP tg2_underflows_total Output underflows.\n# TYPE tg2_underflows_total counter\n");
+  fprintf(fp, "tg2_underflows_total %lu\n", m->underflows);
+  fprintf(fp, "# HELP tg2_ring_underruns_total Callbacks padded with silence.\n");
+  fprintf(fp, "# TYPE tg2_ring_underruns_total counter\ntg2_ring_underruns_total %lu\n", m->ring_underruns);
+  fprintf(fp, "# HELP tg2_log_dropped_total Log messages dropped with the log ring full.\n");
+  fprintf(fp, "# TYPE tg2_log_dropped_total counter\ntg2_log_dropped_total %lu\n", m->log_dropped);
+  fprintf(fp, "# HELP tg2_sink_dropped_samples_total Samples dropped by -O sinks with their queue full.\n");
+  fprintf(fp, "# TYPE tg2_sink_dropped_samples_total counter\ntg2_sink_dropped_samples_total %lu\n",
+          m->sink_dropped);
+  fprintf(fp, "# HELP tg2_on_time_error_seconds Estimated on-time marker error against the system clock.\n");
+  fprintf(fp, "# TYPE tg2_on_time_error_seconds gauge\ntg2_on_time_error_seconds %.9f\n", m->on_time_error);
+  fprintf(fp, "# HELP tg2_latency_seconds Estimated latency from write to DAC.\n");
+  fprintf(fp, "# TYPE tg2_latency_seconds gauge\ntg2_latency_seconds %.9f\n", m->latency);
+  fprintf(fp, "# HELP tg2_look_ahead_seconds Rendered ahead of the device, on top of the latency.\n");
+  fprintf(fp, "# TYPE tg2_look_ahead_seconds gauge\ntg2_look_ahead_seconds %.6f\n", m->look_ahead);
+  fprintf(fp, "# HELP tg2_device_starved_total Seconds the device writer found not yet rendered.\n");
+  fprintf(fp, "# TYPE tg2_device_starved_total counter\ntg2_device_starved_total %lu\n", m->device_starved);
+  fprintf(fp, "# HELP tg2_sound_card_error_ppm Estimated sound card rate error.\n");
+  fprintf(fp, "# TYPE tg2_sound_card_error_ppm gauge\ntg2_sound_card_error_ppm %.4f\n", 1e6 * m->sound_card_error);
+  fprintf(fp, "# HELP tg2_rate_correction_ppm Rate correction in use.\n");
+  fprintf(fp, "# TYPE tg2_rate_correction_ppm gauge\ntg2_rate_correction_ppm %.4f\n", 1e6 * m->correction);
+  fprintf(fp, "# HELP tg2_discipline_state Rate discipline state.\n# TYPE tg2_discipline_state gauge\n");
+  for (int i = 0; i < (int)N_ELEMENTS(discipline_states); i++)
+    fprintf(fp, "tg2_discipline_state{state=\"%s\"} %d\n", discipline_states[i], m->discipline_state == i);
+  fprintf(fp, "# HELP tg2_cycles_total Carrier cycles added or removed by -k rate correction.\n");
+  fprintf(fp, "# TYPE tg2_cycles_total counter\n");
+  fprintf(fp, "tg2_cycles_total{direction=\"added\"} %d\n", m->cycles_added);
+  fprintf(fp, "tg2_cycles_total{direction=\"removed\"} %d\n", m->cycles_removed);
+  fprintf(fp, "# HELP tg2_leap_second_pending Leap second at the end of this minute.\n");
+  fprintf(fp, "# TYPE tg2_leap_second_pending gauge\n");
+  fprintf(fp, "tg2_leap_second_pending{polarity=\"insert\"} %d\n", m->leap_pending && !m->leap_delete);
+  fprintf(fp, "tg2_leap_second_pending{polarity=\"delete\"} %d\n", m->leap_pending && m->leap_delete);
+  fprintf(fp, "# HELP tg2_dst Daylight saving time in effect.\n# TYPE tg2_dst gauge\ntg2_dst %d\n", m->dst != 0);
+  fprintf(fp, "# HELP tg2_dst_pending DST switch at the end of this minute.\n");
+  fprintf(fp, "# TYPE tg2_dst_pending gauge\ntg2_dst_pending %d\n", m->dst_pending != 0);
+  fprintf(fp, "# HELP tg2_time_quality IEEE 1344 time quality code.\n");
+  fprintf(fp, "# TYPE tg2_time_quality gauge\ntg2_time_quality %d\n", m->time_quality);
+
+  uint64_t count = 0;
+  fprintf(fp, "# HELP tg2_write_block_seconds Time blocked in each write to the device.\n");
+  fprintf(fp, "# TYPE tg2_write_block_seconds histogram\n");
+  for (int i = 0; i < METRICS_WRITE_BUCKETS; i++) {
+    count += m->writes[i];
+    fprintf(fp, "tg2_write_block_seconds_bucket{le=\"%g\"} %llu\n", (1 << i) * 1e-6, (unsigned long long)count);
+  }
+  count += m->writes[METRICS_WRITE_BUCKETS];
+  fprintf(fp, "tg2_write_block_seconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)count);
+  fprintf(fp, "tg2_write_block_seconds_sum %.9f\n", m->write_seconds);
+  fprintf(fp, "tg2_write_block_seconds_count %llu\n", (unsigned long long)count);
+
+  if (fclose(fp) != 0 || rename(temp, Metrics.path) != 0)
+    fprintf(stderr, "%s: can't write metrics: %s\n", Metrics.path, strerror(errno));
+}
+
+/*
+ * printf, but once the generator is running, queued for the log writer,
+ * or dropped if it has fallen behind.
+ */
+void Log(const char *fmt, ...) {
+  char message[LOG_MESSAGE_BYTES];
+  va_list vargs;
+
+  va_start(vargs, fmt);
+  if (!LogRunning) {
+    vprintf(fmt, vargs);
+    va_end(vargs);
+    return;
+  }
+  int length = vsnprintf(message, sizeof(message), fmt, vargs);
+  va_end(vargs);
+
+  if (length > 0) LogPush(&TextLog, message, length < (int)sizeof(message) ? length : (int)sizeof(message) - 1);
+}
+
+/*
+ * Queue the record of a second for the -L file.
+ */
+void LogSecond(uint64_t sample, int year, int day, int hour, int minute, int second, int control, int flags) {
+  struct LogRecord record = {
+      .sample = sample,
+      .on_time_error_ns = (int32_t)llround(Timing.on_time_error * 1e9),
+      .correction_ppb = (int32_t)llround(Discipline.correction * 1e9),
+      .control = control,
+      .dropped = atomic_load_explicit(&TextLog.dropped, memory_order_relaxed),
+      .year = year,
+      .day_of_year = day,
+      .hour = hour,
+      .minute = minute,
+      .second = second,
+      .flags = flags,
+  };
+
+  if (LogRunning)
+    LogPush(&BinaryLog, &record, sizeof(record));
+  else if (fwrite(&record, sizeof(record), 1, BinaryLog.fp) != 1)
+    Die("%s: %s", BinaryLogPath, strerror(errno));
+}
+
+void InitLogRing(struct LogRing *ring, FILE *fp) {
+  ring->size = LOG_RING_BYTES;
+  ring->bytes = Allocate(ring->size, ARENA_ALIGNMENT);
+  memset(ring->bytes, 0, ring->size); /* fault it in now */
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->dropped, 0);
+  ring->fp = fp;
+}
+
+/*
+ * Copy a message into a ring whole, or count it dropped.
+ */
+int LogPush(struct LogRing *ring, const void *data, size_t n) {
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+  if (ring->size - (head - tail) < n) {
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    return FALSE;
+  }
+
+  size_t offset = head & (ring->size - 1);
+  size_t first = (n < ring->size - offset) ? n : ring->size - offset;
+  memcpy(ring->bytes + offset, data, first);
+  memcpy(ring->bytes, (const char *)data + first, n - first);
+  atomic_store_explicit(&ring->head, head + n, memory_order_release);
+  return TRUE;
+}
+
+/*
+ * Switch Log() over to the rings, once everything printed so far is out.
+ */
+void StartLog(void) {
+  InitLogRing(&TextLog, stdout);
+  if (BinaryLog.fp != NULL) InitLogRing(&BinaryLog, BinaryLog.fp);
+
+  fflush(stdout);
+  atomic_init(&LogStop, FALSE);
+  if (pthread_create(&LogThread, NULL, LogWriter, NULL) != 0) Die("can't start the log writer");
+  LogRunning = TRUE;
+}
+
+/*
+ * Stop the writer once it has written everything queued, and print
+ * directly again.
+ */
+void StopLog(void) {
+  LogRunning = FALSE;
+  atomic_store(&LogStop, TRUE);
+  pthread_join(LogThread, NULL);
+}
+
+void *LogWriter(void *arg) {
+  const struct timespec poll = {0, LOG_POLL_MS * 1000000L};
+
+  (void)arg;
+  for (;;) {
+    int stop = atomic_load(&LogStop); /* before draining, so nothing queued before the stop is missed */
+    int written = DrainLogRing(&TextLog);
+
+    if (BinaryLog.fp != NULL) written += DrainLogRing(&BinaryLog);
+    if (State.path != NULL && atomic_exchange(&State.due, FALSE)) SaveClockState();
+    if (Schedule.leap_path != NULL || Schedule.zone != NULL) CheckSchedule();
+    if (stop) return NULL;
+    if (written == 0) nanosleep(&poll, NULL);
+  }
+}
+
+/*
+ * Write out everything in a ring.  A write may block as long as it likes;
+ * the ring fills meanwhile and the generator drops messages.
+ */
+int DrainLogRing(struct LogRing *ring) {
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  int written = head - tail;
+
+  while (tail != head) {
+    size_t offset = tail & (ring->size - 1);
+    size_t n = (head - tail < ring->size - offset) ? head - tail : ring->size - offset;
+
+    fwrite(ring->bytes + offset, 1, n, ring->fp);
+    tail += n;
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+  }
+  if (written > 0) fflush(ring->fp);
+  return written;
+}
+
+/*
+ * Run the loop once per second.  A second that is longer by a fraction y
+ * starts the next one y seconds later, so with the sound card fast by d,
+ * error(k+1) = error(k) - d + y.
+ */
+void DisciplineRate(double error) {
+  double tc = Discipline.time_constant;
+
+  if (Discipline.updates == 0) Discipline.fll_error = error;
+  Discipline.updates++;
+
+  if (Discipline.updates < FLL_SECONDS) return;
+  if (Discipline.updates == FLL_SECONDS) {
+    /* Uncorrected so far, so the error has been falling by d a second. */
+    Discipline.frequency = (Discipline.fll_error - error) / (FLL_SECONDS - 1);
+  }
+
+  Discipline.frequency -= error / (4 * tc * tc);
+  SetRateCorrection(Discipline.frequency - error / tc);
+
+  if (Debug)
+    Log("> On-time error %+.6f s, frequency %+.3f ppm, correction %+.3f ppm.\n", error, 1e6 * Discipline.frequency,
+        1e6 * Discipline.correction);
+}
+
+void SetRateCorrection(double correction) {
+  if (correction > MAX_RATE_CORRECTION) correction = MAX_RATE_CORRECTION;
+  if (correction < -MAX_RATE_CORRECTION) correction = -MAX_RATE_CORRECTION;
+  Discipline.correction = correction;
+  RateNumerator = llround(SampleRate * RATE_DENOMINATOR * (1 + correction));
+}
+
+const char *ClockStateMode(void) { return CallbackMode ? "callback" : (Alsa.pcm != NULL ? "alsa" : "blocking"); }
+
+/*
+ * Split a state file line, "rate mode ppm latency_ms saved device", where
+ * saved is a Unix time and the device name runs to the end of the line.
+ * FALSE if it isn't one.
+ */
+int ParseClockState(char *line, double *rate, char *mode, double *frequency, double *latency, long *saved,
+                    const char **device) {
+  int n = 0;
+
+  line[strcspn(line, "\n")] = '\0';
+  if (line[0] == '#' ||
+      sscanf(line, "%lf %15s %lf %lf %ld %n", rate, mode, frequency, latency, saved, &n) != 5 || n == 0)
+    return FALSE;
+  *frequency *= 1e-6;
+  *latency *= 1e-3;
+  *device = line + n;
+  return TRUE;
+}
+
+/*
+ * Look for state saved for this device, rate and mode and, if it is fresh
+ * and the latency just measured agrees with it, start the discipline from
+ * the rate error saved, already locked.
+ */
+void LoadClockState(void) {
+  FILE *fp = fopen(State.path, "r");
+  char line[STATE_LINE], mode[16];
+  double rate, frequency, latency;
+  long saved;
+  const char *device;
+  int found = FALSE, other = FALSE;
+
+  if (fp == NULL) {
+    if (errno != ENOENT) fprintf(stderr, "Warning: can't read %s: %s\n", State.path, strerror(errno));
+    return;
+  }
+  while (!found && fgets(line, sizeof line, fp) != NULL) {
+    if (!ParseClockState(line, &rate, mode, &frequency, &latency, &saved, &device) || strcmp(device, State.device) != 0)
+      continue;
+    found = (rate == SampleRate && strcmp(mode, State.mode) == 0);
+    other = !found;
+  }
+  fclose(fp);
+
+  if (!found) {
+    if (other)
+      fprintf(stderr, "Warning: clock state for %s is for another sample rate or output mode, ignored.\n",
+              State.device);
+    return;
+  }
+
+  long age = time(NULL) - saved;
+  double tolerance = STATE_LATENCY_TOLERANCE + (Alsa.pcm != NULL ? 1e-6 * ALSA_PERIOD_US : 0); /* ALSA's moves */
+  if (age < 0 || age > STATE_MAX_AGE) {
+    fprintf(stderr, "Warning: clock state for %s is %ld days old, ignored.\n", State.device, age / SECONDS_PER_DAY);
+  } else if (fabs(frequency) > MAX_RATE_CORRECTION || fabs(latency - Timing.latency) > tolerance) {
+    fprintf(stderr, "Warning: clock state for %s (%+.3f ppm, latency %.1f ms) doesn't fit, ignored.\n", State.device,
+            1e6 * frequency, 1e3 * latency);
+  } else {
+    Discipline.frequency = frequency;
+    Discipline.updates = FLL_SECONDS; /* measured already */
+    SetRateCorrection(frequency);
+    if (Alsa.pcm == NULL) Timing.latency = latency; /* where the average starts */
+    printf("Clock state for %s restored: %+.3f ppm, latency %.1f ms, saved %ld s ago.\n", State.device,
+           1e6 * frequency, 1e3 * latency, age);
+  }
+}
+
+/*
+ * Generator: publish the rate error and latency, once locked, and ask the
+ * log writer to save them.
+ */
+void PublishClockState(void) {
+  atomic_store_explicit(&State.frequency, Discipline.frequency, memory_order_relaxed);
+  atomic_store_explicit(&State.latency, Timing.latency, memory_order_relaxed);
+  atomic_store_explicit(&State.due, TRUE, memory_order_release);
+}
+
+/*
+ * Write the state file again with this device's line replaced, to a new
+ * file renamed over the old one, so a crash never leaves half of one.
+ */
+void SaveClockState(void) {
+  char temporary[PATH_MAX], line[STATE_LINE], mode[16];
+  double rate, frequency, latency;
+  long saved;
+  const char *device;
+  FILE *in, *out;
+
+  snprintf(temporary, sizeof temporary, "%s.new", State.path);
+  if ((out = fopen(temporary, "w")) == NULL) {
+    fprintf(stderr, "Warning: can't save clock state to %s: %s\n", temporary, strerror(errno));
+    return;
+  }
+  fprintf(out, "# tg2 clock state: rate mode ppm latency_ms saved device\n");
+  if ((in = fopen(State.path, "r")) != NULL) {
+    while (fgets(line, sizeof line, in) != NULL) {
+      if (!ParseClockState(line, &rate, mode, &frequency, &latency, &saved, &device)) continue;
+      if (strcmp(device, State.device) == 0 && rate == SampleRate && strcmp(mode, State.mode) == 0) continue;
+      fprintf(out, "%.0f %s %+.6f %.3f %ld %s\n", rate, mode, 1e6 * frequency, 1e3 * latency, saved, device);
+    }
+    fclose(in);
+  }
+  fprintf(out, "%.0f %s %+.6f %.3f %ld %s\n", SampleRate, State.mode,
+          1e6 * atomic_load_explicit(&State.frequency, memory_order_relaxed),
+          1e3 * atomic_load_explicit(&State.latency, memory_order_relaxed), (long)time(NULL), State.device);
+  if (fclose(out) != 0 || rename(temporary, State.path) != 0)
+    fprintf(stderr, "Warning: can't save clock state to %s: %s\n", State.path, strerror(errno));
+}
+
+/*
+ * Size the callback ring to hold at least ms of samples, and touch it so
+ * the callback never takes a page fault.
+ */
+void InitRing(int ms) {
+  uint64_t size = 1;
+
+  while (size < (uint64_t)MsToSamples(ms)) size <<= 1;
+  OutputRing.samples = Allocate(OutputFormat->bytes * size, sysconf(_SC_PAGESIZE));
+  memset(OutputRing.samples, 0, OutputFormat->bytes * size);
+  OutputRing.size = size;
+  atomic_init(&OutputRing.head, 0);
+  atomic_init(&OutputRing.tail, 0);
+  atomic_init(&OutputRing.consumer_min_fill, size);
+  atomic_init(&OutputRing.underruns, 0);
+  atomic_init(&OutputRing.underrun_samples, 0);
+  atomic_init(&OutputRing.device_underflows, 0);
+  atomic_init(&OutputRing.pinned, 0);
+  OutputRing.producer_min_fill = size;
+  OutputRing.producer_waits = 0;
+}
+
+/*
+ * Copy samples into the ring, waiting for the callback to make room when
+ * it is full.  The wait is a short sleep rather than anything the
+ * callback would have to signal.
+ */
+void RingWrite(const void *samples, int n_samples) {
+  struct Ring *ring = &OutputRing;
+  const char *next = samples;
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  struct timespec nap = {0, 1000000}; /* 1 ms */
+
+  while (n_samples > 0) {
+    uint64_t fill = head - atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint64_t space = ring->size - fill;
+
+    if (fill < ring->producer_min_fill) ring->producer_min_fill = fill;
+    if (space == 0) {
+      ring->producer_waits++;
+      nanosleep(&nap, NULL);
+      continue;
+    }
+
+    uint64_t index = head & (ring->size - 1);
+    uint64_t n = (uint64_t)n_samples < space ? (uint64_t)n_samples : space;
+    if (n > ring->size - index) n = ring->size - index; /* up to the wrap, the rest next time round */
+
+    memcpy(ring->samples + OutputFormat->bytes * index, next, OutputFormat->bytes * n);
+    head += n;
+    next += OutputFormat->bytes * n;
+    n_samples -= n;
+    atomic_store_explicit(&ring->head, head, memory_order_release);
+  }
+}
+
+/*
+ * PortAudio callback: copy whatever is queued, pad with silence if the
+ * generator has fallen behind.  Nothing here blocks or allocates.
+ */
+int OutputCallback(const void *input, void *output, unsigned long frameCount,
+                   const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags, void *userData) {
+  struct Ring *ring = userData;
+  char *out = output;
+  size_t bytes = OutputFormat->bytes;
+  uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  uint64_t fill = atomic_load_explicit(&ring->head, memory_order_acquire) - tail;
+  uint64_t n = fill < frameCount ? fill : frameCount;
+  uint64_t index = tail & (ring->size - 1);
+  uint64_t first = n < ring->size - index ? n : ring->size - index;
+
+  (void)input;
+
+  /* Pin the callback thread on its first call; the generator reports it. */
+  if (OutputCpu >= 0 && atomic_load_explicit(&ring->pinned, memory_order_relaxed) == 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(OutputCpu, &cpus);
+    atomic_store_explicit(&ring->pinned, pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) + 1,
+                          memory_order_relaxed);
+  }
+
+  /* Publish where this buffer will be played, for EstimateDacTime(). */
+  atomic_fetch_add_explicit(&ring->timing_sequence, 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&ring->timing_sample, tail, memory_order_relaxed);
+  atomic_store_explicit(&ring->timing_dac_ns, llround(timeInfo->outputBufferDacTime * 1e9), memory_order_relaxed);
+  atomic_fetch_add_explicit(&ring->timing_sequence, 1, memory_order_release);
+
+  memcpy(out, ring->samples + bytes * index, bytes * first);
+  memcpy(out + bytes * first, ring->samples, bytes * (n - first));
+  atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+
+  if (n < frameCount) {
+    memset(out + bytes * n, 0, bytes * (frameCount - n));
+    atomic_fetch_add_explicit(&ring->underruns, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&ring->underrun_samples, frameCount - n, memory_order_relaxed);
+  }
+  if (statusFlags & paOutputUnderflow) atomic_fetch_add_explicit(&ring->device_underflows, 1, memory_order_relaxed);
+  if (fill < atomic_load_explicit(&ring->consumer_min_fill, memory_order_relaxed))
+    atomic_store_explicit(&ring->consumer_min_fill, fill, memory_order_relaxed);
+
+  return paContinue;
+}
+
+void DrainRing(void) {
+  while (atomic_load_explicit(&OutputRing.tail, memory_order_acquire) !=
+         atomic_load_explicit(&OutputRing.head, memory_order_relaxed)) {
+    Pa_Sleep(10);
+  }
+}
+
+/*
+ * Report ring fill and underruns, then start the low watermarks over for
+ * the next report.
+ */
+void PrintRingStatistics(void) {
+  struct Ring *ring = &OutputRing;
+  uint64_t fill = atomic_load_explicit(&ring->head, memory_order_relaxed) -
+                  atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  uint64_t consumer_min_fill = atomic_exchange_explicit(&ring->consumer_min_fill, ring->size, memory_order_relaxed);
+
+  Log(" Ring fill = %.1f ms of %.1f ms, lowest %.1f ms (generator) %.1f ms (callback).\n", 1000. * fill / SampleRate,
+      1000. * ring->size / SampleRate, 1000. * ring->producer_min_fill / SampleRate,
+      1000. * consumer_min_fill / SampleRate);
+  Log(" Ring underruns = %lu (%lu samples), device underflows = %lu, generator waits = %lu.\n\n",
+      atomic_load_explicit(&ring->underruns, memory_order_relaxed),
+      atomic_load_explicit(&ring->underrun_samples, memory_order_relaxed),
+      atomic_load_explicit(&ring->device_underflows, memory_order_relaxed), ring->producer_waits);
+  ring->producer_min_fill = ring->size;
+
+  int pinned = atomic_exchange_explicit(&ring->pinned, -1, memory_order_relaxed);
+  if (pinned == 1)
+    Log(" Callback thread pinned to CPU %d.\n", OutputCpu);
+  else if (pinned > 1)
+    fprintf(stderr, "Warning: can't pin the callback thread to CPU %d: %s.\n", OutputCpu, strerror(pinned - 1));
+  if (pinned == 0) atomic_store_explicit(&ring->pinned, 0, memory_order_relaxed); /* not called yet */
+}
+
+/*
+ * Allocate the slots, touched so neither side takes a page fault, and
+ * start the device writer.  Until now the generator wrote to the device
+ * itself, so it is full, and has been written up to SampleClock: the
+ * timing starts from there.
+ */
+void StartAhead(void) {
+  size_t bytes;
+
+  Ahead.size = Ahead.depth + 1;
+  Ahead.capacity = (int)ceil(SampleRate * (1 + MAX_RATE_CORRECTION) * LONGEST_PULSE_MS / 1000.);
+  Ahead.piece = MsToSamples(AHEAD_WRITE_MS);
+  bytes = (size_t)OutputFormat->bytes * Ahead.capacity;
+  Ahead.slots = Allocate(Ahead.size * sizeof(struct AheadSlot), ARENA_ALIGNMENT);
+  for (int i = 0; i < Ahead.size; i++) {
+    Ahead.slots[i].samples = Allocate(bytes, sysconf(_SC_PAGESIZE));
+    memset(Ahead.slots[i].samples, 0, bytes);
+    Ahead.slots[i].n = 0;
+  }
+  atomic_init(&Ahead.head, 0);
+  atomic_init(&Ahead.tail, 0);
+  atomic_init(&Ahead.written, SampleClock);
+  atomic_init(&Ahead.timing_sequence, 0);
+  atomic_init(&Ahead.starved, 0);
+  atomic_init(&Ahead.stop, FALSE);
+  Ahead.lowest = UINT64_MAX;
+  PublishAheadTiming(SampleClock);
+  if (pthread_create(&Ahead.thread, NULL, AheadWriter, NULL) != 0) Die("can't start the device writer");
+  Ahead.running = TRUE;
+}
+
+void StopAhead(void) {
+  PassAhead();
+  atomic_store(&Ahead.stop, TRUE);
+  pthread_join(Ahead.thread, NULL);
+  Ahead.running = FALSE;
+}
+
+/*
+ * Device writer: write each slot as it is handed over, a piece at a time,
+ * publishing after each when the next will reach the DAC.  Waiting for a
+ * slot after the first means the generator fell behind, and the device
+ * may have run dry meanwhile.
+ */
+void *AheadWriter(void *arg) {
+  const struct timespec nap = {0, AHEAD_POLL_US * 1000L};
+  uint64_t tail = 0;
+  int waiting = FALSE;
+
+  (void)arg;
+  for (;;) {
+    int stop = atomic_load(&Ahead.stop); /* before looking, so nothing handed over before the stop is missed */
+
+    if (atomic_load_explicit(&Ahead.head, memory_order_acquire) == tail) {
+      if (stop) return NULL;
+      if (tail > 0 && !waiting) atomic_fetch_add_explicit(&Ahead.starved, 1, memory_order_relaxed);
+      waiting = TRUE;
+      nanosleep(&nap, NULL);
+      continue;
+    }
+    waiting = FALSE;
+
+    const struct AheadSlot *slot = &Ahead.slots[tail % Ahead.size];
+    uint64_t written = atomic_load_explicit(&Ahead.written, memory_order_relaxed);
+
+    for (int done = 0, n; done < slot->n; done += n) {
+      n = (slot->n - done < Ahead.piece) ? slot->n - done : Ahead.piece;
+      WriteDevice(slot->samples + (size_t)OutputFormat->bytes * done, n);
+      written += n;
+      PublishAheadTiming(written);
+      atomic_store_explicit(&Ahead.written, written, memory_order_relaxed);
+    }
+    atomic_store_explicit(&Ahead.tail, ++tail, memory_order_release);
+  }
+}
+
+/*
+ * Publish when the next sample written will reach the DAC.  Only right
+ * after a write returns is the device full, as a blocking device's
+ * latency assumes.
+ */
+void PublishAheadTiming(uint64_t sample) {
+  double latency = DeviceLatency();
+  struct timespec now;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  atomic_fetch_add_explicit(&Ahead.timing_sequence, 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&Ahead.timing_sample, sample, memory_order_relaxed);
+  atomic_store_explicit(&Ahead.timing_ns, now.tv_sec * 1000000000LL + now.tv_nsec, memory_order_relaxed);
+  atomic_store_explicit(&Ahead.timing_latency_ns, llround(latency * 1e9), memory_order_relaxed);
+  atomic_fetch_add_explicit(&Ahead.timing_sequence, 1, memory_order_release);
+}
+
+/*
+ * Copy samples into the slot being rendered, handing it over when full.
+ */
+void QueueAhead(const void *samples, int n_samples) {
+  const char *next = samples;
+
+  while (n_samples > 0) {
+    struct AheadSlot *slot = &Ahead.slots[atomic_load_explicit(&Ahead.head, memory_order_relaxed) % Ahead.size];
+    int n = (Ahead.capacity - slot->n < n_samples) ? Ahead.capacity - slot->n : n_samples;
+
+    memcpy(slot->samples + (size_t)OutputFormat->bytes * slot->n, next, (size_t)OutputFormat->bytes * n);
+    slot->n += n;
+    next += (size_t)OutputFormat->bytes * n;
+    n_samples -= n;
+    if (slot->n == Ahead.capacity) PassAhead();
+  }
+}
+
+/*
+ * Hand the slot over, note how far ahead of the device that leaves us,
+ * and wait for the next slot to come free: the generator's only wait for
+ * the device.
+ */
+void PassAhead(void) {
+  const struct timespec nap = {0, AHEAD_POLL_US * 1000L};
+  uint64_t head = atomic_load_explicit(&Ahead.head, memory_order_relaxed);
+
+  if (Ahead.slots[head % Ahead.size].n == 0) return;
+  atomic_store_explicit(&Ahead.head, ++head, memory_order_release);
+
+  uint64_t ahead = SampleClock - atomic_load_explicit(&Ahead.written, memory_order_relaxed);
+  Timing.ahead = (double)ahead / SampleRate;
+  if (ahead < Ahead.lowest) Ahead.lowest = ahead;
+
+  while (head - atomic_load_explicit(&Ahead.tail, memory_order_acquire) == (uint64_t)Ahead.size)
+    nanosleep(&nap, NULL);
+  Ahead.slots[head % Ahead.size].n = 0;
+}
+
+/*
+ * Report how far ahead of the device we are rendering, then start the
+ * low watermark over for the next report.
+ */
+void PrintAheadStatistics(void) {
+  if (Ahead.lowest == UINT64_MAX) return; /* nothing handed over yet */
+  Log(" Rendered ahead of the device = %.3f s, lowest %.3f s, device writer starved %lu times.\n\n", Timing.ahead,
+      (double)Ahead.lowest / SampleRate, atomic_load_explicit(&Ahead.starved, memory_order_relaxed));
+  Ahead.lowest = UINT64_MAX;
+}
+
+/*
+ * Set up the generator thread, and the device writer's, as -R, -K and -A
+ * ask, as far as we're allowed, and say what we got.
+ */
+void SetupRealtime(void) {
+  struct sched_param param;
+  int policy, err;
+
+  pthread_getschedparam(pthread_self(), &policy, &param);
+  Log(" Scheduling %s priority %d", PolicyName(policy), param.sched_priority);
+  if (RealtimePolicy != SCHED_OTHER) {
+    struct sched_param want = {.sched_priority = RealtimePriority};
+
+    if ((err = pthread_setschedparam(pthread_self(), RealtimePolicy, &want)) != 0)
+      fprintf(stderr, "Warning: can't run under %s priority %d: %s.\n", PolicyName(RealtimePolicy), RealtimePriority,
+              strerror(err));
+    pthread_getschedparam(pthread_self(), &policy, &param);
+    Log(", asked for %s priority %d, running %s priority %d", PolicyName(RealtimePolicy), RealtimePriority,
+        PolicyName(policy), param.sched_priority);
+    if (Ahead.running && (err = pthread_setschedparam(Ahead.thread, RealtimePolicy, &want)) != 0)
+      fprintf(stderr, "Warning: can't run the device writer under %s priority %d: %s.\n", PolicyName(RealtimePolicy),
+              RealtimePriority, strerror(err));
+  }
+  Log(".\n");
+
+  if (LockMemory) {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      fprintf(stderr, "Warning: can't lock memory: %s.\n", strerror(errno));
+    } else {
+      PrefaultStack();
+      Log(" Memory locked, %d KiB of stack prefaulted.\n", STACK_PREFAULT_BYTES / 1024);
+    }
+  }
+
+  if (RenderCpu >= 0) {
+    cpu_set_t cpus;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(RenderCpu, &cpus);
+    if ((err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)) != 0)
+      fprintf(stderr, "Warning: can't pin the generator to CPU %d: %s.\n", RenderCpu, strerror(err));
+    else
+      Log(" Generator pinned to CPU %d.\n", RenderCpu);
+  }
+  if (OutputCpu >= 0 && Ahead.running) {
+    cpu_set_t cpus;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(OutputCpu, &cpus);
+    if ((err = pthread_setaffinity_np(Ahead.thread, sizeof(cpus), &cpus)) != 0)
+      fprintf(stderr, "Warning: can't pin the device writer to CPU %d: %s.\n", OutputCpu, strerror(err));
+    else
+      Log(" Device writer pinned to CPU %d.\n", OutputCpu);
+  } else if (OutputCpu >= 0 && !CallbackMode) {
+    fprintf(stderr, "Warning: blocking writes run on the generator thread, so it alone is pinned (see -C, -N).\n");
+  }
+}
+
+const char *PolicyName(int policy) {
+  switch (policy) {
+    case SCHED_FIFO:
+      return "SCHED_FIFO";
+    case SCHED_RR:
+      return "SCHED_RR";
+    case SCHED_OTHER:
+      return "SCHED_OTHER";
+    default:
+      return "another policy";
+  }
+}
+
+/*
+ * With memory locked, touch enough stack that the generator never faults
+ * a new page in while running.
+ */
+void PrefaultStack(void) {
+  char stack[STACK_PREFAULT_BYTES];
+
+  memset(stack, 0, sizeof(stack));
+  __asm__ volatile("" : : "r"(stack) : "memory"); /* keep the memset */
+}
+
+/*
+ * Build the sine wavetables and the per-carrier phase increments for the
+ * sample rate in use.  Must be called once SampleRate and OutputFormat
+ * are known.
+ */
+void InitOscillators(void) {
+  for (int i = 0; i <= WAVETABLE_SIZE; i++) {
+    double sine = sin(2 * M_PI * i / WAVETABLE_SIZE);
+
+    Wavetable[i] = sine;
+    for (int amp = LOW; amp <= HIGH; amp++)
+      LevelWavetables[amp][i] = lround(Levels[amp] * OutputFormat->full_scale * sine);
+  }
+
+  /* Carriers above Nyquist are left at zero, and refused if asked for. */
+  for (size_t i = 0; i < N_ELEMENTS(Oscillators); i++) {
+    if (Oscillators[i].freq < SampleRate / 2)
+      Oscillators[i].increment = (uint64_t)ldexp(Oscillators[i].freq / SampleRate, 64);
+  }
+}
+
+const struct Oscillator *FindOscillator(int freq) {
+  for (size_t i = 0; i < N_ELEMENTS(Oscillators); i++) {
+    if (Oscillators[i].freq == freq) {
+      if (freq >= SampleRate / 2) Die("%d Hz carrier needs a sample rate above %d Hz", freq, 2 * freq);
+      return &Oscillators[i];
+    }
+  }
+  Die("no oscillator for %d Hz", freq);
+  return NULL;
+}
+
+/*
+ * Render n_samples of carrier at amplitude damp, starting at sample number
+ * clock of a template, which starts at phase zero.  The top WAVETABLE_BITS
+ * of the phase index the table and the next 32 bits interpolate between
+ * neighbouring entries.
+ */
+void RunOscillator(const struct Oscillator *osc, uint64_t clock, float damp, float *buffer, int n_samples) {
+  uint64_t phase = osc->increment * clock; /* unsigned arithmetic wraps modulo one cycle */
+
+  for (int i = 0; i < n_samples; i++) {
+    uint32_t index = phase >> (64 - WAVETABLE_BITS);
+    float frac = (float)((uint32_t)(phase >> (32 - WAVETABLE_BITS))) * (1.0f / 4294967296.0f);
+    float s0 = Wavetable[index];
+    buffer[i] = damp * (s0 + (Wavetable[index + 1] - s0) * frac);
+    phase += osc->increment;
+  }
+}
+
+/*
+ * The same for an integer format, from a wavetable already at the
+ * amplitude wanted, interpolating in 64-bit integers and rounding once.
+ */
+void RunIntegerOscillator(const struct Oscillator *osc, uint64_t clock, const int32_t *table, void *buffer,
+                          int n_samples) {
+  uint64_t phase = osc->increment * clock;
+
+  for (int i = 0; i < n_samples; i++) {
+    uint32_t index = phase >> (64 - WAVETABLE_BITS);
+    int64_t frac = (uint32_t)(phase >> (32 - WAVETABLE_BITS));
+    int64_t s0 = table[index];
+    PutSample(buffer, i, (int32_t)(s0 + (((table[index + 1] - s0) * frac + (1LL << 31)) >> 32)));
+    phase += osc->increment;
+  }
+}
+
+struct SampleFormat *FindSampleFormat(const char *name) {
+  for (size_t i = 0; i < N_ELEMENTS(SampleFormats); i++) {
+    if (strcasecmp(SampleFormats[i].name, name) == 0) return &SampleFormats[i];
+  }
+  Die("Unknown sample format %s (f32, s32, s24 or s16)", name);
+  return NULL;
+}
+
+/* Integer samples are little-endian, bytes wide. */
+void PutSample(void *buffer, int i, int32_t value) {
+  unsigned char *p = (unsigned char *)buffer + (size_t)OutputFormat->bytes * i;
+
+  for (int b = 0; b < OutputFormat->bytes; b++) p[b] = (uint32_t)value >> (8 * b);
+}
+
+int32_t GetSample(const void *buffer, int i) {
+  const unsigned char *p = (const unsigned char *)buffer + (size_t)OutputFormat->bytes * i;
+  int shift = 32 - 8 * OutputFormat->bytes;
+  uint32_t value = 0;
+
+  for (int b = 0; b < OutputFormat->bytes; b++) value |= (uint32_t)p[b] << (8 * b);
+  return (int32_t)(value << shift) >> shift; /* sign extend */
+}
+
+int MsToSamples(int ms) { return (int)(SampleRate * ms / 1000.); }
+
+struct IrigRate *FindIrigRate(char letter) {
+  for (size_t i = 0; i < N_ELEMENTS(IrigRates); i++) {
+    if (IrigRates[i].letter == letter) return &IrigRates[i];
+  }
+  Die("Unknown IRIG rate %c (A, B, E, G or H)", letter);
+  return NULL;
+}
+
+/*
+ * The sample clock is the master timebase.  Every pulse boundary is an
+ * exact number of microseconds from the start, and the number of samples
+ * to send is carried forward as an integer fraction, so there is no
+ * truncation error to accumulate: one second is exactly SampleRate
+ * samples on average, whatever the rate, for as long as we run.
+ */
+void InitTimebase(void) {
+  SetRateCorrection(0);
+  if (RateNumerator == 0) Die("bad sample rate %f", SampleRate);
+  TimebaseRemainder = 1000000 * RATE_DENOMINATOR / 2; /* round to nearest sample */
+}
+
+int AdvanceTimebase(int us) {
+  TimebaseRemainder += (uint64_t)us * RateNumerator;
+  int n_samples = TimebaseRemainder / (1000000 * RATE_DENOMINATOR);
+  TimebaseRemainder %= 1000000 * RATE_DENOMINATOR;
+  return n_samples;
+}
+
+/*
+ * Samples in the first seconds of a run, and the fraction of a sample
+ * then owed, exactly as AdvanceTimebase() would send them with no rate
+ * correction.  A whole second is a whole number of 1 / RATE_DENOMINATOR
+ * samples, so this works in those rather than microseconds.
+ */
+uint64_t TimebaseSamples(uint64_t seconds, uint64_t *remainder) {
+  uint64_t total = seconds * RateNumerator + RATE_DENOMINATOR / 2;
+
+  if (remainder != NULL) *remainder = total % RATE_DENOMINATOR * 1000000;
+  return total / RATE_DENOMINATOR;
+}
+
+/*
+ * Render the symbol templates needed by the selected encoder.  Only done
+ * once, at startup, after InitOscillators().
+ */
+void InitTemplates(void) {
+  switch (encode) {
+    case IRIG:
+      for (int high = M2; high <= M8; high += M5 - M2) {
+        for (int total = IRIG_SYMBOL_SHORT; total <= IRIG_SYMBOL_LONG; total++) {
+          struct Template *t = &IrigTemplates[high][total - IRIG_SYMBOL_SHORT];
+          ReserveTemplate(t, total * IrigTenthUs);
+          AddToTemplate(t, high * IrigTenthUs, Irig->carrier, HIGH);
+          AddToTemplate(t, (total - high) * IrigTenthUs, Irig->carrier, Irig->carrier ? LOW : OFF);
+        }
+      }
+      break;
+
+    case WWV:
+      ReserveTemplate(&WwvTickTemplate, 30 * 1000);
+      AddToTemplate(&WwvTickTemplate, 5 * 1000, tone, HIGH);
+      AddToTemplate(&WwvTickTemplate, 25 * 1000, tone, OFF);
+      ReserveTemplate(&WwvDataTemplate, (PI - 30) * 1000);
+      AddToTemplate(&WwvDataTemplate, (PI - 30) * 1000, 100, LOW);
+      ReserveTemplate(&WwvMinuteTemplate, progx[0].arg * 1000);
+      AddToTemplate(&WwvMinuteTemplate, progx[0].arg * 1000, tone, HIGH);
+      ReserveTemplate(&WwvHourTemplate, progx[0].arg * 1000);
+      AddToTemplate(&WwvHourTemplate, progx[0].arg * 1000, HourTone, HIGH);
+      break;
+  }
+
+  /* Longest quiet time is the rest of a long second after the shortest
+   * pulse, or the alignment delay at startup. */
+  ReserveTemplate(&SilenceTemplate, LONGEST_PULSE_MS * 1000);
+  AddToTemplate(&SilenceTemplate, LONGEST_PULSE_MS * 1000, 0, OFF);
+}
+
+/*
+ * A template holds one more sample than the pulse rounds up to at the
+ * fastest corrected rate, since the timebase may ask for either the floor
+ * or the ceiling of a fractional number of samples.
+ */
+void ReserveTemplate(struct Template *t, int us) {
+  t->length = (int)ceil(SampleRate * (1 + MAX_RATE_CORRECTION) * us / 1e6) + 1;
+  t->samples = ArenaAlloc((size_t)OutputFormat->bytes * t->length);
+  t->us = 0;
+}
+
+/*
+ * Append a pulse to a template, keeping the carrier phase continuous with
+ * the start of the template.  The pulse is painted through to the end of
+ * the template, and overwritten by the next pulse added, so the slack at
+ * the end always continues the last pulse.  With no carrier the pulse is
+ * a level, and the sample it starts in is shared with the pulse before
+ * in proportion, so pulse widths are exact to a fraction of a sample.
+ */
+void AddToTemplate(struct Template *t, int pulse, /* pulse length (us) */
+                   int freq,                      /* frequency (Hz), 0 = level */
+                   int amp                        /* amplitude */
+) {
+  double edge = SampleRate * t->us / 1e6;
+  int start = (freq == 0) ? (int)floor(edge) : (int)lround(edge);
+  int n_samples = t->length - start;
+  char *samples = (char *)t->samples + (size_t)OutputFormat->bytes * start;
+
+  if (amp < OFF || amp > HIGH) Die("???");
+  float damp = Levels[amp];
+
+  if (n_samples <= 0) Die("template overflow (%d us)", t->us + pulse);
+
+  if (freq == 0 && OutputFormat->full_scale == 0) {
+    float *level = (float *)samples;
+    float before = (start > 0) ? level[0] : damp;
+    float share = edge - start;
+
+    for (int i = 0; i < n_samples; i++) level[i] = damp;
+    level[0] = share * before + (1 - share) * damp;
+  } else if (freq == 0) {
+    int32_t level = (int32_t)lround(damp * OutputFormat->full_scale);
+    int32_t before = (start > 0) ? GetSample(samples, 0) : level;
+    double share = edge - start;
+
+    for (int i = 0; i < n_samples; i++) PutSample(samples, i, level);
+    PutSample(samples, 0, (int32_t)lround(share * before + (1 - share) * level));
+  } else if (amp == OFF) {
+    memset(samples, 0, (size_t)OutputFormat->bytes * n_samples);
+  } else {
+    /* The template starts at the on-time point, or a whole number of
+     * cycles after it, so at phase zero. */
+    const struct Oscillator *osc = FindOscillator(freq);
+    if (OutputFormat->full_scale == 0)
+      RunOscillator(osc, start, damp, (float *)samples, n_samples);
+    else
+      RunIntegerOscillator(osc, start, LevelWavetables[amp], samples, n_samples);
+  }
+  t->us += pulse;
+}
+
+/*
+ * Send the first us of a template, as many samples as the timebase says.
+ */
+void SendTemplate(const struct Template *t, int us) {
+  int n_samples = AdvanceTimebase(us);
+
+  if (n_samples > t->length) Die("template too short (%d > %d samples)", n_samples, t->length);
+  Emit(t->samples, n_samples);
+}
+
+void SendSilence(int ms) { EmitSilence(AdvanceTimebase(ms * 1000)); }
+
+void EmitSilence(uint64_t n_samples) {
+  while (n_samples > (uint64_t)SilenceTemplate.length) {
+    Emit(SilenceTemplate.samples, SilenceTemplate.length);
+    n_samples -= SilenceTemplate.length;
+  }
+  Emit(SilenceTemplate.samples, n_samples);
+}
+
+void SendIrigSymbol(int high, int low) {
+  SendTemplate(&IrigTemplates[high][high + low - IRIG_SYMBOL_SHORT], (high + low) * IrigTenthUs);
+}
+
+/*
+ * Split an offset in hours, to the half hour, into the IEEE 1344 sign,
+ * hours and half hour.
+ */
+void SetTimeOffset(float TimeOffset, int *SignBit, int *Ones, int *Half) {
+  if (TimeOffset >= -0.2) {
+    *SignBit = 0;
+
+    if (TimeOffset > 0) {
+      *Ones = TimeOffset;
+
+      if ((TimeOffset - floor(TimeOffset)) >= 0.4)
+        *Half = 1;
+      else
+        *Half = 0;
+    } else {
+      *Ones = 0;
+      *Half = 0;
+    }
+  } else {
+    *SignBit = 1;
+    *Ones = -TimeOffset;
+
+    if ((ceil(TimeOffset) - TimeOffset) >= 0.4)
+      *Half = 1;
+    else
+      *Half = 0;
+  }
+}
+
+/*
+ * Move the IEEE 1344 offset forward (spring ahead) or back an hour, to
+ * stay consistent with UTC across a DST switch.
+ */
+void StepOffsetHour(int Forward, int *SignBit, int *Ones, int Half) {
+  if ((*SignBit == 0) == Forward) { /* away from zero */
+    if (*Ones == 0x0F) {
+      *SignBit = !*SignBit;
+      *Ones = (Half == 0) ? 8 : 7;
+    } else
+      (*Ones)++;
+  } else { /* towards zero, and past it */
+    if (*Ones == 0) {
+      *SignBit = !*SignBit;
+      *Ones = (Half == 0) ? 1 : 0;
+    } else
+      (*Ones)--;
+  }
+}
+
+/*
+ * The calendar.  Times are seconds since 2000-01-01 00:00, and years are
+ * counted from 2000, so 100 is 2100 (sent as 00, and not a leap year);
+ * a time converts to a date and back in a few arithmetic steps, however
+ * far away it is.
+ */
+
+/* Days before the start of a year, by the Gregorian rules. */
+static long DaysBeforeYear(int YearValue) {
+  return 365L * YearValue + (YearValue + 3) / 4 - (YearValue + 99) / 100 + (YearValue + 399) / 400;
+}
+
+int DaysInYear(int YearValue) { return DaysBeforeYear(YearValue + 1) - DaysBeforeYear(YearValue); }
+
+/*
+ * Step from start through elapsed seconds of a run, event by event: the
+ * -i/-b leap second in the minute at leap_minute, the -g switch at the
+ * minute dst_minute (NO_EVENT for none) and those in the schedule.  Each
+ * event has a time sent it takes effect at: a deleted second 59 is never
+ * sent, an inserted second 60 takes a second of the run, and a switch
+ * moves the time sent an hour.  As in the generator, a switch from the
+ * schedule to the DST already in effect is passed over.
+ */
+void SeekCalendar(struct CalendarSeek *seek, int64_t start, int64_t elapsed, int64_t leap_minute, int delete,
+                  int64_t dst_minute) {
+  const struct EventTable *table =
+      (Schedule.leap_path != NULL || Schedule.zone != NULL) ? &Schedule.slots[Schedule.front] : NULL;
+  int next = (table != NULL) ? FirstEvent(table, start - SECONDS_PER_MINUTE) : 0;
+  int64_t left = elapsed;
+
+  seek->at = start;
+  seek->leap_second = FALSE;
+  seek->steps = 0;
+  seek->switched = FALSE;
+  for (;;) {
+    int64_t when = NO_EVENT, at;
+    int kind = -1, own = FALSE;
+
+    if (leap_minute != NO_EVENT && (at = leap_minute + (delete ? 59 : 60)) > seek->at && at < when) {
+      when = at;
+      kind = delete ? EVENT_LEAP_DELETE : EVENT_LEAP_INSERT;
+      own = TRUE;
+    }
+    if (dst_minute != NO_EVENT && dst_minute > seek->at && dst_minute < when) {
+      when = dst_minute;
+      kind = EVENT_DST_ON; /* either way */
+      own = TRUE;
+    }
+    for (; table != NULL && next < table->count; next++) {
+      const struct ScheduleEvent *event = &table->events[next];
+
+      at = event->at + (event->kind == EVENT_LEAP_INSERT   ? 60
+                        : event->kind == EVENT_LEAP_DELETE ? 59
+                                                           : 0);
+      if (at <= seek->at) continue; /* before the start */
+      if (at < when) {
+        when = at;
+        kind = event->kind;
+        own = FALSE;
+      }
+      break;
+    }
+
+    if (when == NO_EVENT || seek->at + left < when) {
+      seek->at += left;
+      return;
+    }
+    left -= when - seek->at;
+    seek->at = when;
+    if (!own)
+      next++;
+    else if (kind == EVENT_LEAP_INSERT || kind == EVENT_LEAP_DELETE)
+      leap_minute = NO_EVENT;
+    else
+      dst_minute = NO_EVENT;
+
+    switch (kind) {
+      case EVENT_LEAP_INSERT:
+        if (left == 0) { /* in it */
+          seek->at = when - 1;
+          seek->leap_second = TRUE;
+          return;
+        }
+        left--;
+        break;
+      case EVENT_LEAP_DELETE:
+        seek->at = when + 1;
+        break;
+      default:
+        if (!own && (kind == EVENT_DST_ON) != (seek->dst == 0)) break;
+        seek->at += seek->dst ? -SECONDS_PER_HOUR : SECONDS_PER_HOUR;
+        seek->steps += seek->dst ? -1 : 1;
+        seek->dst = !seek->dst;
+        seek->switched |= own;
+        break;
+    }
+  }
+}
+
+/* Seconds since 2000 from year (0 = 2000), day of year (1 = Jan 1) and
+ * time of day. */
+int64_t CalendarToSeconds(int YearValue, int DayOfYearValue, int HourValue, int MinuteValue, int SecondValue) {
+  return (int64_t)(DaysBeforeYear(YearValue) + DayOfYearValue - 1) * SECONDS_PER_DAY + HourValue * SECONDS_PER_HOUR +
+         MinuteValue * SECONDS_PER_MINUTE + SecondValue;
+}
+
+void SecondsToCalendar(int64_t Seconds, int *YearValue, int *DayOfYearValue, int *HourValue, int *MinuteValue,
+                       int *SecondValue) {
+  long Days = Seconds / SECONDS_PER_DAY;
+  int TimeOfDay = Seconds % SECONDS_PER_DAY;
+  int YearGuess = Days * 400 / 146097; /* days in 400 years; a year out at most */
+
+  if (DaysBeforeYear(YearGuess) > Days)
+    YearGuess--;
+  else if (DaysBeforeYear(YearGuess + 1) <= Days)
+    YearGuess++;
+
+  *YearValue = YearGuess;
+  *DayOfYearValue = Days - DaysBeforeYear(YearGuess) + 1;
+  *HourValue = TimeOfDay / SECONDS_PER_HOUR;
+  *MinuteValue = TimeOfDay % SECONDS_PER_HOUR / SECONDS_PER_MINUTE;
+  *SecondValue = TimeOfDay % SECONDS_PER_MINUTE;
+}
+
+/* Calc day of year from year month & day */
+/* Year - 0 means 2000, 100 means 2100. */
+/* Month - 1 means January, 12 means December. */
+/* DayOfMonth - 1 is first day of month */
+int ConvertMonthDayToDayOfYear(int YearValue, int MonthValue, int DayOfMonthValue) {
+  int ReturnValue;
+  int LeapYear;
+  int MonthCounter;
+
+  /* Array of days in a month.  Note that here January is zero. */
+  /* NB: have to add 1 to days in February in a leap year! */
+  int DaysInMonth[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+  LeapYear = FALSE;
+  if ((YearValue % 4) == 0) {
+    if ((YearValue % 100) == 0) {
+      if ((YearValue % 400) == 0) {
+        LeapYear = TRUE;
+      }
+    } else {
+      LeapYear = TRUE;
+    }
+  }
+
+  if (Debug)
+    printf("\nConvertMonthDayToDayOfYear(): Year %d %s a leap year.\n", YearValue + 2000, LeapYear ? "is" : "is not");
+
+  /* Day of month given us starts in this algorithm. */
+  ReturnValue = DayOfMonthValue;
+
+  /* Add in days in month for each month past January. */
+  for (MonthCounter = 1; MonthCounter < MonthValue; MonthCounter++) {
+    ReturnValue += DaysInMonth[MonthCounter - 1];
+  }
+
+  /* Add a day for leap years where we are past February. */
+  if ((LeapYear) && (MonthValue > 2)) {
+    ReturnValue++;
+  }
+
+  if (Debug)
+    printf(
+        "\nConvertMonthDayToDayOfYear(): %4.4d-%2.2d-%2.2d represents day %3d "
+        "of year.\n",
+        YearValue + 2000, MonthValue, DayOfMonthValue, ReturnValue);
+
+  return (ReturnValue);
+}
+
+void Help(void) {
+  printf("\n\nTime Code Generation - IRIG-B or WWV, v%d.%d, %s dmw", VERSION, ISSUE, ISSUE_DATE);
+  printf("\n\nRCS Info:");
+  printf(
+      "\n  $Header: /home/dmw/src/IRIG_generation/ntp-4.2.2p3/util/RCS/tg.c,v "
+      "1.28 2007/02/12 23:57:45 dmw Exp $");
+  printf("\n\nUsage: %s [option]*", CommandName);
+  printf(
+      "\n         -a name|N                      Audio device by name or "
+      "number, alsa:pcm for direct ALSA mmap output, or rtp:host:port[:L16|:L24] to stream to a network receiver");
+  printf(
+      "\n         -A cpu[,cpu]                   Pin the generator [and callback or device writer] thread to CPUs");
+  printf(
+      "\n         -b yymmddhhmm                  Remove leap second at end of "
+      "minute specified");
+  printf(
+      "\n         -B manifest                    Batch render the jobs listed, one per line: "
+      "file -y ... -c ... [options]");
+  printf(
+      "\n         -c seconds_to_send             Number of seconds to send "
+      "(default 0 = forever)");
+  printf(
+      "\n         -d                             Start with IEEE 1344 DST "
+      "active");
+  printf(
+      "\n         -C milliseconds                Use callback output, buffering this much "
+      "(default blocking writes)");
+  printf(
+      "\n         -D milliseconds                Latency through the codec "
+      "(default measured)");
+  printf(
+      "\n         -e leap-seconds.list           Insert and delete leap seconds as the list says, "
+      "reloading it when it changes");
+  printf(
+      "\n         -f format_type                 i = Modulated IRIG-B 1998 (no "
+      "year coded)");
+  printf(
+      "\n                                        2 = Modulated IRIG-B 2002 "
+      "(year coded)");
+  printf(
+      "\n                                        3 = Modulated IRIG-B w/IEEE "
+      "1344 (year & control funcs) (default)");
+  printf("\n                                        w = WWV(H)");
+  printf(
+      "\n         -F f32|s32|s24|s16             Sample format (default f32, or the first the device "
+      "takes)");
+  printf(
+      "\n         -g yymmddhhmm                  Switch into/out of DST at "
+      "beginning of minute specified");
+  printf(
+      "\n         -i yymmddhhmm                  Insert leap second at end of "
+      "minute specified");
+  printf(
+      "\n         -j                             Disable rate discipline "
+      "against system clock (default enabled)");
+  printf("\n         -I rate                        IRIG time-base rate A, B (default), E, G or H");
+  printf("\n         -J workers                     Batch worker threads (default one per CPU)");
+  printf(
+      "\n         -k nn                          Force rate correction for "
+      "testing (+1 = add cycle, -1 = remove cycle)");
+  printf("\n         -K                             Lock all memory, with the stack prefaulted");
+  printf(
+      "\n         -l time_offset                 Set offset of time sent to "
+      "UTC as per computer, +/- float hours");
+  printf(
+      "\n         -L file                        Log a compact binary record of each second to a "
+      "file");
+  printf(
+      "\n         -m                             Benchmark: render -c seconds from -y to nowhere, "
+      "printing a \"bench\" line of results");
+  printf(
+      "\n         -M file                        Write timing health metrics to a Prometheus text file "
+      "every second");
+  printf(
+      "\n         -N seconds                     Seconds queued behind the one being written to a blocking device, "
+      "so up to N + 1 rendered ahead (default 2, 0 = none)");
+  printf(
+      "\n         -o time_offset                 Set IEEE 1344 time offset, "
+      "+/-, to 0.5 hour (default 0)");
+  printf(
+      "\n         -O stdout|capture:prefix[:s]   Also send the samples, raw, to stdout or to capture files "
+      "of s seconds (default 3600)");
+  printf(
+      "\n         -P file                        Keep the rate error and latency in file, to start locked "
+      "next time");
+  printf(
+      "\n         -q quality_code_hex            Set IEEE 1344 quality code "
+      "(default 0)");
+  printf("\n         -r rate                        Set sample rate (Hz)");
+  printf(
+      "\n         -R fifo|rr[:priority]          Run the generator under real-time scheduling "
+      "(default priority 50)");
+  printf(
+      "\n         -s                             Set leap warning bit (WWV[H] "
+      "only)");
+  printf(
+      "\n         -S first:total                 Render from second first of a total second batch "
+      "job, in place (-w)");
+  printf(
+      "\n         -t sync_frequency              WWV(H) on-time pulse tone "
+      "frequency (default 1200)");
+  printf(
+      "\n         -u DUT1_offset                 Set WWV(H) DUT1 offset -7 to "
+      "+7 (default 0)");
+  printf(
+      "\n         -U path                        Take leap, dst, quality and offset changes on a Unix "
+      "socket");
+  printf(
+      "\n         -w file                        Render to WAV (.wav) or raw file, or raw to "
+      "stdout (-), as fast as possible");
+  printf(
+      "\n         -x                             Turn off verbose output "
+      "(default on)");
+  printf(
+      "\n         -y yymmddhhmmss                Set initial date and time as "
+      "specified (default system time)");
+  printf(
+      "\n         -Z zone                        Switch DST as the tzdata zone does (with -l its "
+      "offset), reloading it when it changes");
+  printf(
+      "\n\nThis software licenced under the GPL, modifications performed 2006 "
+      "& 2007 by Dean Weiten");
+  printf(
+      "\nContact: Dean Weiten, Norscan Instruments Ltd., Winnipeg, MB, Canada, "
+      "ph (204)-233-9138, E-mail dmw@norscan.com");
+  printf("\n\n");
+}
+
+uint32_t Bcd(int value) {
+  uint32_t bcd = 0;
+
+  for (int shift = 0; value > 0; shift += 4, value /= 10) bcd |= (uint32_t)(value % 10) << shift;
+  return bcd;
+}
+
+/*
+ * Pack the fields of an IRIG second into a frame, by the frame program.
+ */
+void EncodeIrigFrame(struct IrigFrame *frame, const uint32_t *fields) {
+  frame->bits[0] = frame->bits[1] = 0;
+  for (int n = 0; n < IRIG_FRAME_BITS; n++) {
+    const struct IrigBit *bit = &IrigProgram[n];
+
+    if (bit->field >= 0 && ((fields[bit->field] >> bit->bit) & 1)) frame->bits[n / 64] |= 1ULL << (n % 64);
+  }
+}
+
+/*
+ * Encode the frame for a time and control functions, as the IRIG rate in
+ * use sends it, with IEEE 1344 parity if enabled.  Returns the parity.
+ */
+int EncodeIrigTime(struct IrigFrame *frame, int YearValue, int DayOfYearValue, int HourValue, int MinuteValue,
+                   int SecondValue, int Hundredths, int Controls) {
+  uint32_t fields[IRIG_FIELDS];
+
+  fields[IRIG_SECONDS] = Bcd(SecondValue);
+  fields[IRIG_MINUTES] = Bcd(MinuteValue);
+  fields[IRIG_HOURS] = Bcd(HourValue);
+  fields[IRIG_DAYS] = Bcd(DayOfYearValue);
+  fields[IRIG_YEARS] = IrigIncludeYear ? Bcd(YearValue % 100) : 0;
+  fields[IRIG_CONTROL] = Controls;
+  fields[IRIG_SBS] = SecondValue + (MinuteValue * SECONDS_PER_MINUTE) + (HourValue * SECONDS_PER_HOUR);
+
+  if (Irig->subseconds >= 1) fields[IRIG_DAYS] |= (Hundredths / 10) << 12;
+  if (Irig->subseconds >= 2) fields[IRIG_YEARS] = Hundredths % 10;
+  if (Irig->frame_bits == 60) {
+    fields[IRIG_SECONDS] = Bcd(MinuteValue);
+    fields[IRIG_MINUTES] = Bcd(HourValue);
+    fields[IRIG_HOURS] = Bcd(DayOfYearValue % 100);
+    fields[IRIG_DAYS] = Bcd(DayOfYearValue / 100);
+  }
+  EncodeIrigFrame(frame, fields);
+
+  if (!IrigIncludeIeee || !IrigParity(frame)) return 0;
+  frame->bits[IRIG_PARITY_POSITION / 64] |= 1ULL << (IRIG_PARITY_POSITION % 64);
+  return 1;
+}
+
+/*
+ * IEEE 1344 parity: odd if there is an odd number of ones before the
+ * parity bit, in the time, year and the control functions before it.
+ */
+int IrigParity(const struct IrigFrame *frame) {
+  uint64_t before = frame->bits[1] & ((1ULL << (IRIG_PARITY_POSITION - 64)) - 1);
+
+  return (__builtin_popcountll(frame->bits[0]) + __builtin_popcountll(before)) & 1;
+}
+
+/*
+ * All heap allocation goes through here so it can be counted.
+ */
+void *Allocate(size_t bytes, size_t alignment) {
+  void *p = NULL;
+
+  if (posix_memalign(&p, alignment, bytes) != 0) Die("out of memory (%zu bytes)", bytes);
+  AllocationCount++;
+  if (StartupComplete) SteadyStateAllocations++;
+  return p;
+}
+
+/*
+ * Size the render arena from the sample rate and the longest pulse, then
+ * touch every page so none is faulted in while generating.
+ */
+void InitArena(void) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t size = (size_t)OutputFormat->bytes * (MsToSamples(LONGEST_PULSE_MS) + 1) * RENDER_ARENA_PULSES;
+
+  /* The IRIG templates come to 9 symbols, a lot at the slow rates. */
+  if (encode == IRIG) size += OutputFormat->bytes * (SampleRate * 10 * IrigTenthUs * IRIG_SYMBOL_LONG / 1e6);
+
+  size = (size + page - 1) / page * page;
+  RenderArena.base = Allocate(size, page);
+  RenderArena.size = size;
+  RenderArena.used = 0;
+  memset(RenderArena.base, 0, size);
+}
+
+void *ArenaAlloc(size_t bytes) {
+  size_t offset = (RenderArena.used + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
 
-  return dlen + (s - src);
+  if (offset + bytes > RenderArena.size)
+    Die("render arena exhausted (%zu + %zu > %zu bytes)", offset, bytes, RenderArena.size);
+  RenderArena.used = offset + bytes;
+  return RenderArena.base + offset;
 }
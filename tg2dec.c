@@ -0,0 +1,1128 @@
+/*
+ * tg2dec.c decode IRIG-B or WWV/H signals, such as tg2 sends or renders,
+ * to check them without a receiver
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRUE 1
+#define FALSE 0
+
+#define N_ELEMENTS(array) (sizeof(array) / sizeof((array)[0]))
+
+#define BLOCK_SAMPLES (4096) /* samples decoded at a time */
+#define VECTOR_FLOATS (4)    /* floats in a vector, as SSE and NEON registers hold */
+#define MIN_LEVEL (0.02)     /* envelope never taken for a pulse, full scale 1 */
+
+#define WAVE_FORMAT_PCM (1)
+#define WAVE_FORMAT_IEEE_FLOAT (3)
+#define WAVE_FORMAT_EXTENSIBLE (0xFFFE)
+
+#define RTP_PREFIX "rtp:"
+#define RTP_HEADER_BYTES (12)
+#define RTP_MAX_PACKET (2048)
+#define RTP_PAYLOAD_L24 (96)        /* as tg2 maps them */
+#define RTP_PAYLOAD_L16 (97)        /* ... */
+#define RTP_IDLE_MS (1000)          /* silence that ends the stream, once it has started */
+#define RTP_MAX_GAP_SECONDS (10)    /* longest gap in timestamps filled with silence */
+#define RTP_SOCKET_BUFFER (1 << 20) /* packets queued while decoding */
+
+#define IRIG (1) /* IRIG-B decoder */
+#define WWV (0)  /* WWV/H decoder */
+
+#define IRIG_FRAME_BITS (100)
+#define IRIG_MARKER (2)           /* symbol value of a position identifier */
+#define IRIG_PARITY_POSITION (75) /* IEEE 1344 parity of the bits before it */
+
+#define WWV_SECONDS (61)        /* positions in a minute, with a leap second */
+#define WWV_DATA_DELAY_MS (30)  /* tick and guard time before the data pulse */
+#define WWV_MINUTE_MS (400)     /* sync pulses longer than this start a minute */
+#define WWV_SYNC_MS (800)       /* ... which are this long */
+#define WWV_TICK_MIN_MS (2)     /* ticks are 5 ms; shorter sync pulses are other tones leaking in */
+#define WWV_TICK_MAX_MS (20)    /* ... and longer ones aren't ticks either */
+#define WWV_DATA_WINDOW_MS (10) /* a whole number of cycles of every tone sent */
+#define WWV_PI (2)              /* symbol value of a position identifier */
+#define WWV_HOUR_TONE (1500)    /* hour on-time frequency */
+
+typedef float FloatVector __attribute__((vector_size(VECTOR_FLOATS * sizeof(float))));
+typedef int32_t MaskVector __attribute__((vector_size(VECTOR_FLOATS * sizeof(int32_t))));
+
+/*
+ * A tone detector: a one bin sliding DFT, a Goertzel filter over a moving
+ * window of a whole number of cycles (or as near as the sample rate
+ * allows), moving-averaged again over the same window.  One window alone
+ * has a step response rippling at twice the tone, flat at just the
+ * halfway point when the pulse starts at a zero crossing as tg2's do; the
+ * second cancels the ripple.  An edge is then where the output, projected
+ * on the phase of the pulse, crosses halfway between the pulse and gap
+ * levels, interpolated between samples, less a window; the threshold is
+ * only known to be halfway once the pulse has ended, so edges are passed
+ * on then, allowing for where it was.  Each pulse is passed on with its
+ * start and length in samples from the start of the input.
+ */
+struct Detector {
+  int freq;                                         /* tone (Hz) */
+  int window;                                       /* samples in the DFT window */
+  int period;                                       /* samples before the reference repeats */
+  int phase;                                        /* reference sample of the next input sample */
+  float *cosine, *sine;                             /* reference, period + BLOCK_SAMPLES long */
+  float *mixed_i, *mixed_q;                         /* window of history, then the block, mixed to DC */
+  float *bin_i, *bin_q;                             /* ... and the sliding DFT of that */
+  float *out_i, *out_q;                             /* its moving sum, for the block */
+  float *power;                                     /* ... squared */
+  double sum_i, sum_q, sum2_i, sum2_q;              /* sliding DFT and moving sum at the end of the last block */
+  double peak, floor;                               /* envelope levels of pulses and gaps */
+  float top, bottom;                                /* highest power of this pulse, lowest of this gap */
+  double pulse_i, pulse_q;                          /* phase of the last pulse, unit length */
+  float last_i, last_q;                             /* output of the sample before the block */
+  int high;                                         /* in a pulse at the end of the last block */
+  double rise, fall;                                /* last threshold crossings (samples), NAN if none */
+  double seeded;                                    /* sample the levels were first taken at */
+  double rise_threshold, rise_floor;                /* ... the threshold and gap level at the rise */
+  void (*pulse)(struct Detector *, double, double); /* pulse start and length (samples), start NAN if unknown */
+};
+
+/*
+ * Input, a WAV (or RF64) file of PCM or float samples, or raw floats.
+ */
+struct Input {
+  FILE *fp;
+  int rtp;                 /* UDP socket for RTP input, -1 for a file */
+  int format;              /* WAVE_FORMAT_PCM or WAVE_FORMAT_IEEE_FLOAT */
+  int bytes;               /* per sample */
+  int channels;            /* interleaved */
+  uint64_t remaining;      /* bytes of samples left, UINT64_MAX to the end of file */
+  unsigned char pushed[4]; /* read while looking for a WAV header */
+  int n_pushed;
+};
+
+/*
+ * RTP input, as tg2 -a rtp: sends it: mono L24 or L16, a packet a
+ * millisecond, timestamped by the media clock, which tg2 takes from the
+ * system clock.  Lost packets are replaced by silence, and late ones
+ * dropped, so samples keep their place by timestamp; the first is placed
+ * against the system clock here, so on the same host (or with clocks
+ * synchronized) the on-time error is measured against the media clock.
+ * The kernel timestamps each packet as it arrives, for the interarrival
+ * jitter of RFC 3550 and the spread of transit times: how evenly the
+ * packets were paced.
+ */
+struct RtpInput {
+  int payload_type;                /* of the stream, from its first packet */
+  int bytes;                       /* per sample */
+  int started;                     /* a packet has arrived */
+  uint16_t sequence;               /* next expected */
+  uint32_t timestamp;              /* ... and its timestamp */
+  uint64_t media;                  /* ... and its media clock, unwrapped */
+  unsigned char packet[RTP_MAX_PACKET];
+  const unsigned char *payload;    /* samples of the last packet not yet read */
+  int samples;                     /* ... how many */
+  long gap;                        /* samples of silence still to read for lost packets */
+  long packets, lost, late, bad;   /* received, missing, out of order, not the stream's */
+  double transit, jitter;          /* last transit (s), RFC 3550 jitter (s) */
+  double jitter_max;               /* s, highest the jitter reached */
+  double transit_min, transit_max; /* s, arrival less media time */
+};
+
+/*
+ * On-time error statistics.
+ */
+struct OnTimeErrors {
+  long count;
+  double sum, sum_squares, max;
+};
+
+/*
+ * Function prototypes
+ */
+void Die(const char *, ...);                 /* Print a message and exit */
+void Help(void);                             /* Usage message */
+float *AllocateFloats(size_t);               /* Allocate n floats, zeroed and aligned */
+void OpenInput(const char *);                /* Open a file or stdin, and read any WAV header */
+int ReadSamples(float *, int);               /* Read a channel of the input as floats */
+void OpenRtpInput(const char *);             /* Listen for an RTP stream */
+int ReadRtpSamples(float *, int);            /* Read samples from the stream, in timestamp order */
+int ReceiveRtpPacket(void);                  /* Wait for the next packet, FALSE at the end of the stream */
+void InitDetector(struct Detector *, int, int, void (*)(struct Detector *, double, double));
+void RunDetector(struct Detector *, const float *, int, uint64_t); /* Find the pulses in a block */
+double OnTimeError(double);                  /* Error (s) of an edge from the nearest second */
+void IrigPulse(struct Detector *, double, double);
+void DecodeIrigFrame(void);                  /* Decode, check and print a whole IRIG-B frame */
+void WwvSyncPulse(struct Detector *, double, double);
+void WwvHourPulse(struct Detector *, double, double);
+void WwvDataPulse(struct Detector *, double, double);
+void StartWwvMinute(double, int);            /* Start a minute at a sync pulse */
+void FindWwvMinute(double);                  /* Place a tick before the first sync pulse */
+void DecodeWwvMinute(int);                   /* Decode, check and print a WWV/H minute */
+void ClearWwvMinute(void);                   /* Forget the minute being received */
+
+/*
+ * Global variables
+ */
+struct Input Input;
+struct RtpInput Rtp;
+double InputPhase = 0; /* samples from a whole second to the start of the input */
+int SampleRate;                     /* Hz */
+int Channel = 0;                    /* channel decoded */
+int decode = IRIG;                  /* IRIG or WWV */
+int IrigIeee = TRUE;                /* control functions are IEEE 1344 */
+int tone = 1000;                    /* WWV sync frequency */
+int Quiet = FALSE;                  /* only print the summary */
+double MaxJitter = INFINITY;        /* s, RTP jitter peak above which the stream fails */
+struct OnTimeErrors Errors;
+long FramesDecoded, BadFrames;
+
+int LastSymbol = -1;           /* IRIG: the symbol before, to find Pr after P0 */
+int FramePosition = -1;        /* ... position of the next symbol, -1 = waiting for a frame */
+double FrameStart, LastRise;   /* ... on-time edge of the frame and start of the last symbol */
+uint64_t FrameBits[2];         /* ... ones received, bit n in FrameBits[n / 64] */
+uint64_t FrameMarkers[2];      /* ... and position identifiers */
+double MinuteStart = NAN;      /* WWV: on-time edge of the minute being received, NAN = none */
+int MinuteHour;                /* ... which was an hour */
+int WwvSymbols[WWV_SECONDS];   /* ... 0, 1 or WWV_PI by second, -1 = none */
+double WwvTicks[WWV_SECONDS];  /* ... edge of each tick (samples), NAN = none */
+double FirstTick = NAN;        /* ... before the first minute is found, the second the arrays start at */
+double LastTick = NAN;         /* ... and the last tick */
+int MinuteFromGap;             /* ... minute found from the missing tick at 29, not a sync pulse */
+
+void Die(const char *fmt, ...) {
+  va_list vargs;
+  va_start(vargs, fmt);
+  vfprintf(stderr, fmt, vargs);
+  va_end(vargs);
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
+static inline FloatVector LoadVector(const float *p) {
+  FloatVector v;
+  memcpy(&v, p, sizeof v);
+  return v;
+}
+
+static inline void StoreVector(float *p, FloatVector v) { memcpy(p, &v, sizeof v); }
+
+static inline int AnyLane(MaskVector m) {
+  uint64_t lanes[sizeof m / sizeof(uint64_t)];
+  uint64_t any = 0;
+
+  memcpy(lanes, &m, sizeof m);
+  for (size_t i = 0; i < N_ELEMENTS(lanes); i++) any |= lanes[i];
+  return any != 0;
+}
+
+static inline FloatVector Select(MaskVector m, FloatVector a, FloatVector b) {
+  return (FloatVector)(((MaskVector)a & m) | ((MaskVector)b & ~m));
+}
+
+static double Now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Main program
+ */
+int main(int argc, char **argv) {
+  int temp;
+  char FormatCharacter = '3';
+  const char *path = "-";
+  struct Detector Detectors[3];
+  int n_detectors = 0;
+  float *block;
+  uint64_t SamplesRead = 0;
+  double elapsed = 0;
+
+  while ((temp = getopt(argc, argv, "C:f:hJ:qr:t?")) != -1) {
+    switch (temp) {
+      case 'C': /* Channel to decode */
+        sscanf(optarg, "%d", &Channel);
+        break;
+
+      case 'f': /* Format, as tg2 -f */
+        sscanf(optarg, "%c", &FormatCharacter);
+        break;
+
+      case 'J': /* Highest RTP jitter allowed, us */
+        if (sscanf(optarg, "%lf", &MaxJitter) != 1 || MaxJitter < 0) Die("Bad jitter limit \"%s\"", optarg);
+        MaxJitter *= 1e-6;
+        break;
+
+      case 'q': /* Summary only */
+        Quiet = TRUE;
+        break;
+
+      case 'r': /* Sample rate of raw input */
+        sscanf(optarg, "%d", &SampleRate);
+        break;
+
+      case 't': /* WWVH sync frequency */
+        tone = 1200;
+        break;
+
+      case 'h':
+      case '?':
+        Help();
+        exit(-1);
+    }
+  }
+  if (optind < argc) path = argv[optind];
+
+  switch (FormatCharacter) {
+    case 'i':
+    case '2':
+      decode = IRIG;
+      IrigIeee = FALSE;
+      break;
+
+    case '3':
+      decode = IRIG;
+      IrigIeee = TRUE;
+      break;
+
+    case 'w':
+      decode = WWV;
+      break;
+
+    default:
+      Die("Unexpected format value of '%c'", FormatCharacter);
+  }
+
+  OpenInput(path);
+  if (SampleRate <= 0) Die("A raw input needs its sample rate (-r).");
+  if (Channel < 0 || Channel >= Input.channels) Die("No channel %d in %d", Channel, Input.channels);
+
+  if (decode == IRIG) {
+    InitDetector(&Detectors[n_detectors++], 1000, lround(SampleRate / 1000.), IrigPulse);
+  } else {
+    int window = lround(SampleRate * WWV_DATA_WINDOW_MS / 1000.);
+
+    ClearWwvMinute();
+    InitDetector(&Detectors[n_detectors++], tone, lround((double)SampleRate / tone), WwvSyncPulse);
+    InitDetector(&Detectors[n_detectors++], WWV_HOUR_TONE, window, WwvHourPulse);
+    InitDetector(&Detectors[n_detectors++], 100, window, WwvDataPulse);
+  }
+  for (int i = 0; i < n_detectors; i++) {
+    if (2 * Detectors[i].freq >= SampleRate) Die("%d Hz tone needs a sample rate above %d Hz", Detectors[i].freq,
+                                                 2 * Detectors[i].freq);
+  }
+
+  block = AllocateFloats(BLOCK_SAMPLES);
+
+  for (;;) {
+    int n = ReadSamples(block, BLOCK_SAMPLES);
+    if (n == 0) break;
+
+    double start = Now();
+    int padded = (n + VECTOR_FLOATS - 1) / VECTOR_FLOATS * VECTOR_FLOATS;
+
+    memset(block + n, 0, sizeof(float) * (padded - n));
+    for (int i = 0; i < n_detectors; i++) RunDetector(&Detectors[i], block, padded, SamplesRead);
+    SamplesRead += n;
+    elapsed += Now() - start;
+  }
+  if (decode == WWV) DecodeWwvMinute(TRUE);
+
+  printf(">> Decoded %ld %s, %ld bad.\n", FramesDecoded, decode == IRIG ? "frames" : "minutes", BadFrames);
+  if (Errors.count > 0) {
+    double mean = Errors.sum / Errors.count;
+
+    printf(">> On-time error of %ld markers: mean %+.2f us, rms %.2f us, max %.2f us.\n", Errors.count, 1e6 * mean,
+           1e6 * sqrt(Errors.sum_squares / Errors.count), 1e6 * Errors.max);
+  }
+  printf(">> Decoded %llu samples in %.3f s: %.0f samples/s, %.0fx realtime.\n", (unsigned long long)SamplesRead,
+         elapsed, SamplesRead / elapsed, SamplesRead / elapsed / SampleRate);
+  if (Input.rtp >= 0) {
+    printf(">> RTP: %ld packets, %ld lost, %ld late, %ld not of the stream.\n", Rtp.packets, Rtp.lost, Rtp.late,
+           Rtp.bad);
+    if (Rtp.packets > 0)
+      printf(">> RTP pacing: jitter %.1f us (RFC 3550, peak %.1f us), transit %.3f to %.3f ms.\n", 1e6 * Rtp.jitter,
+             1e6 * Rtp.jitter_max, 1e3 * Rtp.transit_min, 1e3 * Rtp.transit_max);
+  }
+
+  return BadFrames ? 2 : (Rtp.lost || Rtp.late || Rtp.jitter_max > MaxJitter) ? 3 : 0;
+}
+
+/*
+ * Input
+ */
+static uint32_t GetLe(const unsigned char *p, int bytes) {
+  uint32_t value = 0;
+
+  for (int i = bytes - 1; i >= 0; i--) value = (value << 8) | p[i];
+  return value;
+}
+
+static int ReadBytes(void *buffer, size_t bytes) {
+  unsigned char *p = buffer;
+  size_t n = 0;
+
+  for (; n < bytes && Input.n_pushed > 0; n++) {
+    *p++ = Input.pushed[0];
+    memmove(Input.pushed, Input.pushed + 1, --Input.n_pushed);
+  }
+  return n + fread(p, 1, bytes - n, Input.fp) == bytes;
+}
+
+static void SkipBytes(uint64_t bytes) {
+  unsigned char scratch[4096];
+
+  while (bytes > 0) {
+    size_t n = bytes < sizeof scratch ? bytes : sizeof scratch;
+    if (!ReadBytes(scratch, n)) Die("WAV file ends in a chunk header");
+    bytes -= n;
+  }
+}
+
+/*
+ * Open the input: a file, or stdin for "-".  If it starts with a WAV
+ * header, that gives the sample format and rate; otherwise it is raw
+ * floats, one channel, at the rate given.  Reads sequentially, so a
+ * stream from tg2 -w - can be decoded as it is rendered.
+ */
+void OpenInput(const char *path) {
+  unsigned char header[40];
+  uint64_t ds64_data = UINT64_MAX;
+
+  Input.rtp = -1;
+  if (strncmp(path, RTP_PREFIX, strlen(RTP_PREFIX)) == 0) {
+    OpenRtpInput(path + strlen(RTP_PREFIX));
+    return;
+  }
+  Input.fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+  if (Input.fp == NULL) Die("can't open %s: %s", path, strerror(errno));
+  Input.format = WAVE_FORMAT_IEEE_FLOAT;
+  Input.bytes = sizeof(float);
+  Input.channels = 1;
+  Input.remaining = UINT64_MAX;
+
+  if (!ReadBytes(header, 4)) Die("%s is empty", path);
+  if (memcmp(header, "RIFF", 4) != 0 && memcmp(header, "RF64", 4) != 0) {
+    memcpy(Input.pushed, header, 4);
+    Input.n_pushed = 4;
+    return;
+  }
+
+  if (!ReadBytes(header, 8) || memcmp(header + 4, "WAVE", 4) != 0) Die("%s is not a WAV file", path);
+  for (;;) {
+    uint32_t size;
+
+    if (!ReadBytes(header, 8)) Die("no data in %s", path);
+    size = GetLe(header + 4, 4);
+
+    if (memcmp(header, "ds64", 4) == 0 && size >= 28) {
+      if (!ReadBytes(header, 28)) Die("short ds64 chunk in %s", path);
+      ds64_data = GetLe(header + 8, 4) | (uint64_t)GetLe(header + 12, 4) << 32;
+      SkipBytes(size - 28 + (size & 1));
+    } else if (memcmp(header, "fmt ", 4) == 0 && size >= 16) {
+      size_t n = size < sizeof header ? size : sizeof header;
+
+      if (!ReadBytes(header, n)) Die("short fmt chunk in %s", path);
+      Input.format = GetLe(header, 2);
+      Input.channels = GetLe(header + 2, 2);
+      SampleRate = GetLe(header + 4, 4);
+      Input.bytes = GetLe(header + 14, 2) / 8;
+      if (Input.format == WAVE_FORMAT_EXTENSIBLE && n >= 26) Input.format = GetLe(header + 24, 2);
+      SkipBytes(size - n + (size & 1));
+    } else if (memcmp(header, "data", 4) == 0) {
+      Input.remaining = (size == 0xFFFFFFFF) ? ds64_data : size;
+      break;
+    } else {
+      SkipBytes(size + (size & 1));
+    }
+  }
+
+  if (!((Input.format == WAVE_FORMAT_PCM && Input.bytes >= 2 && Input.bytes <= 4) ||
+        (Input.format == WAVE_FORMAT_IEEE_FLOAT && Input.bytes == sizeof(float))))
+    Die("can't decode WAV format %d with %d bit samples", Input.format, 8 * Input.bytes);
+  if (Input.channels < 1) Die("no channels in %s", path);
+}
+
+/*
+ * Read up to n samples of the channel being decoded, as floats full scale
+ * 1.  Returns the number read, 0 at the end of the input.
+ */
+int ReadSamples(float *samples, int n) {
+  static unsigned char *raw;
+  size_t frame = (size_t)Input.bytes * Input.channels;
+  size_t bytes = frame * n;
+  size_t got;
+
+  if (Input.rtp >= 0) return ReadRtpSamples(samples, n);
+  if (raw == NULL && (raw = malloc(frame * BLOCK_SAMPLES)) == NULL) Die("out of memory");
+  if (bytes > Input.remaining) bytes = Input.remaining / frame * frame;
+
+  for (got = 0; Input.n_pushed > 0 && got < bytes; got++) {
+    raw[got] = Input.pushed[0];
+    memmove(Input.pushed, Input.pushed + 1, --Input.n_pushed);
+  }
+  got += fread(raw + got, 1, bytes - got, Input.fp);
+  if (Input.remaining != UINT64_MAX) Input.remaining -= got;
+  n = got / frame;
+
+  const unsigned char *p = raw + (size_t)Input.bytes * Channel;
+  if (Input.format == WAVE_FORMAT_IEEE_FLOAT) {
+    for (int i = 0; i < n; i++, p += frame) memcpy(&samples[i], p, sizeof(float));
+  } else {
+    double scale = ldexp(1, -(8 * Input.bytes - 1));
+    int shift = 32 - 8 * Input.bytes;
+
+    for (int i = 0; i < n; i++, p += frame)
+      samples[i] = (float)(((int32_t)(GetLe(p, Input.bytes) << shift) >> shift) * scale);
+  }
+  return n;
+}
+
+/*
+ * Bind to a port, [address:]port, joining the group if the address is
+ * multicast.  Samples are placed from the first packet, so the stream
+ * needs no other setup.
+ */
+void OpenRtpInput(const char *name) {
+  struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_DGRAM, .ai_flags = AI_PASSIVE}, *address;
+  char *host = strdup(name);
+  char *port = strrchr(host, ':');
+  int on = 1, size = RTP_SOCKET_BUFFER, err;
+
+  if (port != NULL)
+    *port++ = '\0';
+  else
+    port = host, host = NULL;
+  if ((err = getaddrinfo(host, port, &hints, &address)) != 0) Die("Can't resolve %s: %s", name, gai_strerror(err));
+
+  Input.rtp = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+  if (Input.rtp < 0) Die("Can't open a socket: %s", strerror(errno));
+  setsockopt(Input.rtp, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  setsockopt(Input.rtp, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  if (setsockopt(Input.rtp, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0)
+    Die("Can't timestamp packets: %s", strerror(errno));
+  if (bind(Input.rtp, address->ai_addr, address->ai_addrlen) < 0) Die("Can't listen on %s: %s", name, strerror(errno));
+
+  struct in_addr group = ((struct sockaddr_in *)address->ai_addr)->sin_addr;
+  if (IN_MULTICAST(ntohl(group.s_addr))) {
+    struct ip_mreq request = {.imr_multiaddr = group, .imr_interface = {htonl(INADDR_ANY)}};
+
+    if (setsockopt(Input.rtp, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request, sizeof(request)) < 0)
+      Die("Can't join %s: %s", host, strerror(errno));
+  }
+  freeaddrinfo(address);
+  Input.channels = 1;
+  Input.format = WAVE_FORMAT_PCM;
+}
+
+/*
+ * Fill the block from the stream, with silence for lost packets.  Only
+ * returns short at the end, as the detectors take a short block to be
+ * the last.
+ */
+int ReadRtpSamples(float *samples, int n) {
+  int got = 0;
+
+  while (got < n) {
+    if (Rtp.gap > 0) {
+      int k = (Rtp.gap < n - got) ? Rtp.gap : n - got;
+
+      memset(samples + got, 0, sizeof(float) * k);
+      Rtp.gap -= k;
+      got += k;
+    } else if (Rtp.samples > 0) {
+      int k = (Rtp.samples < n - got) ? Rtp.samples : n - got;
+      double scale = ldexp(1, -(8 * Rtp.bytes - 1));
+      int shift = 32 - 8 * Rtp.bytes;
+
+      for (int i = 0; i < k; i++, Rtp.payload += Rtp.bytes) {
+        uint32_t value = 0;
+
+        for (int b = 0; b < Rtp.bytes; b++) value = (value << 8) | Rtp.payload[b];
+        samples[got + i] = (float)(((int32_t)(value << shift) >> shift) * scale);
+      }
+      Rtp.samples -= k;
+      got += k;
+    } else if (!ReceiveRtpPacket()) {
+      break;
+    }
+  }
+  return got;
+}
+
+/*
+ * Take the next packet of the stream, checking its sequence number and
+ * timestamp against the last, and its arrival against its media time.
+ * Waits for the first for as long as it takes, then RTP_IDLE_MS.
+ */
+int ReceiveRtpPacket(void) {
+  struct pollfd poller = {.fd = Input.rtp, .events = POLLIN};
+  char control[CMSG_SPACE(sizeof(struct timespec))];
+  struct iovec iov = {Rtp.packet, sizeof(Rtp.packet)};
+  struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control)};
+  struct timespec arrival;
+  ssize_t length;
+
+  int ready = poll(&poller, 1, Rtp.started ? RTP_IDLE_MS : -1);
+  if (ready < 0 && errno == EINTR) return TRUE;
+  if (ready < 0) Die("RTP input failed: %s", strerror(errno));
+  if (ready == 0) return FALSE;
+  if ((length = recvmsg(Input.rtp, &message, 0)) < 0) Die("RTP input failed: %s", strerror(errno));
+
+  clock_gettime(CLOCK_REALTIME, &arrival);
+  for (struct cmsghdr *c = CMSG_FIRSTHDR(&message); c != NULL; c = CMSG_NXTHDR(&message, c))
+    if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) memcpy(&arrival, CMSG_DATA(c), sizeof(arrival));
+
+  const unsigned char *p = Rtp.packet;
+  int header = RTP_HEADER_BYTES + 4 * (p[0] & 0x0F);
+  if (length >= header + 4 && (p[0] & 0x10)) header += 4 + 4 * (p[header + 2] << 8 | p[header + 3]);
+  if (length > header && (p[0] & 0x20)) length -= p[length - 1]; /* padding */
+  if (length < header || (p[0] >> 6) != 2 || (Rtp.started && (p[1] & 0x7F) != Rtp.payload_type) ||
+      ((p[1] & 0x7F) != RTP_PAYLOAD_L24 && (p[1] & 0x7F) != RTP_PAYLOAD_L16)) {
+    Rtp.bad++;
+    return TRUE;
+  }
+
+  uint16_t sequence = p[2] << 8 | p[3];
+  uint32_t timestamp = (uint32_t)p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7];
+  uint64_t rate = SampleRate;
+
+  if (!Rtp.started) {
+    /* The media clock value nearest now with these low 32 bits. */
+    uint64_t now = (uint64_t)arrival.tv_sec * rate + (uint64_t)arrival.tv_nsec * rate / 1000000000;
+    uint64_t media = now - (uint32_t)((uint32_t)now - timestamp);
+
+    if ((uint32_t)((uint32_t)now - timestamp) >= 1U << 31) media += 1ULL << 32;
+    InputPhase = media % rate;
+    Rtp.media = media;
+    Rtp.started = TRUE;
+    Rtp.payload_type = p[1] & 0x7F;
+    Rtp.bytes = Rtp.payload_type == RTP_PAYLOAD_L24 ? 3 : 2;
+    Rtp.transit_min = INFINITY;
+    Rtp.transit_max = -INFINITY;
+    Rtp.transit = NAN;
+    Rtp.sequence = sequence;
+    Rtp.timestamp = timestamp;
+  }
+
+  int16_t skipped = sequence - Rtp.sequence;
+  int32_t early = timestamp - Rtp.timestamp;
+  if (skipped < 0 || early < 0) {
+    Rtp.late++;
+    return TRUE;
+  }
+  if (early > RTP_MAX_GAP_SECONDS * SampleRate) Die("RTP timestamps jumped %d samples", early);
+  Rtp.lost += skipped;
+  Rtp.gap = early;
+  Rtp.packets++;
+  Rtp.payload = p + header;
+  Rtp.samples = (length - header) / Rtp.bytes;
+  Rtp.sequence = sequence + 1;
+  Rtp.timestamp = timestamp + Rtp.samples;
+
+  uint64_t media = Rtp.media + early;
+  double transit = (arrival.tv_sec - (double)(media / rate)) + arrival.tv_nsec * 1e-9 - (double)(media % rate) / rate;
+  Rtp.media = media + Rtp.samples;
+  if (!isnan(Rtp.transit)) Rtp.jitter += (fabs(transit - Rtp.transit) - Rtp.jitter) / 16;
+  if (Rtp.jitter > Rtp.jitter_max) Rtp.jitter_max = Rtp.jitter;
+  Rtp.transit = transit;
+  if (transit < Rtp.transit_min) Rtp.transit_min = transit;
+  if (transit > Rtp.transit_max) Rtp.transit_max = transit;
+  return TRUE;
+}
+
+/*
+ * Tone detection
+ */
+static int Gcd(int a, int b) { return b == 0 ? a : Gcd(b, a % b); }
+
+/* Zeroed, and aligned for vectors. */
+float *AllocateFloats(size_t n) {
+  void *p = NULL;
+
+  if (posix_memalign(&p, 64, sizeof(float) * n) != 0) Die("out of memory");
+  return memset(p, 0, sizeof(float) * n);
+}
+
+void InitDetector(struct Detector *d, int freq, int window, void (*pulse)(struct Detector *, double, double)) {
+  memset(d, 0, sizeof *d);
+  d->freq = freq;
+  d->window = window;
+  d->period = SampleRate / Gcd(SampleRate, freq);
+  d->pulse = pulse;
+  d->peak = -1;
+
+  d->cosine = AllocateFloats(d->period + BLOCK_SAMPLES);
+  d->sine = AllocateFloats(d->period + BLOCK_SAMPLES);
+  d->mixed_i = AllocateFloats(window + BLOCK_SAMPLES);
+  d->mixed_q = AllocateFloats(window + BLOCK_SAMPLES);
+  d->bin_i = AllocateFloats(window + BLOCK_SAMPLES);
+  d->bin_q = AllocateFloats(window + BLOCK_SAMPLES);
+  d->out_i = AllocateFloats(BLOCK_SAMPLES);
+  d->out_q = AllocateFloats(BLOCK_SAMPLES);
+  d->power = AllocateFloats(BLOCK_SAMPLES);
+
+  /* Long enough that a block never wraps, so it can be read in vectors. */
+  for (int i = 0; i < d->period + BLOCK_SAMPLES; i++) {
+    double angle = 2 * M_PI * ((int64_t)freq * i % SampleRate) / SampleRate;
+
+    d->cosine[i] = cos(angle);
+    d->sine[i] = -sin(angle);
+  }
+}
+
+/*
+ * Move a level to a new pulse or gap level: straight away if further
+ * from the threshold (direction 1 for pulses, -1 for gaps), otherwise an
+ * eighth of the way, so one weaker pulse of some other tone leaking in
+ * barely moves it.
+ */
+static double FollowLevel(double level, double measured, int direction) {
+  if ((measured - level) * direction > 0) return measured;
+  return level + (measured - level) / 8;
+}
+
+/*
+ * The edge that the output crossed a threshold a fraction of the way
+ * from the gap level to the pulse level for, a fraction 1 - that for a
+ * falling edge.  The step response of the two moving sums is a pair of
+ * parabolas, reaching halfway a window after the edge.
+ */
+static double EdgeFromCrossing(double crossing, double fraction, int window) {
+  double delay;
+
+  fraction = fmin(fmax(fraction, 0), 1);
+  if (fraction <= 0.5)
+    delay = window * sqrt(2 * fraction);
+  else
+    delay = window * (2 - sqrt(2 * (1 - fraction)));
+  return crossing + 1 - delay;
+}
+
+/*
+ * Run a block of n samples, a multiple of VECTOR_FLOATS, the first of
+ * which is sample first of the input, through a detector.  Mixing, power,
+ * the level trackers and the threshold scan work a vector at a time; the
+ * scan only looks at single samples in the few vectors with an edge.
+ */
+void RunDetector(struct Detector *d, const float *samples, int n, uint64_t first) {
+  int window = d->window;
+  float *mixed_i = d->mixed_i + window, *mixed_q = d->mixed_q + window;
+  float *bin_i = d->bin_i + window, *bin_q = d->bin_q + window;
+  const float *cosine = d->cosine + d->phase, *sine = d->sine + d->phase;
+  double sum_i = d->sum_i, sum_q = d->sum_q, sum2_i = d->sum2_i, sum2_q = d->sum2_q;
+  double scale = 2.0 / ((double)window * window); /* output to amplitude */
+
+  for (int i = 0; i < n; i += VECTOR_FLOATS) {
+    FloatVector x = LoadVector(samples + i);
+    StoreVector(mixed_i + i, x * LoadVector(cosine + i));
+    StoreVector(mixed_q + i, x * LoadVector(sine + i));
+  }
+
+  /* The moving sums are running ones, in double so they can't drift. */
+  for (int i = 0; i < n; i++) {
+    sum_i += (double)mixed_i[i] - mixed_i[i - window];
+    sum_q += (double)mixed_q[i] - mixed_q[i - window];
+    bin_i[i] = sum_i, bin_q[i] = sum_q;
+    sum2_i += (double)bin_i[i] - bin_i[i - window];
+    sum2_q += (double)bin_q[i] - bin_q[i - window];
+    d->out_i[i] = sum2_i, d->out_q[i] = sum2_q;
+  }
+  d->sum_i = sum_i, d->sum_q = sum_q, d->sum2_i = sum2_i, d->sum2_q = sum2_q;
+  d->phase = (d->phase + n) % d->period;
+  memmove(d->mixed_i, d->mixed_i + n, sizeof(float) * window);
+  memmove(d->mixed_q, d->mixed_q + n, sizeof(float) * window);
+  memmove(d->bin_i, d->bin_i + n, sizeof(float) * window);
+  memmove(d->bin_q, d->bin_q + n, sizeof(float) * window);
+
+  for (int i = 0; i < n; i += VECTOR_FLOATS) {
+    FloatVector out_i = LoadVector(d->out_i + i), out_q = LoadVector(d->out_q + i);
+    StoreVector(d->power + i, out_i * out_i + out_q * out_q);
+  }
+
+  /* Start with the levels of the first block with any signal and an
+   * edge in it, after the windows have filled; before that the input looks
+   * like a gap.  (Silence alone would put the threshold under the gap
+   * level, and a block all pulse would put it on the pulse.)  A pulse
+   * already under way is passed on at its fall with an unknown start, and
+   * its length from here. */
+  int start = 0;
+  if (d->peak < 0) {
+    start = (2 * window + VECTOR_FLOATS - 1) / VECTOR_FLOATS * VECTOR_FLOATS;
+    if (start >= n) return;
+
+    FloatVector top = LoadVector(d->power + start), bottom = top;
+    for (int i = start + VECTOR_FLOATS; i < n; i += VECTOR_FLOATS) {
+      FloatVector v = LoadVector(d->power + i);
+      top = Select(v > top, v, top);
+      bottom = Select(v < bottom, v, bottom);
+    }
+    d->top = top[0], d->bottom = bottom[0];
+    for (int i = 1; i < VECTOR_FLOATS; i++) d->top = fmaxf(d->top, top[i]), d->bottom = fminf(d->bottom, bottom[i]);
+    if (scale * sqrt(d->top) < MIN_LEVEL || d->top < 4 * d->bottom) return;
+    d->peak = scale * sqrt(d->top);
+    d->floor = scale * sqrt(d->bottom);
+    d->high = d->power[start] > (d->top + d->bottom) / 2;
+    d->rise = NAN;
+    d->fall = d->seeded = first + start;
+    d->rise_floor = d->floor;
+  }
+
+  /*
+   * Scan for edges.  The pulse and gap levels are those of the last pulse
+   * and gap long enough to reach them, to keep the threshold halfway, as
+   * the edges are most exact there; the highest and lowest power of the
+   * pulse or gap so far are followed a vector at a time.
+   */
+  double threshold = fmax((d->peak + d->floor) / 2, MIN_LEVEL);
+  float limit = (threshold / scale) * (threshold / scale);
+  MaskVector state = (MaskVector){0} - d->high;
+  FloatVector top = (FloatVector){0} + d->top, bottom = (FloatVector){0} + d->bottom;
+
+  for (int i = start; i < n; i += VECTOR_FLOATS) {
+    FloatVector v = LoadVector(d->power + i);
+
+    if (!AnyLane((v > limit) ^ state)) {
+      if (d->high)
+        top = Select(v > top, v, top);
+      else
+        bottom = Select(v < bottom, v, bottom);
+      continue;
+    }
+
+    for (int k = 0; k < VECTOR_FLOATS; k++) d->top = fmaxf(d->top, top[k]), d->bottom = fminf(d->bottom, bottom[k]);
+    for (int j = i; j < i + VECTOR_FLOATS; j++) {
+      int high = d->power[j] > limit;
+      if (high == d->high) {
+        if (high)
+          d->top = fmaxf(d->top, d->power[j]);
+        else
+          d->bottom = fminf(d->bottom, d->power[j]);
+        continue;
+      }
+
+      /* Take the phase from the top of the pulse, a window after it
+       * rises or before it falls, or if that isn't in the block from the
+       * last pulse, and interpolate the output along it. */
+      int middle = high ? j + window : j - window;
+      if (middle >= 0 && middle < n && d->power[middle] > limit) {
+        double length = sqrt(d->power[middle]);
+        d->pulse_i = d->out_i[middle] / length, d->pulse_q = d->out_q[middle] / length;
+      }
+      double before_i = (j > 0) ? d->out_i[j - 1] : d->last_i, before_q = (j > 0) ? d->out_q[j - 1] : d->last_q;
+      double before = scale * (before_i * d->pulse_i + before_q * d->pulse_q);
+      double after = scale * (d->out_i[j] * d->pulse_i + d->out_q[j] * d->pulse_q);
+
+      /* ... unless that was some other pulse. */
+      if (after < 0.9 * scale * sqrt(d->power[j])) {
+        before = scale * hypot(before_i, before_q);
+        after = scale * sqrt(d->power[j]);
+      }
+      double crossing = first + j - 1 + (threshold - before) / (after - before);
+
+      if (high) {
+        if (crossing - d->fall >= 2 * window) d->floor = FollowLevel(d->floor, scale * sqrt(d->bottom), -1);
+        d->rise = crossing;
+        d->rise_threshold = threshold;
+        d->rise_floor = d->floor;
+        d->top = d->power[j];
+      } else {
+        if (crossing - d->rise >= 2 * window) d->peak = FollowLevel(d->peak, scale * sqrt(d->top), 1);
+        if (!isnan(d->rise)) {
+          double level = (crossing - d->rise >= 2 * window) ? scale * sqrt(d->top) : d->peak;
+          double span = level - d->rise_floor;
+          double rise = EdgeFromCrossing(d->rise, (d->rise_threshold - d->rise_floor) / span, window);
+          double fall = EdgeFromCrossing(crossing, (level - threshold) / span, window);
+
+          d->pulse(d, rise, fall - rise);
+        } else {
+          double fall = EdgeFromCrossing(crossing, (d->peak - threshold) / (d->peak - d->rise_floor), window);
+
+          d->pulse(d, NAN, fall - d->seeded);
+        }
+        d->fall = crossing;
+        d->bottom = d->power[j];
+      }
+      d->high = high;
+      threshold = fmax((d->peak + d->floor) / 2, MIN_LEVEL);
+      limit = (threshold / scale) * (threshold / scale);
+    }
+    state = (MaskVector){0} - d->high;
+    top = (FloatVector){0} + d->top, bottom = (FloatVector){0} + d->bottom;
+  }
+  for (int k = 0; k < VECTOR_FLOATS; k++) d->top = fmaxf(d->top, top[k]), d->bottom = fminf(d->bottom, bottom[k]);
+  d->last_i = d->out_i[n - 1], d->last_q = d->out_q[n - 1];
+}
+
+/*
+ * Seconds from an edge to the nearest whole second of the input, which
+ * for a render is on time.
+ */
+double OnTimeError(double edge) {
+  double seconds = (edge + InputPhase) / SampleRate;
+  double error = seconds - round(seconds);
+
+  Errors.count++;
+  Errors.sum += error;
+  Errors.sum_squares += error * error;
+  if (fabs(error) > Errors.max) Errors.max = fabs(error);
+  return error;
+}
+
+/*
+ * IRIG-B: 2, 5 or 8 ms of carrier for 0, 1 and position identifier; a
+ * frame starts at the second of two identifiers in a row.
+ */
+void IrigPulse(struct Detector *d, double start, double length) {
+  double ms = 1000. * length / SampleRate;
+  int symbol = (ms < 3.5) ? 0 : (ms < 6.5) ? 1 : IRIG_MARKER;
+
+  (void)d;
+  if (isnan(start)) return; /* cut by the start of the input */
+  if (symbol == IRIG_MARKER && LastSymbol == IRIG_MARKER) {
+    if (FramePosition > 0) BadFrames++; /* a frame cut short */
+    FramePosition = 0;
+    FrameStart = start;
+    FrameBits[0] = FrameBits[1] = 0;
+    FrameMarkers[0] = 1, FrameMarkers[1] = 0;
+  } else if (FramePosition >= 0) {
+    if (start - LastRise > 0.015 * SampleRate) { /* lost symbols */
+      BadFrames++;
+      FramePosition = -1;
+    } else {
+      if (symbol == 1) FrameBits[FramePosition / 64] |= 1ULL << (FramePosition % 64);
+      if (symbol == IRIG_MARKER) FrameMarkers[FramePosition / 64] |= 1ULL << (FramePosition % 64);
+      if (FramePosition == IRIG_FRAME_BITS - 1) DecodeIrigFrame();
+    }
+  }
+  if (FramePosition >= 0) FramePosition++;
+  LastSymbol = symbol;
+  LastRise = start;
+}
+
+static int IrigBits(int position, int n) {
+  int value = 0;
+
+  for (int i = n - 1; i >= 0; i--) value = (value << 1) | ((FrameBits[(position + i) / 64] >> ((position + i) % 64)) & 1);
+  return value;
+}
+
+/* BCD digits of bits units, units + 1, ... and tens at tens, ...; -1 if
+ * a digit is over 9. */
+static int IrigBcd(int units, int tens, int tens_bits) {
+  int low = IrigBits(units, 4), high = IrigBits(tens, tens_bits);
+
+  return (low > 9 || high > 9) ? -1 : 10 * high + low;
+}
+
+void DecodeIrigFrame(void) {
+  uint64_t markers[2] = {1, 0};
+  double error = OnTimeError(FrameStart);
+
+  FramePosition = -1;
+  for (int p = 9; p < IRIG_FRAME_BITS; p += 10) markers[p / 64] |= 1ULL << (p % 64);
+
+  int seconds = IrigBcd(1, 6, 3);
+  int minutes = IrigBcd(10, 15, 3);
+  int hours = IrigBcd(20, 25, 2);
+  int days = IrigBcd(30, 35, 4);
+  int hundreds = IrigBits(40, 2);
+  int years = IrigBcd(50, 55, 4);
+  int controls = IrigBits(60, 9) | IrigBits(70, 9) << 9;
+  int sbs = IrigBits(80, 9) | IrigBits(90, 9) << 9;
+
+  if (FrameMarkers[0] != markers[0] || FrameMarkers[1] != markers[1] || seconds < 0 || minutes < 0 || hours < 0 ||
+      days < 0 || years < 0) {
+    BadFrames++;
+    if (!Quiet) printf("bad frame at %.6f s\n", FrameStart / SampleRate);
+    return;
+  }
+  if (IrigIeee) {
+    uint64_t before = FrameBits[1] & ((1ULL << (IRIG_PARITY_POSITION - 64)) - 1);
+    int parity = (__builtin_popcountll(FrameBits[0]) + __builtin_popcountll(before)) & 1;
+
+    if (parity != ((controls >> 14) & 1)) {
+      BadFrames++;
+      if (!Quiet) printf("bad parity at %.6f s\n", FrameStart / SampleRate);
+      return;
+    }
+  }
+  FramesDecoded++;
+  if (Quiet) return;
+
+  printf("%02d %03d %02d:%02d:%02d  sbs %05d  ctl %05X", years, days + 100 * hundreds, hours, minutes, seconds, sbs,
+         controls);
+  if (IrigIeee) {
+    double offset = ((controls >> 5) & 0xF) + ((controls & 0x200) ? 0.5 : 0);
+
+    printf("  lsp %d ls %d dsp %d dst %d offset %+4.1f quality %X parity ok", controls & 1, (controls >> 1) & 1,
+           (controls >> 2) & 1, (controls >> 3) & 1, (controls & 0x10) ? -offset : offset, (controls >> 10) & 0xF);
+  }
+  printf("  on-time %+7.1f us\n", 1e6 * error);
+}
+
+/*
+ * WWV/H: each second a 5 ms tick of the sync tone, except at 29 and 59,
+ * then after 30 ms, 170, 470 or 770 ms of 100 Hz for 0, 1 and position
+ * identifier.  A minute starts with 800 ms of the sync tone, or of
+ * 1500 Hz for an hour.
+ */
+void WwvSyncPulse(struct Detector *d, double start, double length) {
+  double ms = 1000. * length / SampleRate;
+
+  if (isnan(start)) { /* under way at the start of the input: a minute pulse starts from its fall */
+    if (ms > WWV_TICK_MAX_MS) {
+      StartWwvMinute(d->seeded + length - WWV_SYNC_MS / 1000. * SampleRate, FALSE);
+      WwvTicks[0] = NAN;
+    }
+  } else if (ms > WWV_MINUTE_MS) {
+    StartWwvMinute(start, FALSE);
+  } else if (ms > WWV_TICK_MIN_MS && ms < WWV_TICK_MAX_MS && isnan(MinuteStart)) {
+    FindWwvMinute(start);
+  } else if (ms > WWV_TICK_MIN_MS && ms < WWV_TICK_MAX_MS) {
+    long second = lround((start - MinuteStart) / SampleRate);
+    if (second > 0 && second < WWV_SECONDS) WwvTicks[second] = start;
+  }
+}
+
+void WwvHourPulse(struct Detector *d, double start, double length) {
+  if (1000. * length / SampleRate <= WWV_MINUTE_MS) return;
+  if (isnan(start)) {
+    StartWwvMinute(d->seeded + length - WWV_SYNC_MS / 1000. * SampleRate, TRUE);
+    WwvTicks[0] = NAN;
+  } else {
+    StartWwvMinute(start, TRUE);
+  }
+}
+
+void WwvDataPulse(struct Detector *d, double start, double length) {
+  double ms = 1000. * length / SampleRate;
+
+  (void)d;
+  if (isnan(start)) return;
+  if (isnan(MinuteStart) && isnan(FirstTick)) FirstTick = start - WWV_DATA_DELAY_MS / 1000. * SampleRate;
+  double from = isnan(MinuteStart) ? FirstTick : MinuteStart;
+  long second = lround((start - from) / SampleRate - WWV_DATA_DELAY_MS / 1000.);
+  if (second >= !isnan(MinuteStart) && second < WWV_SECONDS)
+    WwvSymbols[second] = (ms < 320) ? 0 : (ms < 620) ? 1 : WWV_PI;
+}
+
+/*
+ * Until a sync pulse starts a minute, ticks and data are kept by second
+ * from the first of them; a tick two seconds after the last is at 30, as
+ * there is none at 29, and places them in their minute.  So the first
+ * minute of the input is decoded even though it started before it.
+ */
+void FindWwvMinute(double tick) {
+  if (isnan(FirstTick)) FirstTick = tick;
+  long second = lround((tick - FirstTick) / SampleRate);
+
+  if (!isnan(LastTick) && lround((tick - LastTick) / SampleRate) == 2 && second >= 0 && second <= 30) {
+    long shift = 30 - second;
+
+    memmove(WwvTicks + shift, WwvTicks, sizeof(double) * (WWV_SECONDS - shift));
+    memmove(WwvSymbols + shift, WwvSymbols, sizeof(int) * (WWV_SECONDS - shift));
+    for (int i = 0; i < shift; i++) WwvSymbols[i] = -1, WwvTicks[i] = NAN;
+    MinuteStart = tick - 30. * SampleRate;
+    MinuteHour = FALSE;
+    MinuteFromGap = TRUE;
+    second = 30;
+  }
+  if (second >= 0 && second < WWV_SECONDS) WwvTicks[second] = tick;
+  LastTick = tick;
+}
+
+/*
+ * The hour tone leaks into the sync detector too, so both may see the
+ * same pulse; the hour detector's edge is the one to believe.
+ */
+void StartWwvMinute(double start, int hour) {
+  if (!isnan(MinuteStart) && fabs(start - MinuteStart) < 0.1 * SampleRate) {
+    if (hour) MinuteStart = WwvTicks[0] = start, MinuteHour = TRUE;
+    return;
+  }
+  DecodeWwvMinute(FALSE);
+  if (isnan(MinuteStart)) ClearWwvMinute(); /* ticks and data from before the first */
+  MinuteStart = WwvTicks[0] = start;
+  MinuteHour = hour;
+}
+
+static int WwvDigit(int position) {
+  int value = 0;
+
+  for (int i = 3; i >= 0; i--) value = (value << 1) | (WwvSymbols[position + i] == 1);
+  return value;
+}
+
+void ClearWwvMinute(void) {
+  for (int i = 0; i < WWV_SECONDS; i++) WwvSymbols[i] = -1, WwvTicks[i] = NAN;
+  MinuteStart = FirstTick = LastTick = NAN;
+  MinuteFromGap = FALSE;
+}
+
+/* At the start or end of the input, a minute cut short is left out. */
+void DecodeWwvMinute(int end) {
+  double errors[WWV_SECONDS];
+  int good = TRUE;
+
+  if (isnan(MinuteStart) || (end && WwvSymbols[WWV_SECONDS - 2] < 0)) return;
+  if (MinuteFromGap && WwvSymbols[1] < 0) {
+    ClearWwvMinute();
+    return;
+  }
+  for (int i = 0; i < WWV_SECONDS; i++) errors[i] = isnan(WwvTicks[i]) ? NAN : OnTimeError(WwvTicks[i]);
+  for (int i = 1; i < WWV_SECONDS - 1; i++) {
+    if (WwvSymbols[i] < 0 || (WwvSymbols[i] == WWV_PI) != (i % 10 == 9)) good = FALSE;
+  }
+
+  if (!good) {
+    BadFrames++;
+    if (!Quiet) printf("bad minute at %.6f s\n", MinuteStart / SampleRate);
+  } else {
+    int years = WwvDigit(4) + 10 * WwvDigit(51);
+    int minutes = WwvDigit(10) + 10 * (WwvDigit(15) & 7);
+    int hours = WwvDigit(20) + 10 * (WwvDigit(25) & 3);
+    int days = WwvDigit(30) + 10 * WwvDigit(35) + 100 * (WwvDigit(40) & 3);
+    double dut1 = (WwvDigit(56) & 7) / 10.;
+
+    FramesDecoded++;
+    for (int i = 0; i < WWV_SECONDS && !Quiet; i++) {
+      if (isnan(errors[i])) continue;
+      printf("%02d %03d %02d:%02d:%02d", years, days, hours, minutes, i);
+      if (i == 0)
+        printf("  %s  dst %d%d  leap %d  dut1 %+.1f", MinuteHour ? "hour" : "minute", WwvSymbols[55] == 1,
+               WwvSymbols[2] == 1, WwvSymbols[3] == 1, WwvSymbols[50] == 1 ? dut1 : -dut1);
+      printf("  on-time %+7.1f us\n", 1e6 * errors[i]);
+    }
+  }
+
+  ClearWwvMinute();
+}
+
+void Help(void) {
+  printf("\n\nTime Code Decoding - IRIG-B or WWV, for signals from tg2");
+  printf("\n\nUsage: tg2dec [option]... [file]");
+  printf("\n\nDecodes a WAV (PCM or float) or raw float file, or stdin if none or -, printing each frame or");
+  printf("\nsecond decoded and its on-time marker error from the nearest whole second of the input.");
+  printf("\nrtp:[address:]port receives tg2's RTP stream instead, until it stops, checking for lost packets");
+  printf("\nand pacing jitter, with on-time errors against the system clock.  Exits 2 if any frames were bad, or");
+  printf("\n3 if any packets were lost or late or the jitter peaked over -J.");
+  printf("\n\nOptions:");
+  printf("\n         -C channel                     Channel to decode (default 0)");
+  printf("\n         -f format_type                 i or 2 = IRIG-B, 3 = IRIG-B w/IEEE 1344 (default), w = WWV(H)");
+  printf("\n         -h                             Help");
+  printf("\n         -J microseconds                Highest RTP jitter allowed (default any)");
+  printf("\n         -q                             Only print the summary");
+  printf("\n         -r sample_rate                 Sample rate of raw float or RTP input");
+  printf("\n         -t                             WWVH sync tone 1200 Hz (default 1000 Hz)");
+  printf("\n\n");
+}